@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2025 taylor.fish <contact@taylor.fish>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Connecting our ports to others by regular expression. Requires
+// _GNU_SOURCE (for pipe2()).
+//
+// JACK's port registration callback only writes a byte to a pipe. The main
+// thread waits until registrations have stopped arriving for a moment, then
+// makes every missing connection in one pass, so a whole rig starting at
+// once is wired up together rather than one port at a time.
+#ifndef JACL_AUTOCONNECT_H
+#define JACL_AUTOCONNECT_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <jack/jack.h>
+#include <regex.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define AUTOCONNECT_MAX_RULES 16
+
+// How long (in milliseconds) to wait after the last registration before
+// connecting.
+#define AUTOCONNECT_SETTLE 20
+
+#define AUTOCONNECT_USAGE "\
+  -C, --connect [<port>=]<regex>\n\
+                      Connect to every port, now or later registered,\n\
+                      whose full name (client:port) matches <regex>, a\n\
+                      POSIX extended regular expression that must match\n\
+                      the whole name. Only ports of the same type and the\n\
+                      opposite direction are connected. With '<port>=',\n\
+                      only our port of that name is connected. May be\n\
+                      given multiple times.\n\
+"
+
+typedef struct AutoConnectRule {
+    // NULL for all of our ports.
+    char *port;
+    regex_t regex;
+} AutoConnectRule;
+
+typedef struct AutoConnect {
+    AutoConnectRule rules[AUTOCONNECT_MAX_RULES];
+    size_t nrules;
+    // Written by JACK's registration callback.
+    int notify_read;
+    int notify_write;
+    bool pending;
+    struct timespec last_notify;
+} AutoConnect;
+
+static inline bool autoconnect_init(AutoConnect * const ac) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) != 0) {
+        perror("pipe2() failed");
+        return false;
+    }
+    ac->notify_read = fds[0];
+    ac->notify_write = fds[1];
+    return true;
+}
+
+static inline bool autoconnect_add_rule(
+    AutoConnect * const ac,
+    const char * const spec
+) {
+    if (ac->nrules >= AUTOCONNECT_MAX_RULES) {
+        fputs("too many connect rules\n", stderr);
+        return false;
+    }
+    AutoConnectRule * const rule = &ac->rules[ac->nrules];
+    const char *pattern = spec;
+    const char * const eq = strchr(spec, '=');
+    rule->port = NULL;
+    if (eq != NULL) {
+        rule->port = strndup(spec, eq - spec);
+        if (rule->port == NULL) {
+            abort();
+        }
+        pattern = eq + 1;
+    }
+
+    // Anchor the expression so it must match the whole name.
+    const size_t len = strlen(pattern);
+    char * const anchored = malloc(len + 5);
+    if (anchored == NULL) {
+        abort();
+    }
+    anchored[0] = '^';
+    anchored[1] = '(';
+    memcpy(anchored + 2, pattern, len);
+    memcpy(anchored + 2 + len, ")$", 3);
+    const int status =
+        regcomp(&rule->regex, anchored, REG_EXTENDED | REG_NOSUB);
+    free(anchored);
+    if (status != 0) {
+        char message[128];
+        regerror(status, &rule->regex, message, sizeof(message));
+        fprintf(stderr, "bad connect rule: %s: %s\n", spec, message);
+        free(rule->port);
+        return false;
+    }
+    ++ac->nrules;
+    return true;
+}
+
+static inline void autoconnect_handle_registration(
+    const jack_port_id_t port,
+    const int registered,
+    void * const arg
+) {
+    (void)port;
+    if (!registered) {
+        return;
+    }
+    const AutoConnect * const ac = arg;
+    const int saved_errno = errno;
+    if (write(ac->notify_write, "r", 1) < 0) {
+        // A notification is already pending.
+    }
+    errno = saved_errno;
+}
+
+// Registers the callback; call before jack_activate(). Does nothing if
+// there are no rules.
+static inline bool autoconnect_watch(
+    AutoConnect * const ac,
+    jack_client_t * const client
+) {
+    if (ac->nrules == 0) {
+        return true;
+    }
+    const int status = jack_set_port_registration_callback(
+        client,
+        autoconnect_handle_registration,
+        ac
+    );
+    if (status != 0) {
+        fprintf(
+            stderr,
+            "jack_set_port_registration_callback() failed: %d\n",
+            status
+        );
+        return false;
+    }
+    // Connect whatever already exists once the client is activated.
+    ac->pending = true;
+    clock_gettime(CLOCK_MONOTONIC, &ac->last_notify);
+    return true;
+}
+
+// Reads pending notifications; the connections are made once they settle.
+static inline void autoconnect_read(AutoConnect * const ac) {
+    char buf[64];
+    bool any = false;
+    while (read(ac->notify_read, buf, sizeof(buf)) > 0) {
+        any = true;
+    }
+    if (any) {
+        ac->pending = true;
+        clock_gettime(CLOCK_MONOTONIC, &ac->last_notify);
+    }
+}
+
+// How long poll() may wait before the next pass, or -1 if none is pending.
+static inline int autoconnect_timeout(const AutoConnect * const ac) {
+    if (ac->nrules == 0 || !ac->pending) {
+        return -1;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const long elapsed = (now.tv_sec - ac->last_notify.tv_sec) * 1000 +
+        (now.tv_nsec - ac->last_notify.tv_nsec) / 1000000;
+    const long left = AUTOCONNECT_SETTLE - elapsed;
+    return left > 0 ? (int)left : 0;
+}
+
+static inline void autoconnect_port(
+    const AutoConnect * const ac,
+    jack_client_t * const client,
+    jack_port_t * const port
+) {
+    const char * const name = jack_port_name(port);
+    const char * const short_name = jack_port_short_name(port);
+    const bool input = jack_port_flags(port) & JackPortIsInput;
+    const char ** const peers = jack_get_ports(
+        client,
+        NULL,
+        jack_port_type(port),
+        input ? JackPortIsOutput : JackPortIsInput
+    );
+    if (peers == NULL) {
+        return;
+    }
+    for (size_t i = 0; peers[i] != NULL; ++i) {
+        bool matched = false;
+        for (size_t r = 0; r < ac->nrules && !matched; ++r) {
+            const AutoConnectRule * const rule = &ac->rules[r];
+            matched =
+                (rule->port == NULL || strcmp(rule->port, short_name) == 0) &&
+                regexec(&rule->regex, peers[i], 0, NULL, 0) == 0;
+        }
+        if (!matched || jack_port_connected_to(port, peers[i])) {
+            continue;
+        }
+        const int status = input ?
+            jack_connect(client, peers[i], name) :
+            jack_connect(client, name, peers[i]);
+        if (status != 0 && status != EEXIST) {
+            fprintf(
+                stderr,
+                "could not connect %s and %s: %d\n",
+                name,
+                peers[i],
+                status
+            );
+        }
+    }
+    jack_free(peers);
+}
+
+// Makes any missing connections if registrations have settled. `ports` has
+// `nports` entries; NULL entries are skipped.
+static inline void autoconnect_apply(
+    AutoConnect * const ac,
+    jack_client_t * const client,
+    jack_port_t * const * const ports,
+    const size_t nports
+) {
+    if (client == NULL || autoconnect_timeout(ac) != 0) {
+        return;
+    }
+    ac->pending = false;
+    for (size_t i = 0; i < nports; ++i) {
+        if (ports[i] != NULL) {
+            autoconnect_port(ac, client, ports[i]);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2025 taylor.fish <contact@taylor.fish>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// CRC-32C (Castagnoli), using the SSE4.2 crc32 instruction when the CPU has
+// it and a lookup table otherwise. Call crc32c_init() once, before any
+// threads that use crc32c() start.
+#ifndef JACL_CRC32C_H
+#define JACL_CRC32C_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define CRC32C_SSE42 1
+#endif
+
+static uint32_t crc32c_table[256];
+static bool crc32c_hardware;
+
+static inline uint32_t crc32c_software(
+    uint32_t crc,
+    const unsigned char *p,
+    size_t len
+) {
+    for (; len > 0; --len) {
+        crc = crc32c_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef CRC32C_SSE42
+__attribute__((target("sse4.2")))
+static inline uint32_t crc32c_sse42(
+    uint32_t crc,
+    const unsigned char *p,
+    size_t len
+) {
+    uint64_t crc64 = crc;
+    for (; len >= 8; len -= 8, p += 8) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        crc64 = __builtin_ia32_crc32di(crc64, word);
+    }
+    crc = (uint32_t)crc64;
+    for (; len > 0; --len) {
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+static inline void crc32c_init(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = crc >> 1 ^ (crc & 1 ? 0x82f63b78u : 0);
+        }
+        crc32c_table[i] = crc;
+    }
+#ifdef CRC32C_SSE42
+    __builtin_cpu_init();
+    crc32c_hardware = __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static inline uint32_t crc32c(const void * const data, const size_t len) {
+    uint32_t crc = 0xffffffffu;
+#ifdef CRC32C_SSE42
+    if (crc32c_hardware) {
+        return ~crc32c_sse42(crc, data, len);
+    }
+#endif
+    return ~crc32c_software(crc, data, len);
+}
+
+#endif
@@ -14,31 +14,140 @@
  * You should have received a copy of the GNU General Public License
  * along with this program. If not, see <https://www.gnu.org/licenses/>.
  */
-#define _POSIX_C_SOURCE 1
+#define _GNU_SOURCE
+#include "autoconnect.h"
+#include "expr.h"
+#include "osc.h"
+#include "probes.h"
+#include "reconnect.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <jack/jack.h>
 #include <jack/metadata.h>
+#include <math.h>
 #include <poll.h>
 #include <signal.h>
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#define MAX_PORTS 64
+#define MAX_VARS 32
+// Automation lanes are indexed in buckets of at least 2^AUTO_BUCKET_SHIFT
+// frames. Sparse lanes use larger buckets, so that a lane never has more
+// buckets than breakpoints.
+#define AUTO_BUCKET_SHIFT 12
+// Quantized values are first bounded by this: beyond it, floats can't hold
+// every integer anyway, and it keeps the conversion to an integer defined.
+#define QUANTIZE_LIMIT (1 << 24)
+
 static int sigfd_write;
 
 static const char *USAGE = "\
-Usage: %s [client-name]\n\
+Usage: %s [options] [client-name]\n\
+\n\
+Provides CV output ports whose values are determined by standard input. Each\n\
+line contains one or more whitespace-separated assignments of the form\n\
+<port>=<value>, where <value> is a base-10 floating-point number. A bare\n\
+<value> sets the first port.\n\
 \n\
-Provides a CV output port whose value is determined by standard input (one \n\
-base-10 floating-point number per line).\n\
+All assignments on a line are applied together: every port moves in the\n\
+same period. A token of the form ~<seconds> crossfades all ports from their\n\
+current values to the new ones over that time.\n\
 \n\
 [client-name] is the name of the JACK client to create; if not provided, the\n\
 default is 'jacl-cv'.\n\
+\n\
+Options:\n\
+  -p, --port <name>   Create an output port called <name>. May be given\n\
+                      multiple times. If omitted, a single port called\n\
+                      'value' is created.\n\
+  -u, --udp <[host:]port>\n\
+                      Also accept OSC messages on this UDP address. A\n\
+                      message sent to /<name> sets port <name> to its first\n\
+                      numeric (int or float) argument.\n\
+  -a, --address <address>=<name>\n\
+                      Map an additional OSC address to port <name>.\n\
+                      Addresses are matched exactly; patterns are not\n\
+                      supported. All messages in one OSC packet (such as\n\
+                      a bundle) are applied together, like one line of\n\
+                      standard input.\n\
+  -f, --fade <seconds>\n\
+                      Default crossfade time (default: 0).\n\
+  -A, --automation <file>\n\
+                      Play back the automation in <file>, following the\n\
+                      JACK transport. Ports with automation ignore other\n\
+                      input. See below for the file format.\n\
+  -e, --expr <name>=<expression>\n\
+                      Compute port <name> from <expression> at every\n\
+                      sample, ignoring other input. See below.\n\
+" AUTOCONNECT_USAGE "\
+\n\
+Mapping options apply to the port called <name>, or to all ports if\n\
+'<name>=' is omitted. Each input value is clamped, then quantized, then\n\
+mapped through the curve:\n\
+\n\
+  -c, --clamp [<name>=]<min>:<max>\n\
+                      Clamp input values to [<min>, <max>].\n\
+  -q, --quantize [<name>=]<degrees>\n\
+                      Treat input values as MIDI note numbers and round\n\
+                      them to the nearest note of a scale, given as a\n\
+                      comma-separated list of semitones above the tonic\n\
+                      (e.g., 0,2,4,5,7,9,11 for a major scale in C).\n\
+  -m, --map [<name>=]<curve>\n\
+                      Map input values through <curve>:\n\
+                        lin:<min>:<max>  0..1 to <min>..<max> linearly.\n\
+                        exp:<min>:<max>  0..1 to <min>..<max>\n\
+                                         exponentially (<min> and <max>\n\
+                                         must be non-zero and have the\n\
+                                         same sign).\n\
+                        voct[:<ref>[:<octave>]]\n\
+                                         MIDI note numbers to 1V/octave\n\
+                                         pitch: note <ref> (default: 60)\n\
+                                         maps to 0, and each octave adds\n\
+                                         <octave> (default: 0.1, i.e.,\n\
+                                         1 V when 1.0 is 10 V).\n\
+\n\
+Clamping messages are printed at most once per second.\n\
+";
+
+// Split from USAGE to stay within the string length limit of ISO C.
+static const char *USAGE_FORMATS = "\
+\n\
+Automation files use native byte order and consist of a 16-byte header\n\
+(the 8 bytes 'JACLAUT1', a uint32 breakpoint count, and 4 reserved bytes)\n\
+followed by 16-byte breakpoints sorted by frame:\n\
+\n\
+  uint64 frame   Transport frame of the breakpoint, at most 2^32 - 1.\n\
+  uint16 port    Index of the port (in the order of --port options).\n\
+  uint8  curve   0 to hold the value until the port's next breakpoint, or\n\
+                 1 to ramp linearly to it.\n\
+  uint8  (reserved)\n\
+  float  value   Output value (not mapped).\n\
+\n\
+Expressions use the operators + - * / % ^ < > <= >= == != and parentheses,\n\
+and may refer to:\n\
+\n\
+  t          Seconds since the client was activated.\n\
+  pos        Transport position in seconds.\n\
+  beat       Transport position in beats (0 without BBT information).\n\
+  pi         3.14159...\n\
+  <port>     The output of another port. Ports with expressions may only\n\
+             refer to earlier ports with expressions.\n\
+  $<var>     A variable, initially 0, set with $<var>=<value> on standard\n\
+             input (as part of that line's scene).\n\
+\n\
+Functions: sin cos tan abs floor ceil sqrt exp log min max pow\n\
+clamp(x,lo,hi) mix(a,b,t), and saw sqr tri (period 1, range -1 to 1).\n\
+Expression output is not mapped.\n\
 ";
 
 static void usage(FILE * const stream, const char * const arg0) {
@@ -54,9 +163,10 @@ static void usage(FILE * const stream, const char * const arg0) {
         bin = "jacl-cv";
     }
     fprintf(stream, USAGE, bin);
+    fputs(USAGE_FORMATS, stream);
 }
 
-static void on_exit(const int signum) {
+static void handle_exit_signal(const int signum) {
     (void)signum;
     close(sigfd_write);
 }
@@ -65,7 +175,7 @@ static bool install_exit_handler(const int signum) {
     sigset_t mask;
     sigemptyset(&mask);
     const struct sigaction act = {
-        .sa_handler = on_exit,
+        .sa_handler = handle_exit_signal,
         .sa_mask = mask,
         .sa_flags = 0,
     };
@@ -95,51 +205,750 @@ static bool set_nonblock(const int fd) {
     return true;
 }
 
+// Matches option `shortopt` or `longopt` at `argv[*argi]`, accepting both
+// "--long value" and "--long=value". On a match, `*value` is set to the
+// option's argument (NULL if missing) and `*argi` is advanced past it.
+static bool match_option(
+    const int argc,
+    char ** const argv,
+    int * const argi,
+    const char * const shortopt,
+    const char * const longopt,
+    const char ** const value
+) {
+    const char * const arg = argv[*argi];
+    const size_t longlen = strlen(longopt);
+    if (strncmp(arg, longopt, longlen) == 0 && arg[longlen] == '=') {
+        *value = arg + longlen + 1;
+        return true;
+    }
+    if (strcmp(arg, shortopt) != 0 && strcmp(arg, longopt) != 0) {
+        return false;
+    }
+    *value = *argi + 1 < argc ? argv[++*argi] : NULL;
+    return true;
+}
+
+typedef struct Mapping Mapping;
+typedef float (*MapFn)(const Mapping *mapping, float value);
+
+// How input values of a port are turned into output values. The functions
+// are chosen once at startup, so mapping a value doesn't branch on the
+// configuration.
+struct Mapping {
+    float min;
+    float max;
+    MapFn quantize;
+    MapFn curve;
+    float a;
+    float b;
+    // Nearest scale note (as an offset from the octave) for each semitone.
+    signed char scale[12];
+};
+
+static float map_identity(const Mapping * const mapping, const float value) {
+    (void)mapping;
+    return value;
+}
+
+static float map_linear(const Mapping * const mapping, const float value) {
+    return mapping->a + value * mapping->b;
+}
+
+static float map_exp(const Mapping * const mapping, const float value) {
+    return mapping->a * expf(value * mapping->b);
+}
+
+static float map_voct(const Mapping * const mapping, const float value) {
+    return (value - mapping->a) * mapping->b;
+}
+
+static float map_quantize(const Mapping * const mapping, const float value) {
+    const float bounded =
+        fminf(fmaxf(value, -QUANTIZE_LIMIT), QUANTIZE_LIMIT);
+    const long note = lroundf(bounded);
+    const long degree = (note % 12 + 12) % 12;
+    return (float)(note - degree + mapping->scale[degree]);
+}
+
+static float apply_mapping(const Mapping * const mapping, const float value) {
+    const float clamped = fminf(fmaxf(value, mapping->min), mapping->max);
+    return mapping->curve(mapping, mapping->quantize(mapping, clamped));
+}
+
+typedef struct AutoHeader {
+    char magic[8];
+    uint32_t count;
+    uint32_t reserved;
+} AutoHeader;
+
+typedef struct AutoPoint {
+    uint64_t frame;
+    uint16_t port;
+    uint8_t curve;
+    uint8_t reserved;
+    float value;
+} AutoPoint;
+
+enum {
+    CURVE_HOLD = 0,
+    CURVE_LINEAR = 1,
+};
+
+// The breakpoints of one port.
+typedef struct Lane {
+    // Indices of the port's breakpoints in the file, in order.
+    uint32_t *points;
+    uint32_t count;
+    // For each bucket of frames, the position in `points` of the first
+    // breakpoint at or after the start of the bucket.
+    uint32_t *buckets;
+    size_t nbuckets;
+    unsigned bucket_shift;
+    // Process thread only: the position in `points` of the next breakpoint,
+    // and how far ahead of the transport the lane was last rendered.
+    uint32_t next;
+    jack_nframes_t shift;
+} Lane;
+
+typedef struct Automation {
+    const AutoPoint *points;
+    Lane lanes[MAX_PORTS];
+    // Process thread only.
+    bool located;
+    jack_nframes_t next_frame;
+} Automation;
+
+typedef struct Scene {
+    float values[MAX_PORTS];
+    float vars[MAX_VARS];
+    // Length of the crossfade from the previous scene, in frames.
+    jack_nframes_t fade;
+} Scene;
+
+// Expression inputs: blocks for t, pos and beat, then one for each port.
+enum {
+    INPUT_T,
+    INPUT_POS,
+    INPUT_BEAT,
+    INPUT_PORTS,
+};
+
 typedef struct State {
     jack_client_t *client;
-    jack_port_t *port;
-    _Atomic float value;
+    size_t nports;
+    const char *names[MAX_PORTS];
+    jack_port_t *ports[MAX_PORTS];
+    OscTable osc_table;
+    jack_nframes_t sample_rate;
+    // Default crossfade time, in seconds.
+    float fade_time;
+    Mapping mappings[MAX_PORTS];
+    Automation automation;
+    // Expressions by port (NULL for ports without one), and their source.
+    Expr *exprs[MAX_PORTS];
+    const char *expr_texts[MAX_PORTS];
+    bool has_exprs;
+    const char *var_names[MAX_VARS];
+    size_t nvars;
+    // Values clamped since the last report, the port of the latest one, and
+    // when the last report was printed.
+    unsigned long clamped;
+    size_t clamp_port;
+    struct timespec clamp_time;
+
+    // Scenes are double-buffered. The main thread fills
+    // `scenes[(published + 1) % 2]` and then increments `published`;
+    // process() reads `published` once per period and acknowledges it in
+    // `acked`, after which the other buffer may be reused.
+    Scene scenes[2];
+    atomic_uint published;
+    atomic_uint acked;
+
+    // The playback latency of each port, from the latency callback.
+    atomic_uint latencies[MAX_PORTS];
+
+    // Main thread only: the last committed scene, whether it still has to
+    // be published, and the scene being built.
+    Scene committed;
+    bool unpublished;
+    Scene staged;
+    bool staged_dirty;
+    bool staged_error;
+
+    // Process thread only.
+    unsigned seen;
+    jack_nframes_t fade_pos;
+    jack_nframes_t fade_len;
+    float from[MAX_PORTS];
+    float to[MAX_PORTS];
+    float out[MAX_PORTS];
+    float vars[MAX_VARS];
+    // Frames since activation, and expression inputs: blocks for t, pos and
+    // beat, then a copy of each port's output, in double precision.
+    uint64_t frames;
+    double input_blocks[INPUT_PORTS + MAX_PORTS][EXPR_BLOCK];
+    ExprStack stack;
+    Reconnect reconnect;
+    AutoConnect autoconnect;
 } State;
 
 static int close_and_fail(jack_client_t * const client) {
-    jack_client_close(client);
+    // The client is NULL while we wait for the JACK server to come back.
+    if (client != NULL) {
+        jack_client_close(client);
+    }
     return EXIT_FAILURE;
 }
 
+// Picks up a newly published scene, if any. All ports start moving towards
+// it in the same period.
+static void load_scene(State * const state) {
+    const unsigned seq =
+        atomic_load_explicit(&state->published, memory_order_acquire);
+    if (seq == state->seen) {
+        return;
+    }
+    const Scene * const scene = &state->scenes[seq % 2];
+    for (size_t p = 0; p < state->nports; ++p) {
+        state->from[p] = state->out[p];
+        state->to[p] = scene->values[p];
+    }
+    memcpy(state->vars, scene->vars, sizeof(state->vars));
+    state->fade_len = scene->fade;
+    state->fade_pos = 0;
+    state->seen = seq;
+    atomic_store_explicit(&state->acked, seq, memory_order_release);
+}
+
+static void render(
+    State * const state,
+    const size_t p,
+    float * const buffer,
+    const jack_nframes_t nframes
+) {
+    const float from = state->from[p];
+    const float to = state->to[p];
+    if (state->fade_pos >= state->fade_len) {
+        for (jack_nframes_t i = 0; i < nframes; ++i) {
+            buffer[i] = to;
+        }
+    } else {
+        const float step = 1.0f / state->fade_len;
+        const float delta = to - from;
+        for (jack_nframes_t i = 0; i < nframes; ++i) {
+            const float t = fminf((state->fade_pos + i + 1) * step, 1);
+            buffer[i] = from + delta * t;
+        }
+    }
+    if (nframes > 0) {
+        state->out[p] = buffer[nframes - 1];
+    }
+}
+
+// Sets `lane->next` to the first breakpoint after `frame`, starting from the
+// bucket containing `frame`.
+static void locate(
+    Lane * const lane,
+    const AutoPoint * const points,
+    const uint64_t frame
+) {
+    const uint64_t bucket = frame >> lane->bucket_shift;
+    uint32_t next = lane->count;
+    if (bucket < lane->nbuckets) {
+        next = lane->buckets[bucket];
+    }
+    while (next < lane->count && points[lane->points[next]].frame <= frame) {
+        ++next;
+    }
+    lane->next = next;
+}
+
+// Renders `nframes` frames of automation starting at transport frame
+// `frame`. If `rolling` is false, the value at `frame` is held.
+static void render_lane(
+    Lane * const lane,
+    const AutoPoint * const points,
+    float * const buffer,
+    const jack_nframes_t nframes,
+    const uint64_t frame,
+    const bool rolling
+) {
+    jack_nframes_t i = 0;
+    while (i < nframes) {
+        const uint64_t pos = frame + (rolling ? i : 0);
+        while (
+            lane->next < lane->count &&
+            points[lane->points[lane->next]].frame <= pos
+        ) {
+            ++lane->next;
+        }
+        jack_nframes_t end = nframes;
+        const AutoPoint *next = NULL;
+        if (lane->next < lane->count) {
+            next = &points[lane->points[lane->next]];
+            if (rolling && next->frame - frame < nframes) {
+                end = (jack_nframes_t)(next->frame - frame);
+            }
+        }
+        // Before the first breakpoint, hold its value.
+        const AutoPoint * const prev =
+            lane->next > 0 ? &points[lane->points[lane->next - 1]] : next;
+        if (next == NULL || prev == next || prev->curve != CURVE_LINEAR) {
+            for (; i < end; ++i) {
+                buffer[i] = prev->value;
+            }
+            continue;
+        }
+        const double slope =
+            (double)(next->value - prev->value) / (next->frame - prev->frame);
+        const float start = prev->value + (float)(slope * (pos - prev->frame));
+        const float step = rolling ? (float)slope : 0;
+        for (jack_nframes_t k = 0; i < end; ++i, ++k) {
+            buffer[i] = start + step * k;
+        }
+    }
+}
+
+static void render_automation(
+    State * const state,
+    float ** const buffers,
+    const jack_nframes_t nframes
+) {
+    Automation * const automation = &state->automation;
+    jack_position_t position;
+    const jack_transport_state_t transport =
+        jack_transport_query(state->client, &position);
+    const bool rolling = transport == JackTransportRolling;
+    const bool relocated =
+        !automation->located || position.frame != automation->next_frame;
+    for (size_t p = 0; p < state->nports; ++p) {
+        Lane * const lane = &automation->lanes[p];
+        if (lane->count == 0 || buffers[p] == NULL) {
+            continue;
+        }
+        // While rolling, render ahead by the port's playback latency, so
+        // values are heard at their transport frame.
+        const jack_nframes_t shift = !rolling ? 0 : atomic_load_explicit(
+            &state->latencies[p],
+            memory_order_relaxed
+        );
+        const uint64_t frame = (uint64_t)position.frame + shift;
+        if (relocated || shift != lane->shift) {
+            locate(lane, automation->points, frame);
+            lane->shift = shift;
+        }
+        render_lane(
+            lane,
+            automation->points,
+            buffers[p],
+            nframes,
+            frame,
+            rolling
+        );
+    }
+    automation->located = true;
+    automation->next_frame = position.frame + (rolling ? nframes : 0);
+}
+
+// Copies `buffer[off..off + n]` (or zeros, if it's NULL) into `block`.
+static void copy_output(
+    double * const block,
+    const float * const buffer,
+    const jack_nframes_t off,
+    const size_t n
+) {
+    for (size_t i = 0; i < n; ++i) {
+        block[i] = buffer == NULL ? 0 : buffer[off + i];
+    }
+}
+
+// Renders all expression ports, EXPR_BLOCK frames at a time. Ports are
+// evaluated in order, so an expression sees the finished output of earlier
+// ports for the same block.
+static void render_exprs(
+    State * const state,
+    float ** const buffers,
+    const jack_nframes_t nframes
+) {
+    jack_position_t position;
+    const jack_transport_state_t transport =
+        jack_transport_query(state->client, &position);
+    const bool rolling = transport == JackTransportRolling;
+    const double rate = state->sample_rate;
+    double beat = 0;
+    double beat_step = 0;
+    if (position.valid & JackPositionBBT) {
+        beat = (position.bar - 1) * (double)position.beats_per_bar +
+            (position.beat - 1) +
+            position.tick / position.ticks_per_beat;
+        beat_step = rolling ? position.beats_per_minute / 60 / rate : 0;
+    }
+
+    double (* const inputs)[EXPR_BLOCK] = state->input_blocks;
+    const double *blocks[INPUT_PORTS + MAX_PORTS];
+    for (size_t i = 0; i < INPUT_PORTS + state->nports; ++i) {
+        blocks[i] = inputs[i];
+    }
+    for (jack_nframes_t off = 0; off < nframes; off += EXPR_BLOCK) {
+        const size_t left = nframes - off;
+        const size_t n = left < EXPR_BLOCK ? left : EXPR_BLOCK;
+        expr_fill_ramp(
+            inputs[INPUT_T],
+            n,
+            (double)(state->frames + off) / rate,
+            1 / rate
+        );
+        expr_fill_ramp(
+            inputs[INPUT_POS],
+            n,
+            (double)(position.frame + (rolling ? off : 0)) / rate,
+            rolling ? 1 / rate : 0
+        );
+        expr_fill_ramp(
+            inputs[INPUT_BEAT],
+            n,
+            beat + beat_step * off,
+            beat_step
+        );
+        for (size_t p = 0; p < state->nports; ++p) {
+            copy_output(inputs[INPUT_PORTS + p], buffers[p], off, n);
+        }
+        for (size_t p = 0; p < state->nports; ++p) {
+            if (state->exprs[p] == NULL || buffers[p] == NULL) {
+                continue;
+            }
+            expr_eval(
+                state->exprs[p],
+                blocks,
+                state->vars,
+                &state->stack,
+                buffers[p] + off,
+                n
+            );
+            // Later expressions see this port's finished output.
+            copy_output(inputs[INPUT_PORTS + p], buffers[p], off, n);
+        }
+    }
+    for (size_t p = 0; p < state->nports; ++p) {
+        if (state->exprs[p] != NULL && nframes > 0) {
+            state->out[p] = buffers[p][nframes - 1];
+        }
+    }
+}
+
 static int process(const jack_nframes_t nframes, void * const arg) {
-    const State * const state = arg;
-    jack_port_t * const port = state->port;
-    if (port == NULL) {
-        return 0;
+    PROBE1(process_entry, nframes);
+    State * const state = arg;
+    load_scene(state);
+    float *buffers[MAX_PORTS];
+    for (size_t p = 0; p < state->nports; ++p) {
+        jack_port_t * const port = state->ports[p];
+        buffers[p] = NULL;
+        if (port == NULL) {
+            continue;
+        }
+
+        jack_default_audio_sample_t * const buffer =
+            jack_port_get_buffer(port, nframes);
+        if (buffer == NULL) {
+            PROBE2(process_return, nframes, -1);
+            return -1;
+        }
+        buffers[p] = buffer;
+        render(state, p, buffer, nframes);
+    }
+    if (state->automation.points != NULL) {
+        render_automation(state, buffers, nframes);
+    }
+    if (state->has_exprs) {
+        render_exprs(state, buffers, nframes);
+    }
+    state->frames += nframes;
+    if (state->fade_pos < state->fade_len) {
+        state->fade_pos += nframes;
+    }
+    PROBE2(process_return, nframes, 0);
+    return 0;
+}
+
+// Keeps each port's playback latency for automation. Output is generated
+// rather than captured, so the ports' capture latency stays zero.
+static void handle_latency(
+    const jack_latency_callback_mode_t mode,
+    void * const arg
+) {
+    State * const state = arg;
+    if (mode != JackPlaybackLatency) {
+        return;
+    }
+    for (size_t p = 0; p < state->nports; ++p) {
+        if (state->ports[p] == NULL) {
+            continue;
+        }
+        jack_latency_range_t range;
+        jack_port_get_latency_range(state->ports[p], mode, &range);
+        atomic_store_explicit(
+            &state->latencies[p],
+            range.max,
+            memory_order_relaxed
+        );
+    }
+}
+
+static jack_nframes_t fade_frames(
+    const State * const state,
+    const float time
+) {
+    return (jack_nframes_t)(time * state->sample_rate + 0.5f);
+}
+
+// Publishes the committed scene to process(), unless process() hasn't yet
+// picked up the previous one, in which case this returns false and the
+// main loop tries again later. Without a client, nothing reads the scenes,
+// so it's published right away; the new client's process() picks it up.
+static bool publish_scene(State * const state) {
+    if (!state->unpublished) {
+        return true;
+    }
+    const unsigned seq =
+        atomic_load_explicit(&state->published, memory_order_relaxed);
+    if (
+        state->client != NULL &&
+        atomic_load_explicit(&state->acked, memory_order_acquire) != seq
+    ) {
+        return false;
     }
+    state->scenes[(seq + 1) % 2] = state->committed;
+    atomic_store_explicit(&state->published, seq + 1, memory_order_release);
+    state->unpublished = false;
+    return true;
+}
+
+// Commits `scene`. If an earlier one is still waiting to be published, it's
+// replaced, so process() may skip straight to the newest scene.
+static void commit_scene(State * const state, const Scene * const scene) {
+    state->committed = *scene;
+    state->unpublished = true;
+    publish_scene(state);
+}
+
+// Starts building a new scene from the last committed one.
+static void stage(State * const state) {
+    state->staged = state->committed;
+    state->staged.fade = fade_frames(state, state->fade_time);
+    state->staged_dirty = false;
+    state->staged_error = false;
+}
+
+// Commits the staged scene, unless it is empty or had errors.
+static void commit_staged(State * const state) {
+    if (state->staged_error) {
+        fputs("error: scene discarded\n", stderr);
+    } else if (state->staged_dirty) {
+        commit_scene(state, &state->staged);
+    }
+    stage(state);
+}
+
+// Returns -1 if there is no port called `name`.
+static int find_port(
+    const State * const state,
+    const char * const name,
+    const size_t len
+) {
+    for (size_t i = 0; i < state->nports; ++i) {
+        const char * const port_name = state->names[i];
+        if (strncmp(port_name, name, len) == 0 && port_name[len] == '\0') {
+            return (int)i;
+        }
+    }
+    return -1;
+}
 
-    jack_default_audio_sample_t * const buffer =
-        jack_port_get_buffer(port, nframes);
-    if (buffer == NULL) {
+// How long poll() may wait before clamped values are due to be reported,
+// or -1 if there are none.
+static int clamp_timeout(const State * const state) {
+    if (state->clamped == 0) {
         return -1;
     }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    // Also avoids overflow before the first report, when clamp_time is 0.
+    if (now.tv_sec - state->clamp_time.tv_sec > 1) {
+        return 0;
+    }
+    const long elapsed = (now.tv_sec - state->clamp_time.tv_sec) * 1000 +
+        (now.tv_nsec - state->clamp_time.tv_nsec) / 1000000;
+    const long left = 1000 - elapsed;
+    return left > 0 ? (int)left : 0;
+}
 
-    const float value =
-        atomic_load_explicit(&state->value, memory_order_relaxed);
-    for (jack_nframes_t i = 0; i < nframes; ++i) {
-        buffer[i] = value;
+// Reports clamped values, at most once per second. The main loop also
+// calls this, so the last of a burst is reported even if no more follow.
+static void report_clamped(State * const state) {
+    if (clamp_timeout(state) != 0) {
+        return;
     }
-    return 0;
+    const char * const name = state->names[state->clamp_port];
+    if (state->clamped == 1) {
+        fprintf(stderr, "value clamped (port %s)\n", name);
+    } else {
+        fprintf(
+            stderr,
+            "%lu values clamped (last: port %s)\n",
+            state->clamped,
+            name
+        );
+    }
+    state->clamped = 0;
+    clock_gettime(CLOCK_MONOTONIC, &state->clamp_time);
+}
+
+static void warn_clamped(State * const state, const size_t index) {
+    ++state->clamped;
+    state->clamp_port = index;
+    report_clamped(state);
 }
 
-static void handle_line(State * const state, const char * const line) {
+static void set_value(
+    State * const state,
+    const size_t index,
+    const float value
+) {
+    if (!isfinite(value)) {
+        fputs("error: value must be finite\n", stderr);
+        state->staged_error = true;
+        return;
+    }
+    const Mapping * const mapping = &state->mappings[index];
+    if (value < mapping->min || value > mapping->max) {
+        warn_clamped(state, index);
+    }
+    state->staged.values[index] = apply_mapping(mapping, value);
+    state->staged_dirty = true;
+}
+
+static bool parse_float(const char * const text, float * const value) {
     errno = 0;
     char *endptr = NULL;
-    float value = strtof(line, &endptr);
-    if (!endptr || endptr == line || errno != 0) {
-        fputs("error: could not parse as a float\n", stderr);
+    *value = strtof(text, &endptr);
+    if (!endptr || endptr == text || *endptr != '\0' || errno != 0) {
+        fprintf(stderr, "error: could not parse as a float: %s\n", text);
+        return false;
+    }
+    return true;
+}
+
+// Returns -1 if there is no variable called `name` (including the '$').
+static int find_var(
+    const State * const state,
+    const char * const name,
+    const size_t len
+) {
+    for (size_t i = 0; i < state->nvars; ++i) {
+        const char * const var_name = state->var_names[i];
+        if (strncmp(var_name, name, len) == 0 && var_name[len] == '\0') {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static void set_var(State * const state, const char * const token) {
+    const char * const eq = strchr(token, '=');
+    const int index = eq ? find_var(state, token, eq - token) : -1;
+    if (index < 0) {
+        fprintf(stderr, "error: no such variable: %s\n", token);
+        state->staged_error = true;
         return;
     }
-    // Check for NaN
-    if (value != value) {
-        fputs("error: value cannot be NaN\n", stderr);
+    float value;
+    if (!parse_float(eq + 1, &value) || value != value) {
+        state->staged_error = true;
         return;
     }
+    state->staged.vars[index] = value;
+    state->staged_dirty = true;
+}
+
+static void handle_token(State * const state, const char * const token) {
+    float value;
+    if (token[0] == '~') {
+        if (!parse_float(token + 1, &value) || !(value >= 0)) {
+            state->staged_error = true;
+            return;
+        }
+        state->staged.fade = fade_frames(state, value);
+        return;
+    }
+    if (token[0] == '$') {
+        set_var(state, token);
+        return;
+    }
+    const char * const eq = strchr(token, '=');
+    int index = 0;
+    const char *text = token;
+    if (eq != NULL) {
+        index = find_port(state, token, eq - token);
+        if (index < 0) {
+            fprintf(
+                stderr,
+                "error: no such port: %.*s\n",
+                (int)(eq - token),
+                token
+            );
+            state->staged_error = true;
+            return;
+        }
+        text = eq + 1;
+    }
+    if (!parse_float(text, &value)) {
+        state->staged_error = true;
+        return;
+    }
+    set_value(state, index, value);
+}
+
+// All assignments on one line form a single scene.
+static void handle_line(State * const state, char * const line) {
+    char *saveptr = NULL;
+    for (
+        const char *token = strtok_r(line, " \t\r", &saveptr);
+        token != NULL;
+        token = strtok_r(NULL, " \t\r", &saveptr)
+    ) {
+        handle_token(state, token);
+    }
+    commit_staged(state);
+}
+
+static void handle_osc(void * const ctx, const OscMessage * const message) {
+    State * const state = ctx;
+    const int index = osc_table_find(&state->osc_table, message->address);
+    if (index < 0) {
+        fprintf(stderr, "unknown OSC address: %s\n", message->address);
+        return;
+    }
+    OscMessage args = *message;
+    OscArg arg;
+    while (osc_next_arg(&args, &arg)) {
+        float value;
+        if (osc_arg_number(&arg, &value)) {
+            set_value(state, index, value);
+            return;
+        }
+    }
+    fprintf(stderr, "no numeric argument for %s\n", message->address);
+}
+
+// All messages in one OSC packet (e.g., a bundle) form a single scene.
+static void handle_osc_packet(void * const ctx) {
+    commit_staged(ctx);
+}
+
+static void init_mapping(Mapping * const mapping) {
+    // JACLI_CV_CLAMP makes [0, 1] the default range.
     static const bool clamp =
         #if JACLI_CV_CLAMP
             true
@@ -147,36 +956,678 @@ static void handle_line(State * const state, const char * const line) {
             false
         #endif
     ;
-    if (!clamp) {
-    } else if (value < 0) {
-        fputs("value clamped to 0\n", stderr);
-        value = 0;
-    } else if (value > 1) {
-        fputs("value clamped to 1\n", stderr);
-        value = 1;
+    *mapping = (Mapping){
+        .min = clamp ? 0 : -INFINITY,
+        .max = clamp ? 1 : INFINITY,
+        .quantize = map_identity,
+        .curve = map_identity,
+    };
+}
+
+// Parses up to `max` colon-separated floats. Returns the number parsed, or
+// -1 on error.
+static int parse_floats(
+    const char * const text,
+    float * const values,
+    const int max
+) {
+    if (*text == '\0') {
+        return 0;
+    }
+    const char *p = text;
+    for (int i = 0; i < max; ++i) {
+        errno = 0;
+        char *endptr = NULL;
+        values[i] = strtof(p, &endptr);
+        if (!endptr || endptr == p || errno != 0) {
+            return -1;
+        }
+        if (*endptr == '\0') {
+            return i + 1;
+        }
+        if (*endptr != ':') {
+            return -1;
+        }
+        p = endptr + 1;
+    }
+    return -1;
+}
+
+static bool parse_clamp(Mapping * const mapping, const char * const spec) {
+    float values[2];
+    if (parse_floats(spec, values, 2) != 2 || !(values[0] <= values[1])) {
+        return false;
+    }
+    mapping->min = values[0];
+    mapping->max = values[1];
+    return true;
+}
+
+static bool parse_scale(Mapping * const mapping, const char * const spec) {
+    bool in_scale[12] = {false};
+    bool any = false;
+    const char *p = spec;
+    while (true) {
+        char *endptr = NULL;
+        const long degree = strtol(p, &endptr, 10);
+        if (endptr == p || degree < 0 || degree > 11) {
+            return false;
+        }
+        in_scale[degree] = true;
+        any = true;
+        if (*endptr == '\0') {
+            break;
+        }
+        if (*endptr != ',') {
+            return false;
+        }
+        p = endptr + 1;
+    }
+    if (!any) {
+        return false;
+    }
+    // For each semitone, find the nearest scale note (preferring the lower
+    // one on ties), possibly in a neighboring octave.
+    for (int semitone = 0; semitone < 12; ++semitone) {
+        for (int distance = 0; distance <= 6; ++distance) {
+            const int below = semitone - distance;
+            const int above = semitone + distance;
+            if (in_scale[(below + 12) % 12]) {
+                mapping->scale[semitone] = (signed char)below;
+                break;
+            }
+            if (in_scale[above % 12]) {
+                mapping->scale[semitone] = (signed char)above;
+                break;
+            }
+        }
+    }
+    mapping->quantize = map_quantize;
+    return true;
+}
+
+static bool parse_curve(Mapping * const mapping, const char * const spec) {
+    float values[2] = {0};
+    if (strncmp(spec, "lin:", 4) == 0) {
+        if (parse_floats(spec + 4, values, 2) != 2) {
+            return false;
+        }
+        mapping->curve = map_linear;
+        mapping->a = values[0];
+        mapping->b = values[1] - values[0];
+        return true;
+    }
+    if (strncmp(spec, "exp:", 4) == 0) {
+        if (parse_floats(spec + 4, values, 2) != 2) {
+            return false;
+        }
+        const float ratio = values[1] / values[0];
+        if (!(ratio > 0) || isinf(ratio)) {
+            return false;
+        }
+        mapping->curve = map_exp;
+        mapping->a = values[0];
+        mapping->b = logf(ratio);
+        return true;
+    }
+    if (strcmp(spec, "voct") == 0 || strncmp(spec, "voct:", 5) == 0) {
+        values[0] = 60;
+        values[1] = 0.1f;
+        if (spec[4] != '\0' && parse_floats(spec + 5, values, 2) < 1) {
+            return false;
+        }
+        mapping->curve = map_voct;
+        mapping->a = values[0];
+        mapping->b = values[1] / 12;
+        return true;
+    }
+    return false;
+}
+
+typedef bool (*MapParser)(Mapping *mapping, const char *spec);
+
+typedef struct MapOption {
+    MapParser parse;
+    const char *value;
+} MapOption;
+
+// Applies a mapping option of the form "[<name>=]<spec>".
+static bool apply_map_option(
+    State * const state,
+    const MapOption * const option
+) {
+    const char *spec = option->value;
+    size_t first = 0;
+    size_t last = state->nports;
+    const char * const eq = strchr(spec, '=');
+    if (eq != NULL) {
+        const int index = find_port(state, spec, eq - spec);
+        if (index < 0) {
+            fprintf(
+                stderr,
+                "no such port: %.*s\n",
+                (int)(eq - spec),
+                spec
+            );
+            return false;
+        }
+        first = (size_t)index;
+        last = first + 1;
+        spec = eq + 1;
+    }
+    for (size_t i = first; i < last; ++i) {
+        if (!option->parse(&state->mappings[i], spec)) {
+            fprintf(stderr, "bad mapping: %s\n", option->value);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Maps an automation file and indexes its breakpoints by port and time.
+static bool load_automation(State * const state, const char * const path) {
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        fprintf(stderr, "could not open %s", path);
+        perror("");
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("fstat() failed");
+        close(fd);
+        return false;
+    }
+    const size_t size = (size_t)st.st_size;
+    AutoHeader header;
+    if (size < sizeof(header)) {
+        fprintf(stderr, "%s: not an automation file\n", path);
+        close(fd);
+        return false;
+    }
+    void * const map =
+        mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap() failed");
+        return false;
+    }
+    // Avoid page faults in the process thread if possible.
+    mlock(map, size);
+
+    memcpy(&header, map, sizeof(header));
+    const AutoPoint * const points =
+        (const AutoPoint *)((const char *)map + sizeof(header));
+    if (memcmp(header.magic, "JACLAUT1", 8) != 0) {
+        fprintf(stderr, "%s: not an automation file\n", path);
+        return false;
+    }
+    if (header.count > (size - sizeof(header)) / sizeof(AutoPoint)) {
+        fprintf(stderr, "%s: file is truncated\n", path);
+        return false;
+    }
+
+    Automation * const automation = &state->automation;
+    uint64_t last_frame = 0;
+    for (uint32_t i = 0; i < header.count; ++i) {
+        const AutoPoint * const point = &points[i];
+        if (point->frame < last_frame) {
+            fprintf(
+                stderr,
+                "%s: breakpoint %lu out of order\n",
+                path,
+                (unsigned long)i
+            );
+            return false;
+        }
+        if (point->frame > UINT32_MAX) {
+            fprintf(
+                stderr,
+                "%s: breakpoint %lu is too late\n",
+                path,
+                (unsigned long)i
+            );
+            return false;
+        }
+        if (point->port >= state->nports || point->curve > CURVE_LINEAR) {
+            fprintf(
+                stderr,
+                "%s: bad breakpoint %lu\n",
+                path,
+                (unsigned long)i
+            );
+            return false;
+        }
+        last_frame = point->frame;
+        ++automation->lanes[point->port].count;
+    }
+
+    for (size_t p = 0; p < state->nports; ++p) {
+        Lane * const lane = &automation->lanes[p];
+        if (lane->count == 0) {
+            continue;
+        }
+        lane->points = calloc(lane->count, sizeof(*lane->points));
+        if (lane->points == NULL) {
+            abort();
+        }
+        lane->count = 0;
+    }
+    for (uint32_t i = 0; i < header.count; ++i) {
+        Lane * const lane = &automation->lanes[points[i].port];
+        lane->points[lane->count++] = i;
+    }
+    for (size_t p = 0; p < state->nports; ++p) {
+        Lane * const lane = &automation->lanes[p];
+        lane->bucket_shift = AUTO_BUCKET_SHIFT;
+        if (lane->count == 0) {
+            continue;
+        }
+        // Frames fit in 32 bits, so this stops by a shift of 32.
+        const uint64_t last = points[lane->points[lane->count - 1]].frame;
+        while ((last >> lane->bucket_shift) >= lane->count) {
+            ++lane->bucket_shift;
+        }
+        lane->nbuckets = (size_t)(last >> lane->bucket_shift) + 1;
+        lane->buckets = calloc(lane->nbuckets, sizeof(*lane->buckets));
+        if (lane->buckets == NULL) {
+            abort();
+        }
+        uint32_t next = 0;
+        for (size_t b = 0; b < lane->nbuckets; ++b) {
+            const uint64_t start = (uint64_t)b << lane->bucket_shift;
+            while (
+                next < lane->count &&
+                points[lane->points[next]].frame < start
+            ) {
+                ++next;
+            }
+            lane->buckets[b] = next;
+        }
+    }
+    automation->points = points;
+    return true;
+}
+
+typedef struct ExprContext {
+    State *state;
+    // The port whose expression is being compiled.
+    size_t port;
+} ExprContext;
+
+static int resolve_name(
+    void * const ctx,
+    const char * const name,
+    const size_t len
+) {
+    const ExprContext * const context = ctx;
+    State * const state = context->state;
+    static const char * const inputs[] = {
+        [INPUT_T] = "t",
+        [INPUT_POS] = "pos",
+        [INPUT_BEAT] = "beat",
+    };
+    for (size_t i = 0; i < INPUT_PORTS; ++i) {
+        if (strlen(inputs[i]) == len && strncmp(inputs[i], name, len) == 0) {
+            return (int)i;
+        }
+    }
+    if (name[0] == '$') {
+        int index = find_var(state, name, len);
+        if (index >= 0) {
+            return index | EXPR_SCALAR;
+        }
+        if (state->nvars >= MAX_VARS) {
+            fprintf(stderr, "too many variables (max %d)\n", MAX_VARS);
+            return -1;
+        }
+        char * const copy = strndup(name, len);
+        if (copy == NULL) {
+            abort();
+        }
+        index = (int)state->nvars++;
+        state->var_names[index] = copy;
+        return index | EXPR_SCALAR;
+    }
+    const int index = find_port(state, name, len);
+    if (index < 0) {
+        return -1;
+    }
+    // Expression ports are evaluated in order after all other ports.
+    if (state->expr_texts[index] != NULL && (size_t)index >= context->port) {
+        fprintf(
+            stderr,
+            "port %s: cannot refer to port %s\n",
+            state->names[context->port],
+            state->names[index]
+        );
+        return -1;
+    }
+    return INPUT_PORTS + index;
+}
+
+// Stores an expression of the form "<name>=<expression>" for later
+// compilation.
+static bool add_expr(State * const state, const char * const spec) {
+    const char * const eq = strchr(spec, '=');
+    const int index = eq ? find_port(state, spec, eq - spec) : -1;
+    if (index < 0) {
+        fprintf(stderr, "bad expression (no such port): %s\n", spec);
+        return false;
+    }
+    if (state->expr_texts[index] != NULL) {
+        fprintf(
+            stderr,
+            "duplicate expression for port %s\n",
+            state->names[index]
+        );
+        return false;
+    }
+    state->expr_texts[index] = eq + 1;
+    return true;
+}
+
+static bool compile_exprs(State * const state) {
+    for (size_t p = 0; p < state->nports; ++p) {
+        if (state->expr_texts[p] == NULL) {
+            continue;
+        }
+        ExprContext context = {
+            .state = state,
+            .port = p,
+        };
+        Expr * const expr = malloc(sizeof(*expr));
+        if (expr == NULL) {
+            abort();
+        }
+        const char * const text = state->expr_texts[p];
+        if (!expr_compile(expr, text, resolve_name, &context)) {
+            fprintf(stderr, "in expression for port %s\n", state->names[p]);
+            return false;
+        }
+        state->exprs[p] = expr;
+        state->has_exprs = true;
+    }
+    return true;
+}
+
+static bool add_osc_address(
+    State * const state,
+    const char * const address,
+    const int index
+) {
+    if (osc_table_insert(&state->osc_table, address, index)) {
+        return true;
+    }
+    fprintf(stderr, "duplicate OSC address: %s\n", address);
+    return false;
+}
+
+// Builds the OSC address table: /<name> for every port, plus any addresses
+// given with --address (as "<address>=<name>").
+static bool build_osc_table(
+    State * const state,
+    char ** const mappings,
+    const size_t nmappings
+) {
+    osc_table_init(&state->osc_table, state->nports + nmappings);
+    for (size_t i = 0; i < state->nports; ++i) {
+        const char * const name = state->names[i];
+        char * const address = malloc(strlen(name) + 2);
+        if (address == NULL) {
+            abort();
+        }
+        address[0] = '/';
+        strcpy(address + 1, name);
+        if (!add_osc_address(state, address, (int)i)) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < nmappings; ++i) {
+        char * const mapping = mappings[i];
+        char * const eq = strrchr(mapping, '=');
+        const int index = eq ? find_port(state, eq + 1, strlen(eq + 1)) : -1;
+        if (index < 0 || mapping[0] != '/') {
+            fprintf(stderr, "bad OSC address mapping: %s\n", mapping);
+            return false;
+        }
+        *eq = '\0';
+        if (!add_osc_address(state, mapping, index)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sets up a newly opened client: callbacks, ports and activation. Used at
+// startup and again after the server restarts.
+static bool start_client(State * const state, jack_client_t * const client) {
+    state->client = client;
+    for (size_t i = 0; i < state->nports; ++i) {
+        state->ports[i] = NULL;
+    }
+    const int spc_status = jack_set_process_callback(client, process, state);
+    if (spc_status != 0) {
+        fprintf(
+            stderr,
+            "jack_set_process_callback() failed: %d\n",
+            spc_status
+        );
+        return false;
+    }
+
+    const int slc_status =
+        jack_set_latency_callback(client, handle_latency, state);
+    if (slc_status != 0) {
+        fprintf(
+            stderr,
+            "jack_set_latency_callback() failed: %d\n",
+            slc_status
+        );
+        return false;
+    }
+    if (
+        !reconnect_watch(&state->reconnect, client) ||
+        !autoconnect_watch(&state->autoconnect, client)
+    ) {
+        return false;
+    }
+
+    for (size_t i = 0; i < state->nports; ++i) {
+        jack_port_t * const port = jack_port_register(
+            client,
+            state->names[i],
+            JACK_DEFAULT_AUDIO_TYPE,
+            JackPortIsOutput,
+            0
+        );
+        if (port == NULL) {
+            fputs("jack_port_register() failed\n", stderr);
+            return false;
+        }
+
+        const jack_uuid_t uuid = jack_port_uuid(port);
+        const int sp_status = jack_set_property(
+            client,
+            uuid,
+            JACK_METADATA_SIGNAL_TYPE,
+            "CV",
+            "text/plain"
+        );
+        if (sp_status != 0) {
+            fprintf(stderr, "jack_set_property() failed: %d\n", sp_status);
+        }
+        state->ports[i] = port;
+    }
+
+    const int astatus = jack_activate(client);
+    if (astatus != 0) {
+        fprintf(stderr, "jack_activate() failed: %d\n", astatus);
+        return false;
     }
-    atomic_store_explicit(&state->value, value, memory_order_relaxed);
+    return true;
 }
 
 int main(const int argc, char ** const argv) {
+    static State state = {
+        .nports = 0,
+    };
+    const char *udp = NULL;
+    const char *automation = NULL;
+    char *mappings[MAX_PORTS];
+    size_t nmappings = 0;
+    MapOption map_options[MAX_PORTS * 3];
+    size_t nmap_options = 0;
+    const char *exprs[MAX_PORTS];
+    size_t nexprs = 0;
+
     int argi = 1;
-    if (argc > argi) {
-        if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+    for (; argi < argc; ++argi) {
+        const char * const arg = argv[argi];
+        const char *value = NULL;
+        MapParser parse = NULL;
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
             usage(stdout, argv[0]);
             return EXIT_SUCCESS;
         }
-        if (strcmp(argv[1], "--version") == 0) {
+        if (strcmp(arg, "--version") == 0) {
             puts("0.1");
             return EXIT_SUCCESS;
         }
-        if (strcmp(argv[1], "--") == 0) {
+        if (strcmp(arg, "--") == 0) {
             ++argi;
+            break;
+        }
+        if (arg[0] != '-' || arg[1] == '\0') {
+            break;
+        }
+        if (match_option(argc, argv, &argi, "-p", "--port", &value)) {
+            if (value == NULL || *value == '\0' || strchr(value, '=')) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+            if (state.nports >= MAX_PORTS) {
+                fprintf(stderr, "too many ports (max %d)\n", MAX_PORTS);
+                return EXIT_FAILURE;
+            }
+            state.names[state.nports++] = value;
+        } else if (match_option(argc, argv, &argi, "-u", "--udp", &value)) {
+            if (value == NULL) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+            udp = value;
+        } else if (
+            match_option(argc, argv, &argi, "-a", "--address", &value)
+        ) {
+            if (value == NULL || nmappings >= MAX_PORTS) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+            // Options live in argv, so they can be modified in place.
+            mappings[nmappings++] = (char *)value;
+        } else if (match_option(argc, argv, &argi, "-c", "--clamp", &value)) {
+            parse = parse_clamp;
+        } else if (
+            match_option(argc, argv, &argi, "-q", "--quantize", &value)
+        ) {
+            parse = parse_scale;
+        } else if (match_option(argc, argv, &argi, "-m", "--map", &value)) {
+            parse = parse_curve;
+        } else if (
+            match_option(argc, argv, &argi, "-A", "--automation", &value)
+        ) {
+            if (value == NULL) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+            automation = value;
+        } else if (match_option(argc, argv, &argi, "-e", "--expr", &value)) {
+            if (value == NULL || nexprs >= MAX_PORTS) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+            exprs[nexprs++] = value;
+        } else if (match_option(argc, argv, &argi, "-f", "--fade", &value)) {
+            float * const time = &state.fade_time;
+            if (value == NULL || !parse_float(value, time) || !(*time >= 0)) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (
+            match_option(argc, argv, &argi, "-C", "--connect", &value)
+        ) {
+            if (value == NULL) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+            if (!autoconnect_add_rule(&state.autoconnect, value)) {
+                return EXIT_FAILURE;
+            }
+        } else {
+            fprintf(stderr, "unknown option: %s\n", arg);
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+        if (parse != NULL) {
+            const size_t max = sizeof(map_options) / sizeof(*map_options);
+            if (value == NULL || nmap_options >= max) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+            map_options[nmap_options++] = (MapOption){
+                .parse = parse,
+                .value = value,
+            };
         }
     }
     if (argc - argi > 1) {
         usage(stderr, argv[0]);
         return EXIT_FAILURE;
     }
+    if (state.nports == 0) {
+        state.names[state.nports++] = "value";
+    }
+    for (size_t i = 0; i < state.nports; ++i) {
+        const char * const name = state.names[i];
+        if (find_port(&state, name, strlen(name)) != (int)i) {
+            fprintf(stderr, "duplicate port: %s\n", name);
+            return EXIT_FAILURE;
+        }
+        init_mapping(&state.mappings[i]);
+    }
+    for (size_t i = 0; i < nmap_options; ++i) {
+        if (!apply_map_option(&state, &map_options[i])) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (automation != NULL && !load_automation(&state, automation)) {
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < nexprs; ++i) {
+        if (!add_expr(&state, exprs[i])) {
+            return EXIT_FAILURE;
+        }
+    }
+    if (!compile_exprs(&state)) {
+        return EXIT_FAILURE;
+    }
+
+    static OscReceiver receiver = {
+        .fd = -1,
+    };
+    if (udp != NULL) {
+        if (!build_osc_table(&state, mappings, nmappings)) {
+            return EXIT_FAILURE;
+        }
+        if (!osc_receiver_open(&receiver, udp)) {
+            return EXIT_FAILURE;
+        }
+    } else if (nmappings > 0) {
+        fputs("--address requires --udp\n", stderr);
+        return EXIT_FAILURE;
+    }
 
     int sigfds[2];
     if (pipe(sigfds) != 0) {
@@ -201,47 +1652,16 @@ int main(const int argc, char ** const argv) {
         return EXIT_FAILURE;
     }
 
-    State state = {
-        .client = client,
-    };
-    const int spc_status = jack_set_process_callback(client, process, &state);
-    if (spc_status != 0) {
-        fprintf(
-            stderr,
-            "jack_set_process_callback() failed: %d\n",
-            spc_status
-        );
+    state.client = client;
+    state.sample_rate = jack_get_sample_rate(client);
+    stage(&state);
+    if (
+        !reconnect_init(&state.reconnect, name, state.nports) ||
+        !autoconnect_init(&state.autoconnect)
+    ) {
         return close_and_fail(client);
     }
-
-    jack_port_t * const port = jack_port_register(
-        client,
-        "value",
-        JACK_DEFAULT_AUDIO_TYPE,
-        JackPortIsOutput,
-        0
-    );
-    if (port == NULL) {
-        fputs("jack_port_register() failed\n", stderr);
-        return close_and_fail(client);
-    }
-    state.port = port;
-
-    const jack_uuid_t uuid = jack_port_uuid(port);
-    const int sp_status = jack_set_property(
-        client,
-        uuid,
-        JACK_METADATA_SIGNAL_TYPE,
-        "CV",
-        "text/plain"
-    );
-    if (sp_status != 0) {
-        fprintf(stderr, "jack_set_property() failed: %d\n", sp_status);
-    }
-
-    const int astatus = jack_activate(client);
-    if (astatus != 0) {
-        fprintf(stderr, "jack_activate() failed: %d\n", astatus);
+    if (!start_client(&state, client)) {
         return close_and_fail(client);
     }
 
@@ -258,24 +1678,67 @@ int main(const int argc, char ** const argv) {
             .fd = STDIN_FILENO,
             .events = POLLIN,
         },
+        {
+            .fd = receiver.fd,
+            .events = POLLIN,
+        },
+        {
+            .fd = state.reconnect.notify_read,
+            .events = POLLIN,
+        },
+        {
+            .fd = state.autoconnect.notify_read,
+            .events = POLLIN,
+        },
     };
 
-    char line[128];
+    char line[1024];
     size_t linelen = 0;
     while (true) {
-        const int status =
-            poll(pollfds, sizeof(pollfds) / sizeof(*pollfds), -1);
+        // Commands keep being applied while the server is down; the ports
+        // pick up the current scene once the client is back.
+        if (state.client == NULL) {
+            jack_client_t * const next = reconnect_try(&state.reconnect);
+            if (next == NULL) {
+            } else if (start_client(&state, next)) {
+                reconnect_restore(&state.reconnect, next, state.ports);
+            } else {
+                jack_client_close(next);
+                state.client = NULL;
+            }
+        }
+        autoconnect_apply(
+            &state.autoconnect,
+            state.client,
+            state.ports,
+            state.nports
+        );
+        report_clamped(&state);
+        int timeout = reconnect_combine_timeouts(
+            reconnect_timeout(&state.reconnect),
+            autoconnect_timeout(&state.autoconnect)
+        );
+        timeout = reconnect_combine_timeouts(timeout, clamp_timeout(&state));
+        // A scene waiting for process() is retried about once a millisecond.
+        if (!publish_scene(&state)) {
+            timeout = reconnect_combine_timeouts(timeout, 1);
+        }
+        const int status = poll(
+            pollfds,
+            sizeof(pollfds) / sizeof(*pollfds),
+            timeout
+        );
         if (status > 0) {
         } else if (status == 0 || errno == EINTR) {
             continue;
         } else {
             perror("poll() failed");
-            return close_and_fail(client);
+            return close_and_fail(state.client);
         }
         for (size_t i = 0; i < sizeof(pollfds) / sizeof(*pollfds); ++i) {
             if (pollfds[i].revents & POLLNVAL) {
                 fprintf(stderr, "unexpected POLLNVAL on #%zu\n", i);
-                return close_and_fail(client);
+                return close_and_fail(state.client);
             }
         }
         if (pollfds[0].revents) {
@@ -308,9 +1771,31 @@ int main(const int argc, char ** const argv) {
         } else if (pollfds[1].revents) {
             pollfds[1].fd = -1;
         }
+        if (pollfds[2].revents & POLLIN) {
+            if (!osc_receive(
+                &receiver,
+                handle_osc,
+                handle_osc_packet,
+                &state
+            )) {
+                return close_and_fail(state.client);
+            }
+        }
+        if (
+            pollfds[3].revents & POLLIN &&
+            reconnect_read(&state.reconnect, state.ports)
+        ) {
+            jack_client_close(state.client);
+            state.client = NULL;
+        }
+        if (pollfds[4].revents & POLLIN) {
+            autoconnect_read(&state.autoconnect);
+        }
     }
 
-    jack_client_close(client);
+    if (state.client != NULL) {
+        jack_client_close(state.client);
+    }
     const int tty = open("/dev/tty", O_WRONLY);
     if (tty != -1) {
         while (write(tty, "\n", 1) == -1 && errno == EINTR) {}
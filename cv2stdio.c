@@ -0,0 +1,620 @@
+/*
+ * Copyright (C) 2025 taylor.fish <contact@taylor.fish>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "probes.h"
+#include "queue.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <jack/jack.h>
+#include <jack/metadata.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define MAX_PORTS 64
+#define RING_SIZE (1 << 20)
+// How often (in milliseconds) queued records are written to standard output.
+#define WRITE_INTERVAL 10
+
+static int sigfd_write;
+
+static const char *USAGE = "\
+Usage: %s [options] [client-name]\n\
+\n\
+Writes the values of incoming JACK CV signals to standard output. Each line\n\
+has the form '<frame> <port> <value>', where <frame> is the JACK frame time\n\
+of the sample, less the capture latency of its port.\n\
+\n\
+[client-name] is the name of the JACK client to create; if not provided, the\n\
+default is 'jacl-cv2stdio'.\n\
+\n\
+Options:\n\
+  -p, --port <name>   Create an input port called <name>. May be given\n\
+                      multiple times. If omitted, a single port called 'in'\n\
+                      is created.\n\
+  -m, --mode <mode>   How values are reported (default: change):\n\
+                        sample  every sample.\n\
+                        change  a sample whenever it differs from the last\n\
+                                reported value by more than the threshold.\n\
+                        rle     runs of samples within the threshold of the\n\
+                                run's first value, reported when the run\n\
+                                ends as '<frame> <port> <value> <length>'.\n\
+                        linear  breakpoints of a piecewise-linear\n\
+                                approximation that stays within the\n\
+                                threshold of the signal (swinging door).\n\
+                                The signal is linear between consecutive\n\
+                                breakpoints of a port.\n\
+  -t, --threshold <value>\n\
+                      Threshold for change, rle and linear (default: 0.001).\n\
+";
+
+static void usage(FILE * const stream, const char * const arg0) {
+    const char *bin = arg0 ? arg0 : "";
+    size_t start = 0;
+    for (size_t i = 0; bin[i] != '\0'; ++i) {
+        if (bin[i] == '/') {
+            start = i + 1;
+        }
+    }
+    bin += start;
+    if (*bin == '\0') {
+        bin = "jacl-cv2stdio";
+    }
+    fprintf(stream, USAGE, bin);
+}
+
+static void handle_exit_signal(const int signum) {
+    (void)signum;
+    close(sigfd_write);
+}
+
+static bool install_exit_handler(const int signum) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    const struct sigaction act = {
+        .sa_handler = handle_exit_signal,
+        .sa_mask = mask,
+        .sa_flags = 0,
+    };
+    if (sigaction(signum, &act, NULL) == 0) {
+        return true;
+    }
+    fprintf(stderr, "sigaction(%d) failed", signum);
+    perror("");
+    return false;
+}
+
+static bool set_nonblock(const int fd) {
+    const int flags = fcntl(fd, F_GETFL);
+    if (flags == -1) {
+        fprintf(stderr, "fcntl(%d, F_GETFL) failed", fd);
+        perror("");
+        return false;
+    }
+    if (flags & O_NONBLOCK) {
+        return true;
+    }
+    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        fprintf(stderr, "fcntl(%d, F_SETFL) failed", fd);
+        perror("");
+        return false;
+    }
+    return true;
+}
+
+// Matches option `shortopt` or `longopt` at `argv[*argi]`, accepting both
+// "--long value" and "--long=value". On a match, `*value` is set to the
+// option's argument (NULL if missing) and `*argi` is advanced past it.
+static bool match_option(
+    const int argc,
+    char ** const argv,
+    int * const argi,
+    const char * const shortopt,
+    const char * const longopt,
+    const char ** const value
+) {
+    const char * const arg = argv[*argi];
+    const size_t longlen = strlen(longopt);
+    if (strncmp(arg, longopt, longlen) == 0 && arg[longlen] == '=') {
+        *value = arg + longlen + 1;
+        return true;
+    }
+    if (strcmp(arg, shortopt) != 0 && strcmp(arg, longopt) != 0) {
+        return false;
+    }
+    *value = *argi + 1 < argc ? argv[++*argi] : NULL;
+    return true;
+}
+
+typedef enum Mode {
+    MODE_SAMPLE,
+    MODE_CHANGE,
+    MODE_RLE,
+    MODE_LINEAR,
+} Mode;
+
+typedef struct Record {
+    jack_nframes_t frame;
+    uint32_t port;
+    float value;
+    // Run length (rle mode only).
+    uint32_t count;
+} Record;
+
+// Per-port reporting state. Owned by the process thread while the client
+// is active.
+typedef struct PortState {
+    bool started;
+    // change, rle: the last reported value / the current run's value.
+    // linear: the last breakpoint.
+    jack_nframes_t frame;
+    float value;
+    uint32_t count;
+    // linear: the previous sample and the slopes bounding the "door".
+    jack_nframes_t prev_frame;
+    float prev_value;
+    float slope_min;
+    float slope_max;
+} PortState;
+
+typedef struct State {
+    jack_client_t *client;
+    Mode mode;
+    float threshold;
+    size_t nports;
+    const char *names[MAX_PORTS];
+    jack_port_t *ports[MAX_PORTS];
+    PortState port_states[MAX_PORTS];
+    // Records, one per element.
+    SpscRing ring;
+    atomic_size_t dropped;
+    // The capture latency of each port, from the latency callback.
+    atomic_uint latencies[MAX_PORTS];
+} State;
+
+static int close_and_fail(jack_client_t * const client) {
+    jack_client_close(client);
+    return EXIT_FAILURE;
+}
+
+static void emit(
+    State * const state,
+    const size_t port,
+    const jack_nframes_t frame,
+    const float value,
+    const uint32_t count
+) {
+    const Record record = {
+        .frame = frame,
+        .port = (uint32_t)port,
+        .value = value,
+        .count = count,
+    };
+    if (spsc_push(&state->ring, &record, 1) == 0) {
+        atomic_fetch_add_explicit(&state->dropped, 1, memory_order_relaxed);
+    }
+}
+
+// Makes a breakpoint at the previous sample. Its value is the point closest
+// to that sample on a line that stays within the door, so every sample since
+// the last breakpoint is within the threshold.
+static void close_door(PortState * const ps) {
+    const float dt = (float)(jack_nframes_t)(ps->prev_frame - ps->frame);
+    const float slope = fminf(
+        fmaxf((ps->prev_value - ps->value) / dt, ps->slope_min),
+        ps->slope_max
+    );
+    ps->value += slope * dt;
+    ps->frame = ps->prev_frame;
+}
+
+// Resets the door so that it starts at the last breakpoint and passes
+// through the previous sample.
+static void open_door(PortState * const ps, const float threshold) {
+    const float dt = (float)(jack_nframes_t)(ps->prev_frame - ps->frame);
+    ps->slope_max = (ps->prev_value + threshold - ps->value) / dt;
+    ps->slope_min = (ps->prev_value - threshold - ps->value) / dt;
+}
+
+static void process_port(
+    State * const state,
+    const size_t p,
+    const float * const buffer,
+    const jack_nframes_t nframes,
+    const jack_nframes_t start
+) {
+    PortState * const ps = &state->port_states[p];
+    const float threshold = state->threshold;
+    jack_nframes_t i = 0;
+    if (!ps->started && nframes > 0) {
+        ps->started = true;
+        ps->frame = start;
+        ps->value = buffer[0];
+        ps->count = 1;
+        ps->prev_frame = start;
+        ps->prev_value = buffer[0];
+        ps->slope_min = -INFINITY;
+        ps->slope_max = INFINITY;
+        if (state->mode != MODE_RLE) {
+            emit(state, p, start, buffer[0], 0);
+        }
+        i = 1;
+    }
+
+    switch (state->mode) {
+        case MODE_SAMPLE:
+            for (; i < nframes; ++i) {
+                emit(state, p, start + i, buffer[i], 0);
+            }
+            break;
+        case MODE_CHANGE:
+            for (; i < nframes; ++i) {
+                if (fabsf(buffer[i] - ps->value) > threshold) {
+                    ps->value = buffer[i];
+                    emit(state, p, start + i, buffer[i], 0);
+                }
+            }
+            break;
+        case MODE_RLE:
+            for (; i < nframes; ++i) {
+                if (fabsf(buffer[i] - ps->value) <= threshold) {
+                    ++ps->count;
+                    continue;
+                }
+                emit(state, p, ps->frame, ps->value, ps->count);
+                ps->frame = start + i;
+                ps->value = buffer[i];
+                ps->count = 1;
+            }
+            break;
+        case MODE_LINEAR:
+            for (; i < nframes; ++i) {
+                const jack_nframes_t frame = start + i;
+                const float value = buffer[i];
+                const float dt = (float)(jack_nframes_t)(frame - ps->frame);
+                const float hi = (value + threshold - ps->value) / dt;
+                const float lo = (value - threshold - ps->value) / dt;
+                const float slope_max = fminf(ps->slope_max, hi);
+                const float slope_min = fmaxf(ps->slope_min, lo);
+                if (slope_min <= slope_max) {
+                    ps->slope_max = slope_max;
+                    ps->slope_min = slope_min;
+                } else {
+                    close_door(ps);
+                    emit(state, p, ps->frame, ps->value, 0);
+                    ps->prev_frame = frame;
+                    ps->prev_value = value;
+                    open_door(ps, threshold);
+                    continue;
+                }
+                ps->prev_frame = frame;
+                ps->prev_value = value;
+            }
+            break;
+    }
+}
+
+static int process(const jack_nframes_t nframes, void * const arg) {
+    PROBE1(process_entry, nframes);
+    State * const state = arg;
+    const jack_nframes_t start = jack_last_frame_time(state->client);
+    for (size_t p = 0; p < state->nports; ++p) {
+        jack_port_t * const port = state->ports[p];
+        if (port == NULL) {
+            continue;
+        }
+        const jack_default_audio_sample_t * const buffer =
+            jack_port_get_buffer(port, nframes);
+        if (buffer == NULL) {
+            PROBE2(process_return, nframes, -1);
+            return -1;
+        }
+        const jack_nframes_t latency = atomic_load_explicit(
+            &state->latencies[p],
+            memory_order_relaxed
+        );
+        process_port(state, p, buffer, nframes, start - latency);
+    }
+    PROBE2(process_return, nframes, 0);
+    return 0;
+}
+
+// Keeps each port's capture latency for process(), and publishes our own
+// playback latency: records wait up to WRITE_INTERVAL before they are
+// written.
+static void handle_latency(
+    const jack_latency_callback_mode_t mode,
+    void * const arg
+) {
+    State * const state = arg;
+    const jack_nframes_t rate = jack_get_sample_rate(state->client);
+    for (size_t p = 0; p < state->nports; ++p) {
+        jack_port_t * const port = state->ports[p];
+        if (port == NULL) {
+            continue;
+        }
+        jack_latency_range_t range;
+        if (mode == JackCaptureLatency) {
+            jack_port_get_latency_range(port, mode, &range);
+            atomic_store_explicit(
+                &state->latencies[p],
+                range.max,
+                memory_order_relaxed
+            );
+            continue;
+        }
+        range.min = 0;
+        range.max = (jack_nframes_t)((uint64_t)rate * WRITE_INTERVAL / 1000);
+        jack_port_set_latency_range(port, mode, &range);
+    }
+}
+
+static void print_record(const State * const state, const Record * const r) {
+    const char * const name = state->names[r->port];
+    if (state->mode == MODE_RLE) {
+        printf(
+            "%lu %s %.9g %lu\n",
+            (unsigned long)r->frame,
+            name,
+            r->value,
+            (unsigned long)r->count
+        );
+    } else {
+        printf("%lu %s %.9g\n", (unsigned long)r->frame, name, r->value);
+    }
+}
+
+static void drain(State * const state) {
+    Record records[256];
+    size_t n;
+    do {
+        n = spsc_pop(
+            &state->ring,
+            records,
+            sizeof(records) / sizeof(*records)
+        );
+        for (size_t i = 0; i < n; ++i) {
+            print_record(state, &records[i]);
+        }
+    } while (n == sizeof(records) / sizeof(*records));
+    const size_t dropped =
+        atomic_exchange_explicit(&state->dropped, 0, memory_order_relaxed);
+    if (dropped > 0) {
+        fprintf(stderr, "dropped %zu records\n", dropped);
+    }
+    fflush(stdout);
+}
+
+// Writes out whatever the current mode still holds back once the client has
+// been closed (the open run or the final breakpoint).
+static void finish(State * const state) {
+    for (size_t p = 0; p < state->nports; ++p) {
+        PortState * const ps = &state->port_states[p];
+        if (!ps->started) {
+            continue;
+        }
+        if (state->mode == MODE_RLE) {
+            emit(state, p, ps->frame, ps->value, ps->count);
+        } else if (
+            state->mode == MODE_LINEAR && ps->prev_frame != ps->frame
+        ) {
+            close_door(ps);
+            emit(state, p, ps->frame, ps->value, 0);
+        }
+    }
+    drain(state);
+}
+
+static bool parse_mode(const char * const text, Mode * const mode) {
+    static const struct {
+        const char *name;
+        Mode mode;
+    } modes[] = {
+        {"sample", MODE_SAMPLE},
+        {"change", MODE_CHANGE},
+        {"rle", MODE_RLE},
+        {"linear", MODE_LINEAR},
+    };
+    for (size_t i = 0; i < sizeof(modes) / sizeof(*modes); ++i) {
+        if (strcmp(text, modes[i].name) == 0) {
+            *mode = modes[i].mode;
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(const int argc, char ** const argv) {
+    static State state = {
+        .mode = MODE_CHANGE,
+        .threshold = 0.001f,
+    };
+
+    int argi = 1;
+    for (; argi < argc; ++argi) {
+        const char * const arg = argv[argi];
+        const char *value = NULL;
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            usage(stdout, argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(arg, "--version") == 0) {
+            puts("0.1");
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(arg, "--") == 0) {
+            ++argi;
+            break;
+        }
+        if (arg[0] != '-' || arg[1] == '\0') {
+            break;
+        }
+        if (match_option(argc, argv, &argi, "-p", "--port", &value)) {
+            if (value == NULL || *value == '\0') {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+            if (state.nports >= MAX_PORTS) {
+                fprintf(stderr, "too many ports (max %d)\n", MAX_PORTS);
+                return EXIT_FAILURE;
+            }
+            state.names[state.nports++] = value;
+        } else if (match_option(argc, argv, &argi, "-m", "--mode", &value)) {
+            if (value == NULL || !parse_mode(value, &state.mode)) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (
+            match_option(argc, argv, &argi, "-t", "--threshold", &value)
+        ) {
+            char *endptr = NULL;
+            state.threshold = value ? strtof(value, &endptr) : -1;
+            if (!endptr || *endptr != '\0' || !(state.threshold >= 0)) {
+                fputs("bad threshold\n", stderr);
+                return EXIT_FAILURE;
+            }
+        } else {
+            fprintf(stderr, "unknown option: %s\n", arg);
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - argi > 1) {
+        usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (state.nports == 0) {
+        state.names[state.nports++] = "in";
+    }
+
+    int sigfds[2];
+    if (pipe(sigfds) != 0) {
+        perror("pipe() failed");
+        return EXIT_FAILURE;
+    }
+    sigfd_write = sigfds[1];
+
+    static const int signals[] = {SIGHUP, SIGINT, SIGQUIT, SIGTERM};
+    for (size_t i = 0; i < sizeof(signals) / sizeof(*signals); ++i) {
+        if (!install_exit_handler(signals[i])) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    spsc_init(&state.ring, sizeof(Record), RING_SIZE / sizeof(Record));
+
+    const char * const name = argc > argi ? argv[argi] : "jacl-cv2stdio";
+    jack_status_t status = 0;
+    jack_client_t * const client =
+        jack_client_open(name, JackNoStartServer, &status);
+    if (client == NULL) {
+        fprintf(stderr, "jack_client_open() failed: 0x%x\n", (int)status);
+        return EXIT_FAILURE;
+    }
+
+    state.client = client;
+    const int spc_status = jack_set_process_callback(client, process, &state);
+    if (spc_status != 0) {
+        fprintf(
+            stderr,
+            "jack_set_process_callback() failed: %d\n",
+            spc_status
+        );
+        return close_and_fail(client);
+    }
+
+    const int slc_status =
+        jack_set_latency_callback(client, handle_latency, &state);
+    if (slc_status != 0) {
+        fprintf(
+            stderr,
+            "jack_set_latency_callback() failed: %d\n",
+            slc_status
+        );
+        return close_and_fail(client);
+    }
+
+    for (size_t i = 0; i < state.nports; ++i) {
+        jack_port_t * const port = jack_port_register(
+            client,
+            state.names[i],
+            JACK_DEFAULT_AUDIO_TYPE,
+            JackPortIsInput,
+            0
+        );
+        if (port == NULL) {
+            fputs("jack_port_register() failed\n", stderr);
+            return close_and_fail(client);
+        }
+
+        const jack_uuid_t uuid = jack_port_uuid(port);
+        const int sp_status = jack_set_property(
+            client,
+            uuid,
+            JACK_METADATA_SIGNAL_TYPE,
+            "CV",
+            "text/plain"
+        );
+        if (sp_status != 0) {
+            fprintf(stderr, "jack_set_property() failed: %d\n", sp_status);
+        }
+        state.ports[i] = port;
+    }
+
+    const int astatus = jack_activate(client);
+    if (astatus != 0) {
+        fprintf(stderr, "jack_activate() failed: %d\n", astatus);
+        return close_and_fail(client);
+    }
+
+    const int sigfd_read = sigfds[0];
+    if (!set_nonblock(sigfd_read)) {
+        return close_and_fail(client);
+    }
+    struct pollfd pollfd = {
+        .fd = sigfd_read,
+        .events = 0,
+    };
+    while (true) {
+        const int status = poll(&pollfd, 1, WRITE_INTERVAL);
+        if (status < 0 && errno != EINTR) {
+            perror("poll() failed");
+            return close_and_fail(client);
+        }
+        drain(&state);
+        if (status > 0 && pollfd.revents) {
+            break;
+        }
+    }
+
+    jack_client_close(client);
+    finish(&state);
+    const int tty = open("/dev/tty", O_WRONLY);
+    if (tty != -1) {
+        while (write(tty, "\n", 1) == -1 && errno == EINTR) {}
+        close(tty);
+    }
+    return EXIT_SUCCESS;
+}
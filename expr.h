@@ -0,0 +1,505 @@
+/*
+ * Copyright (C) 2025 taylor.fish <contact@taylor.fish>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// A small arithmetic expression language, compiled once into stack-machine
+// bytecode. Each instruction operates on a whole block of samples at a time,
+// so evaluation is a short sequence of simple (vectorizable) loops and never
+// allocates.
+#ifndef JACL_EXPR_H
+#define JACL_EXPR_H
+
+#include <ctype.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EXPR_BLOCK 256
+#define EXPR_STACK 16
+#define EXPR_MAX_CODE 256
+// Set in the values returned by ExprResolver for scalar (per-block
+// constant) inputs.
+#define EXPR_SCALAR 0x8000
+
+typedef enum ExprOp {
+    OP_CONST,
+    // Push an input block/scalar.
+    OP_BLOCK,
+    OP_SCALAR,
+    OP_NEG,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_POW,
+    OP_LT,
+    OP_GT,
+    OP_LE,
+    OP_GE,
+    OP_EQ,
+    OP_NE,
+    OP_SIN,
+    OP_COS,
+    OP_TAN,
+    OP_ABS,
+    OP_FLOOR,
+    OP_CEIL,
+    OP_SQRT,
+    OP_EXP,
+    OP_LOG,
+    OP_SAW,
+    OP_SQR,
+    OP_TRI,
+    OP_MIN,
+    OP_MAX,
+    OP_CLAMP,
+    OP_MIX,
+} ExprOp;
+
+typedef struct ExprInsn {
+    uint8_t op;
+    uint16_t arg;
+    double value;
+} ExprInsn;
+
+typedef struct Expr {
+    ExprInsn code[EXPR_MAX_CODE];
+    size_t len;
+} Expr;
+
+// Returns the input index for `name` (with EXPR_SCALAR set for scalar
+// inputs), or -1 if it's unknown. Variables are passed with their leading
+// '$'.
+typedef int (*ExprResolver)(void *ctx, const char *name, size_t len);
+
+typedef struct ExprParser {
+    const char *text;
+    const char *p;
+    Expr *expr;
+    ExprResolver resolve;
+    void *ctx;
+    int depth;
+    int max_depth;
+    bool error;
+} ExprParser;
+
+static const struct {
+    const char *name;
+    int nargs;
+    ExprOp op;
+} EXPR_FUNCTIONS[] = {
+    {"sin", 1, OP_SIN},
+    {"cos", 1, OP_COS},
+    {"tan", 1, OP_TAN},
+    {"abs", 1, OP_ABS},
+    {"floor", 1, OP_FLOOR},
+    {"ceil", 1, OP_CEIL},
+    {"sqrt", 1, OP_SQRT},
+    {"exp", 1, OP_EXP},
+    {"log", 1, OP_LOG},
+    {"saw", 1, OP_SAW},
+    {"sqr", 1, OP_SQR},
+    {"tri", 1, OP_TRI},
+    {"min", 2, OP_MIN},
+    {"max", 2, OP_MAX},
+    {"pow", 2, OP_POW},
+    {"clamp", 3, OP_CLAMP},
+    {"mix", 3, OP_MIX},
+};
+
+static inline void expr_fail(
+    ExprParser * const parser,
+    const char * const msg
+) {
+    if (!parser->error) {
+        fprintf(
+            stderr,
+            "expression error at column %d: %s\n",
+            (int)(parser->p - parser->text) + 1,
+            msg
+        );
+    }
+    parser->error = true;
+}
+
+// Appends an instruction that changes the stack depth by `delta`.
+static inline void expr_emit(
+    ExprParser * const parser,
+    const ExprOp op,
+    const int delta,
+    const uint16_t arg,
+    const double value
+) {
+    Expr * const expr = parser->expr;
+    if (expr->len >= EXPR_MAX_CODE) {
+        expr_fail(parser, "expression too long");
+        return;
+    }
+    expr->code[expr->len++] = (ExprInsn){
+        .op = (uint8_t)op,
+        .arg = arg,
+        .value = value,
+    };
+    parser->depth += delta;
+    if (parser->depth > parser->max_depth) {
+        parser->max_depth = parser->depth;
+    }
+}
+
+static inline void expr_skip_space(ExprParser * const parser) {
+    while (isspace((unsigned char)*parser->p)) {
+        ++parser->p;
+    }
+}
+
+static inline bool expr_accept(
+    ExprParser * const parser,
+    const char * const s
+) {
+    expr_skip_space(parser);
+    const size_t len = strlen(s);
+    if (strncmp(parser->p, s, len) != 0) {
+        return false;
+    }
+    parser->p += len;
+    return true;
+}
+
+static inline void expr_parse_expr(ExprParser *parser);
+
+static inline bool expr_is_ident(const char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+static inline void expr_parse_call(
+    ExprParser * const parser,
+    const char * const name,
+    const size_t len
+) {
+    const size_t nfunctions = sizeof(EXPR_FUNCTIONS) / sizeof(*EXPR_FUNCTIONS);
+    for (size_t i = 0; i < nfunctions; ++i) {
+        if (strlen(EXPR_FUNCTIONS[i].name) != len ||
+            strncmp(EXPR_FUNCTIONS[i].name, name, len) != 0) {
+            continue;
+        }
+        const int nargs = EXPR_FUNCTIONS[i].nargs;
+        for (int arg = 0; arg < nargs; ++arg) {
+            if (arg > 0 && !expr_accept(parser, ",")) {
+                expr_fail(parser, "expected ','");
+                return;
+            }
+            expr_parse_expr(parser);
+        }
+        if (!expr_accept(parser, ")")) {
+            expr_fail(parser, "expected ')'");
+            return;
+        }
+        expr_emit(parser, EXPR_FUNCTIONS[i].op, 1 - nargs, 0, 0);
+        return;
+    }
+    expr_fail(parser, "unknown function");
+}
+
+static inline void expr_parse_primary(ExprParser * const parser) {
+    expr_skip_space(parser);
+    const char * const start = parser->p;
+    if (expr_accept(parser, "(")) {
+        expr_parse_expr(parser);
+        if (!expr_accept(parser, ")")) {
+            expr_fail(parser, "expected ')'");
+        }
+        return;
+    }
+    if (isdigit((unsigned char)*start) || *start == '.') {
+        char *endptr = NULL;
+        const double value = strtod(start, &endptr);
+        if (endptr == start) {
+            expr_fail(parser, "bad number");
+            return;
+        }
+        parser->p = endptr;
+        expr_emit(parser, OP_CONST, 1, 0, value);
+        return;
+    }
+    const char *end = start + (*start == '$');
+    while (expr_is_ident(*end)) {
+        ++end;
+    }
+    const size_t len = end - start;
+    if (len == 0 || (len == 1 && *start == '$')) {
+        expr_fail(parser, "expected a value");
+        return;
+    }
+    parser->p = end;
+    if (*start != '$' && expr_accept(parser, "(")) {
+        expr_parse_call(parser, start, len);
+        return;
+    }
+    if (len == 2 && strncmp(start, "pi", 2) == 0) {
+        expr_emit(parser, OP_CONST, 1, 0, 3.14159265358979);
+        return;
+    }
+    const int input = parser->resolve(parser->ctx, start, len);
+    if (input < 0) {
+        parser->p = start;
+        expr_fail(parser, "unknown name");
+        return;
+    }
+    const bool scalar = input & EXPR_SCALAR;
+    expr_emit(
+        parser,
+        scalar ? OP_SCALAR : OP_BLOCK,
+        1,
+        (uint16_t)(input & ~EXPR_SCALAR),
+        0
+    );
+}
+
+static inline void expr_parse_unary(ExprParser *parser);
+
+static inline void expr_parse_power(ExprParser * const parser) {
+    expr_parse_primary(parser);
+    if (expr_accept(parser, "^")) {
+        expr_parse_unary(parser);
+        expr_emit(parser, OP_POW, -1, 0, 0);
+    }
+}
+
+static inline void expr_parse_unary(ExprParser * const parser) {
+    if (expr_accept(parser, "-")) {
+        expr_parse_unary(parser);
+        expr_emit(parser, OP_NEG, 0, 0, 0);
+        return;
+    }
+    expr_accept(parser, "+");
+    expr_parse_power(parser);
+}
+
+static inline void expr_parse_product(ExprParser * const parser) {
+    expr_parse_unary(parser);
+    while (!parser->error) {
+        ExprOp op;
+        if (expr_accept(parser, "*")) {
+            op = OP_MUL;
+        } else if (expr_accept(parser, "/")) {
+            op = OP_DIV;
+        } else if (expr_accept(parser, "%")) {
+            op = OP_MOD;
+        } else {
+            break;
+        }
+        expr_parse_unary(parser);
+        expr_emit(parser, op, -1, 0, 0);
+    }
+}
+
+static inline void expr_parse_sum(ExprParser * const parser) {
+    expr_parse_product(parser);
+    while (!parser->error) {
+        ExprOp op;
+        if (expr_accept(parser, "+")) {
+            op = OP_ADD;
+        } else if (expr_accept(parser, "-")) {
+            op = OP_SUB;
+        } else {
+            break;
+        }
+        expr_parse_product(parser);
+        expr_emit(parser, op, -1, 0, 0);
+    }
+}
+
+static inline void expr_parse_expr(ExprParser * const parser) {
+    expr_parse_sum(parser);
+    while (!parser->error) {
+        ExprOp op;
+        // Two-character operators first.
+        if (expr_accept(parser, "<=")) {
+            op = OP_LE;
+        } else if (expr_accept(parser, ">=")) {
+            op = OP_GE;
+        } else if (expr_accept(parser, "==")) {
+            op = OP_EQ;
+        } else if (expr_accept(parser, "!=")) {
+            op = OP_NE;
+        } else if (expr_accept(parser, "<")) {
+            op = OP_LT;
+        } else if (expr_accept(parser, ">")) {
+            op = OP_GT;
+        } else {
+            break;
+        }
+        expr_parse_sum(parser);
+        expr_emit(parser, op, -1, 0, 0);
+    }
+}
+
+// Compiles `text` into `expr`. Prints an error and returns false on failure.
+static inline bool expr_compile(
+    Expr * const expr,
+    const char * const text,
+    const ExprResolver resolve,
+    void * const ctx
+) {
+    ExprParser parser = {
+        .text = text,
+        .p = text,
+        .expr = expr,
+        .resolve = resolve,
+        .ctx = ctx,
+    };
+    expr->len = 0;
+    expr_parse_expr(&parser);
+    expr_skip_space(&parser);
+    if (!parser.error && *parser.p != '\0') {
+        expr_fail(&parser, "unexpected character");
+    }
+    if (!parser.error && parser.max_depth > EXPR_STACK) {
+        expr_fail(&parser, "expression too deeply nested");
+    }
+    return !parser.error;
+}
+
+typedef struct ExprStack {
+    double data[EXPR_STACK][EXPR_BLOCK];
+} ExprStack;
+
+// Fills `block[0..n]` with `start + step * i`. Each value is computed on its
+// own, so errors don't accumulate along the block.
+static inline void expr_fill_ramp(
+    double * const block,
+    const size_t n,
+    const double start,
+    const double step
+) {
+    for (size_t i = 0; i < n; ++i) {
+        block[i] = start + step * (double)i;
+    }
+}
+
+#define EXPR_MAP1(f) \
+    for (size_t i = 0; i < n; ++i) { \
+        a[i] = (f); \
+    }
+
+#define EXPR_MAP2(f) \
+    for (size_t i = 0; i < n; ++i) { \
+        b[i] = (f); \
+    }
+
+// Evaluates `expr` for `n` (at most EXPR_BLOCK) samples, writing the result
+// to `out`. `blocks` and `scalars` hold the current inputs. Evaluation is
+// in double precision, so inputs that keep growing, like times, stay exact
+// enough to step by a single frame; only the result is rounded to float.
+static inline void expr_eval(
+    const Expr * const expr,
+    const double * const * const blocks,
+    const float * const scalars,
+    ExprStack * const stack,
+    float * const out,
+    const size_t n
+) {
+    size_t sp = 0;
+    for (size_t pc = 0; pc < expr->len; ++pc) {
+        const ExprInsn insn = expr->code[pc];
+        // `a` is the top of the stack; `b` the element below it. Binary
+        // operations write to `b`.
+        double * const a = sp > 0 ? stack->data[sp - 1] : NULL;
+        double * const b = sp > 1 ? stack->data[sp - 2] : NULL;
+        double * const c = sp > 2 ? stack->data[sp - 3] : NULL;
+        double * const top = stack->data[sp];
+        switch ((ExprOp)insn.op) {
+            case OP_CONST: {
+                const double value = insn.value;
+                for (size_t i = 0; i < n; ++i) {
+                    top[i] = value;
+                }
+                ++sp;
+                break;
+            }
+            case OP_BLOCK:
+                memcpy(top, blocks[insn.arg], n * sizeof(*top));
+                ++sp;
+                break;
+            case OP_SCALAR: {
+                const double value = scalars[insn.arg];
+                for (size_t i = 0; i < n; ++i) {
+                    top[i] = value;
+                }
+                ++sp;
+                break;
+            }
+            case OP_NEG: EXPR_MAP1(-a[i]) break;
+            case OP_SIN: EXPR_MAP1(sin(a[i])) break;
+            case OP_COS: EXPR_MAP1(cos(a[i])) break;
+            case OP_TAN: EXPR_MAP1(tan(a[i])) break;
+            case OP_ABS: EXPR_MAP1(fabs(a[i])) break;
+            case OP_FLOOR: EXPR_MAP1(floor(a[i])) break;
+            case OP_CEIL: EXPR_MAP1(ceil(a[i])) break;
+            case OP_SQRT: EXPR_MAP1(sqrt(a[i])) break;
+            case OP_EXP: EXPR_MAP1(exp(a[i])) break;
+            case OP_LOG: EXPR_MAP1(log(a[i])) break;
+            case OP_SAW: EXPR_MAP1(2 * (a[i] - floor(a[i])) - 1) break;
+            case OP_SQR:
+                EXPR_MAP1(a[i] - floor(a[i]) < 0.5 ? 1.0 : -1.0)
+                break;
+            case OP_TRI:
+                EXPR_MAP1(1 - 4 * fabs(a[i] - floor(a[i]) - 0.5))
+                break;
+            case OP_ADD: EXPR_MAP2(b[i] + a[i]) --sp; break;
+            case OP_SUB: EXPR_MAP2(b[i] - a[i]) --sp; break;
+            case OP_MUL: EXPR_MAP2(b[i] * a[i]) --sp; break;
+            case OP_DIV: EXPR_MAP2(b[i] / a[i]) --sp; break;
+            case OP_MOD: EXPR_MAP2(fmod(b[i], a[i])) --sp; break;
+            case OP_POW: EXPR_MAP2(pow(b[i], a[i])) --sp; break;
+            case OP_LT: EXPR_MAP2(b[i] < a[i]) --sp; break;
+            case OP_GT: EXPR_MAP2(b[i] > a[i]) --sp; break;
+            case OP_LE: EXPR_MAP2(b[i] <= a[i]) --sp; break;
+            case OP_GE: EXPR_MAP2(b[i] >= a[i]) --sp; break;
+            case OP_EQ: EXPR_MAP2(b[i] == a[i]) --sp; break;
+            case OP_NE: EXPR_MAP2(b[i] != a[i]) --sp; break;
+            case OP_MIN: EXPR_MAP2(fmin(b[i], a[i])) --sp; break;
+            case OP_MAX: EXPR_MAP2(fmax(b[i], a[i])) --sp; break;
+            case OP_CLAMP:
+                // clamp(x, lo, hi): c = x, b = lo, a = hi
+                for (size_t i = 0; i < n; ++i) {
+                    c[i] = fmin(fmax(c[i], b[i]), a[i]);
+                }
+                sp -= 2;
+                break;
+            case OP_MIX:
+                // mix(x, y, t): c = x, b = y, a = t
+                for (size_t i = 0; i < n; ++i) {
+                    c[i] += (b[i] - c[i]) * a[i];
+                }
+                sp -= 2;
+                break;
+        }
+    }
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = (float)stack->data[0][i];
+    }
+}
+
+#undef EXPR_MAP1
+#undef EXPR_MAP2
+
+#endif
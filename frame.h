@@ -0,0 +1,470 @@
+/*
+ * Copyright (C) 2025 taylor.fish <contact@taylor.fish>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Framing for MIDI sent over lossy datagram transports (UDP multicast).
+//
+// Messages are grouped into batches, and every batch gets a sequence
+// number. Each datagram carries the newest batch along with up to
+// `redundancy` of the batches before it, so a receiver can recover from
+// isolated losses and detect the rest on its own, without a back channel.
+//
+// Datagram layout (integers are big-endian):
+//   "JM", version (1 byte), batch count (1 byte), session (4 bytes),
+//   send time (4 bytes, microseconds on any clock of the sender's choosing)
+//   then for each batch, oldest first:
+//     sequence (4 bytes), length (2 bytes), messages
+//   where each message is its length (1 byte, or 2 bytes with the high bit
+//   of the first set) followed by its bytes. If the high bit of the batch
+//   length is set, the messages are compressed as an lz.h block.
+//   If the high bit of the batch count is set, the datagram ends with a
+//   CRC-32C (4 bytes) of everything before it. Datagrams that fail the
+//   check are dropped whole, so corruption can't turn into stray messages.
+//
+// The session is chosen randomly by the sender when it starts, so receivers
+// can tell a restarted sender from a stream of old duplicates. Send times
+// only matter relative to each other; receivers use them to measure
+// network jitter.
+//
+// Over a byte stream, each datagram is preceded by its length (2 bytes).
+//
+// The same datagrams may also be sent over several network paths at once. A
+// receiver taking all of them delivers each batch once, in sequence order,
+// holding batches that arrive early (up to FRAME_WINDOW of them) until the
+// ones before them come in over another path or are given up for lost.
+#ifndef JACL_FRAME_H
+#define JACL_FRAME_H
+
+#include "crc32c.h"
+#include "lz.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Bumped whenever the datagram layout changes, so receivers drop datagrams
+// they can't parse instead of misreading them. Version 1 had no send time.
+#define FRAME_VERSION 2
+// Largest datagram; small enough to avoid IP fragmentation on Ethernet.
+#define FRAME_MAX 1400
+#define FRAME_HEADER 12
+#define FRAME_BATCH_HEADER 6
+#define FRAME_CRC 4
+// Room for one batch in a datagram, leaving space for a CRC.
+#define FRAME_BATCH_MAX (FRAME_MAX - FRAME_HEADER - FRAME_BATCH_HEADER - \
+    FRAME_CRC)
+// Largest message that fits in a batch of its own.
+#define FRAME_MESSAGE_MAX (FRAME_BATCH_MAX - 2)
+#define FRAME_MAX_REDUNDANCY 7
+#define FRAME_HAS_CRC 0x80
+#define FRAME_COMPRESSED 0x8000
+// Batches smaller than this are never compressed: the saving wouldn't pay
+// for the CPU time.
+#define FRAME_COMPRESS_MIN 128
+// Batches a reordering receiver holds at most.
+#define FRAME_WINDOW 8
+
+typedef struct FrameBatch {
+    uint32_t seq;
+    size_t len;
+    bool compressed;
+    unsigned char data[FRAME_BATCH_MAX];
+} FrameBatch;
+
+typedef struct FrameSender {
+    uint32_t session;
+    uint32_t seq;
+    unsigned redundancy;
+    // Whether to compress batches that are large enough.
+    bool compress;
+    // Whether to append a CRC to every datagram.
+    bool checksum;
+    // The batch being filled.
+    FrameBatch current;
+    // The last `redundancy` batches sent, as a ring indexed by sequence
+    // number.
+    FrameBatch history[FRAME_MAX_REDUNDANCY];
+} FrameSender;
+
+static inline void frame_write_u32(unsigned char * const p, const uint32_t n) {
+    p[0] = n >> 24;
+    p[1] = (n >> 16) & 0xff;
+    p[2] = (n >> 8) & 0xff;
+    p[3] = n & 0xff;
+}
+
+static inline uint32_t frame_read_u32(const unsigned char * const p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | p[2] << 8 | p[3];
+}
+
+static inline void frame_sender_init(
+    FrameSender * const sender,
+    const uint32_t session,
+    const unsigned redundancy
+) {
+    memset(sender, 0, sizeof(*sender));
+    sender->session = session;
+    sender->redundancy = redundancy < FRAME_MAX_REDUNDANCY ?
+        redundancy : FRAME_MAX_REDUNDANCY;
+}
+
+static inline bool frame_empty(const FrameSender * const sender) {
+    return sender->current.len == 0;
+}
+
+// Adds a message to the current batch. Returns false if it doesn't fit;
+// the caller should then send the batch with frame_finish() and try again.
+// Messages longer than FRAME_MESSAGE_MAX never fit.
+static inline bool frame_add(
+    FrameSender * const sender,
+    const unsigned char * const message,
+    const size_t len
+) {
+    FrameBatch * const batch = &sender->current;
+    const size_t prefix = len < 0x80 ? 1 : 2;
+    if (
+        len > FRAME_MESSAGE_MAX ||
+        batch->len + prefix + len > sizeof(batch->data)
+    ) {
+        return false;
+    }
+    unsigned char *p = batch->data + batch->len;
+    if (prefix == 1) {
+        *p++ = (unsigned char)len;
+    } else {
+        *p++ = 0x80 | (unsigned char)(len >> 8);
+        *p++ = len & 0xff;
+    }
+    memcpy(p, message, len);
+    batch->len += prefix + len;
+    return true;
+}
+
+// Closes the current batch and encodes a datagram of it and as many of the
+// previous batches as fit into `out` (FRAME_MAX bytes). `time` is the send
+// time in microseconds. Returns the datagram's length.
+static inline size_t frame_finish(
+    FrameSender * const sender,
+    const uint32_t time,
+    unsigned char * const out
+) {
+    FrameBatch * const current = &sender->current;
+    current->seq = sender->seq++;
+    current->compressed = false;
+    if (sender->compress && current->len >= FRAME_COMPRESS_MIN) {
+        // Keep the result only if it saves at least an eighth.
+        unsigned char packed[sizeof(current->data)];
+        const size_t len = lz_compress(
+            current->data,
+            current->len,
+            packed,
+            current->len - current->len / 8
+        );
+        if (len > 0) {
+            memcpy(current->data, packed, len);
+            current->len = len;
+            current->compressed = true;
+        }
+    }
+
+    // Choose the previous batches to repeat, newest first.
+    const size_t max = FRAME_MAX - (sender->checksum ? FRAME_CRC : 0);
+    size_t size = FRAME_HEADER + FRAME_BATCH_HEADER + current->len;
+    unsigned count = 0;
+    while (count < sender->redundancy && count < current->seq) {
+        const uint32_t seq = current->seq - count - 1;
+        const FrameBatch * const batch =
+            &sender->history[seq % sender->redundancy];
+        if (size + FRAME_BATCH_HEADER + batch->len > max) {
+            break;
+        }
+        size += FRAME_BATCH_HEADER + batch->len;
+        ++count;
+    }
+
+    out[0] = 'J';
+    out[1] = 'M';
+    out[2] = FRAME_VERSION;
+    out[3] = (unsigned char)(count + 1) |
+        (sender->checksum ? FRAME_HAS_CRC : 0);
+    frame_write_u32(out + 4, sender->session);
+    frame_write_u32(out + 8, time);
+    unsigned char *p = out + FRAME_HEADER;
+    for (unsigned i = count + 1; i-- > 0;) {
+        const FrameBatch * const batch = i == 0 ? current :
+            &sender->history[(current->seq - i) % sender->redundancy];
+        const size_t len =
+            batch->len | (batch->compressed ? FRAME_COMPRESSED : 0);
+        frame_write_u32(p, batch->seq);
+        p[4] = len >> 8;
+        p[5] = len & 0xff;
+        memcpy(p + FRAME_BATCH_HEADER, batch->data, batch->len);
+        p += FRAME_BATCH_HEADER + batch->len;
+    }
+
+    if (sender->checksum) {
+        frame_write_u32(p, crc32c(out, size));
+        size += FRAME_CRC;
+    }
+
+    if (sender->redundancy > 0) {
+        sender->history[current->seq % sender->redundancy] = *current;
+    }
+    current->len = 0;
+    return size;
+}
+
+// A batch received ahead of its turn, decompressed.
+typedef struct FrameHeld {
+    bool held;
+    uint32_t seq;
+    size_t len;
+    unsigned char data[FRAME_MAX];
+} FrameHeld;
+
+typedef struct FrameReceiver {
+    bool synced;
+    uint32_t session;
+    // The next sequence number expected.
+    uint32_t next;
+    // Whether to hold batches that arrive early instead of counting the
+    // ones before them as lost right away. Held batches are kept in a ring
+    // indexed by sequence number; no allocation, so the work per batch is
+    // bounded.
+    bool reorder;
+    unsigned nheld;
+    FrameHeld window[FRAME_WINDOW];
+    // Batches that never arrived, and batches recovered from a redundant
+    // copy after the datagram that first carried them was lost.
+    unsigned long lost;
+    unsigned long recovered;
+    // Datagrams dropped because they failed the CRC check.
+    unsigned long corrupt;
+    // The send time of the last datagram received.
+    uint32_t sent;
+} FrameReceiver;
+
+typedef void (*FrameHandler)(
+    void *ctx,
+    const unsigned char *message,
+    size_t len
+);
+
+static inline bool frame_deliver(
+    const unsigned char *p,
+    const unsigned char * const end,
+    const FrameHandler handler,
+    void * const ctx
+) {
+    while (p < end) {
+        size_t len = *p++;
+        if (len & 0x80) {
+            if (p == end) {
+                return false;
+            }
+            len = (len & 0x7f) << 8 | *p++;
+        }
+        if ((size_t)(end - p) < len) {
+            return false;
+        }
+        handler(ctx, p, len);
+        p += len;
+    }
+    return true;
+}
+
+// Delivers the held batches that are next in sequence.
+static inline void frame_drain(
+    FrameReceiver * const receiver,
+    const FrameHandler handler,
+    void * const ctx
+) {
+    while (receiver->nheld > 0) {
+        FrameHeld * const held =
+            &receiver->window[receiver->next % FRAME_WINDOW];
+        if (!held->held || held->seq != receiver->next) {
+            break;
+        }
+        held->held = false;
+        --receiver->nheld;
+        ++receiver->next;
+        frame_deliver(held->data, held->data + held->len, handler, ctx);
+    }
+}
+
+// Gives up on every batch before `seq` that hasn't arrived, delivering the
+// held ones among them and any that follow.
+static inline void frame_skip_to(
+    FrameReceiver * const receiver,
+    const uint32_t seq,
+    const FrameHandler handler,
+    void * const ctx
+) {
+    // Only batches within a window of `next` can be held.
+    uint32_t skipped = seq - receiver->next;
+    if (skipped > FRAME_WINDOW) {
+        receiver->lost += skipped - FRAME_WINDOW;
+        skipped = FRAME_WINDOW;
+    }
+    for (uint32_t i = 0; i < skipped; ++i) {
+        FrameHeld * const held =
+            &receiver->window[(receiver->next + i) % FRAME_WINDOW];
+        if (!held->held || held->seq != receiver->next + i) {
+            ++receiver->lost;
+            continue;
+        }
+        held->held = false;
+        --receiver->nheld;
+        frame_deliver(held->data, held->data + held->len, handler, ctx);
+    }
+    receiver->next = seq;
+    frame_drain(receiver, handler, ctx);
+}
+
+static inline void frame_clear_window(FrameReceiver * const receiver) {
+    for (unsigned i = 0; i < FRAME_WINDOW; ++i) {
+        receiver->window[i].held = false;
+    }
+    receiver->nheld = 0;
+}
+
+// Whether the receiver is holding batches until a gap before them is
+// filled. The caller should call frame_flush() if that takes too long.
+static inline bool frame_pending(const FrameReceiver * const receiver) {
+    return receiver->nheld > 0;
+}
+
+// Gives up on the oldest gap, delivering the held batches after it up to
+// the next gap, if any.
+static inline void frame_flush(
+    FrameReceiver * const receiver,
+    const FrameHandler handler,
+    void * const ctx
+) {
+    for (uint32_t i = 1; i < FRAME_WINDOW && receiver->nheld > 0; ++i) {
+        const uint32_t seq = receiver->next + i;
+        const FrameHeld * const held = &receiver->window[seq % FRAME_WINDOW];
+        if (!held->held || held->seq != seq) {
+            continue;
+        }
+        frame_skip_to(receiver, seq, handler, ctx);
+        return;
+    }
+}
+
+// Passes every message in the datagram that hasn't been seen yet to
+// `handler`, in order. Returns false if the datagram is malformed or
+// corrupt.
+static inline bool frame_receive(
+    FrameReceiver * const receiver,
+    const unsigned char * const data,
+    const size_t len,
+    const FrameHandler handler,
+    void * const ctx
+) {
+    if (
+        len < FRAME_HEADER ||
+        data[0] != 'J' ||
+        data[1] != 'M' ||
+        data[2] != FRAME_VERSION
+    ) {
+        return false;
+    }
+    const unsigned count = data[3] & ~FRAME_HAS_CRC;
+    const unsigned char *end = data + len;
+    if (data[3] & FRAME_HAS_CRC) {
+        if (len < FRAME_HEADER + FRAME_CRC) {
+            return false;
+        }
+        end -= FRAME_CRC;
+        if (crc32c(data, end - data) != frame_read_u32(end)) {
+            ++receiver->corrupt;
+            return false;
+        }
+    }
+    const uint32_t session = frame_read_u32(data + 4);
+    receiver->sent = frame_read_u32(data + 8);
+    const unsigned char *p = data + FRAME_HEADER;
+    for (unsigned i = 0; i < count; ++i) {
+        if ((size_t)(end - p) < FRAME_BATCH_HEADER) {
+            return false;
+        }
+        const uint32_t seq = frame_read_u32(p);
+        const size_t len_field = (size_t)p[4] << 8 | p[5];
+        const bool compressed = len_field & FRAME_COMPRESSED;
+        size_t batch_len = len_field & ~(size_t)FRAME_COMPRESSED;
+        const unsigned char *batch = p + FRAME_BATCH_HEADER;
+        if ((size_t)(end - batch) < batch_len) {
+            return false;
+        }
+        p = batch + batch_len;
+
+        if (!receiver->synced || receiver->session != session) {
+            // Start with the newest batch rather than replaying old ones.
+            if (i + 1 < count) {
+                continue;
+            }
+            receiver->synced = true;
+            receiver->session = session;
+            receiver->next = seq;
+            frame_clear_window(receiver);
+        }
+        const int32_t ahead = (int32_t)(seq - receiver->next);
+        FrameHeld * const slot = &receiver->window[seq % FRAME_WINDOW];
+        if (ahead < 0 || (ahead > 0 && slot->held && slot->seq == seq)) {
+            // Already delivered, or held.
+            continue;
+        }
+        unsigned char unpacked[FRAME_MAX];
+        if (compressed) {
+            const long unpacked_len =
+                lz_decompress(batch, batch_len, unpacked, sizeof(unpacked));
+            if (unpacked_len < 0) {
+                return false;
+            }
+            batch = unpacked;
+            batch_len = (size_t)unpacked_len;
+        }
+        if (i + 1 < count) {
+            ++receiver->recovered;
+        }
+        if (ahead > 0 && !receiver->reorder) {
+            receiver->lost += (uint32_t)ahead;
+            receiver->next = seq;
+        } else if (ahead > 0) {
+            if (ahead >= FRAME_WINDOW) {
+                const uint32_t oldest = seq - (FRAME_WINDOW - 1);
+                frame_skip_to(receiver, oldest, handler, ctx);
+            }
+            if (seq != receiver->next) {
+                slot->held = true;
+                slot->seq = seq;
+                slot->len = batch_len;
+                memcpy(slot->data, batch, batch_len);
+                ++receiver->nheld;
+                continue;
+            }
+        }
+        receiver->next = seq + 1;
+        if (!frame_deliver(batch, batch + batch_len, handler, ctx)) {
+            return false;
+        }
+        frame_drain(receiver, handler, ctx);
+    }
+    return true;
+}
+
+#endif
@@ -0,0 +1,952 @@
+/*
+ * Copyright (C) 2025 taylor.fish <contact@taylor.fish>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "probes.h"
+#include "queue.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <jack/jack.h>
+#include <jack/midiport.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#define MAX_LAYERS 64
+// Each layer is indexed in at most LOOP_BUCKETS buckets of frames.
+#define LOOP_BUCKETS 1024
+#define MAX_PERIOD_EVENTS 512
+#define COMMAND_QUEUE 64
+#define DEFAULT_POOL (1 << 16)
+
+static int sigfd_write;
+
+static const char *USAGE = "\
+Usage: %s [options] [client-name]\n\
+\n\
+A MIDI looper that follows the JACK transport. MIDI from the input port is\n\
+passed through to the output port and recorded into the loop, which is\n\
+played back while the transport is rolling.\n\
+\n\
+Commands are read from standard input, one per line:\n\
+\n\
+  record    Start recording the first layer; the next command closes it,\n\
+            which sets the loop length.\n\
+  overdub   Start or stop recording additional layers. Each pass through\n\
+            the loop becomes its own layer.\n\
+  play      Stop recording.\n\
+  undo      Remove the most recent layer.\n\
+  clear     Remove all layers.\n\
+\n\
+[client-name] is the name of the JACK client to create; if not provided, the\n\
+default is 'jacl-looper'.\n\
+\n\
+Options:\n\
+  -c, --control <channel>:<cc>\n\
+                      Also accept commands as MIDI control changes on\n\
+                      <channel> (1-16): <cc> is record, and the next four\n\
+                      controllers are overdub, play, undo and clear. Values\n\
+                      of 64 or more trigger the command. These messages are\n\
+                      not recorded or passed through.\n\
+  -e, --events <count>\n\
+                      Maximum number of recorded events (default: 65536).\n\
+  -n, --no-thru       Don't pass input through to the output.\n\
+";
+
+static void usage(FILE * const stream, const char * const arg0) {
+    const char *bin = arg0 ? arg0 : "";
+    size_t start = 0;
+    for (size_t i = 0; bin[i] != '\0'; ++i) {
+        if (bin[i] == '/') {
+            start = i + 1;
+        }
+    }
+    bin += start;
+    if (*bin == '\0') {
+        bin = "jacl-looper";
+    }
+    fprintf(stream, USAGE, bin);
+}
+
+static void handle_exit_signal(const int signum) {
+    (void)signum;
+    close(sigfd_write);
+}
+
+static bool install_exit_handler(const int signum) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    const struct sigaction act = {
+        .sa_handler = handle_exit_signal,
+        .sa_mask = mask,
+        .sa_flags = 0,
+    };
+    if (sigaction(signum, &act, NULL) == 0) {
+        return true;
+    }
+    fprintf(stderr, "sigaction(%d) failed", signum);
+    perror("");
+    return false;
+}
+
+static bool set_nonblock(const int fd) {
+    const int flags = fcntl(fd, F_GETFL);
+    if (flags == -1) {
+        fprintf(stderr, "fcntl(%d, F_GETFL) failed", fd);
+        perror("");
+        return false;
+    }
+    if (flags & O_NONBLOCK) {
+        return true;
+    }
+    if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        fprintf(stderr, "fcntl(%d, F_SETFL) failed", fd);
+        perror("");
+        return false;
+    }
+    return true;
+}
+
+// Matches option `shortopt` or `longopt` at `argv[*argi]`, accepting both
+// "--long value" and "--long=value". On a match, `*value` is set to the
+// option's argument (NULL if missing) and `*argi` is advanced past it.
+static bool match_option(
+    const int argc,
+    char ** const argv,
+    int * const argi,
+    const char * const shortopt,
+    const char * const longopt,
+    const char ** const value
+) {
+    const char * const arg = argv[*argi];
+    const size_t longlen = strlen(longopt);
+    if (strncmp(arg, longopt, longlen) == 0 && arg[longlen] == '=') {
+        *value = arg + longlen + 1;
+        return true;
+    }
+    if (strcmp(arg, shortopt) != 0 && strcmp(arg, longopt) != 0) {
+        return false;
+    }
+    *value = *argi + 1 < argc ? argv[++*argi] : NULL;
+    return true;
+}
+
+typedef enum Command {
+    CMD_RECORD,
+    CMD_OVERDUB,
+    CMD_PLAY,
+    CMD_UNDO,
+    CMD_CLEAR,
+    NUM_COMMANDS,
+} Command;
+
+static const char * const COMMAND_NAMES[] = {
+    [CMD_RECORD] = "record",
+    [CMD_OVERDUB] = "overdub",
+    [CMD_PLAY] = "play",
+    [CMD_UNDO] = "undo",
+    [CMD_CLEAR] = "clear",
+};
+
+typedef enum Mode {
+    MODE_EMPTY,
+    MODE_RECORDING,
+    MODE_PLAYING,
+    MODE_OVERDUBBING,
+} Mode;
+
+// A recorded channel message. Eight bytes, so a cache line holds eight.
+typedef struct LoopEvent {
+    // Frames from the start of the loop.
+    uint32_t pos;
+    uint8_t size;
+    uint8_t data[3];
+} LoopEvent;
+
+// A layer is a run of events in the pool, sorted by position.
+typedef struct Layer {
+    uint32_t start;
+    uint32_t count;
+    // For each bucket of positions, the index (relative to `start`) of the
+    // first event at or after the start of the bucket.
+    uint32_t buckets[LOOP_BUCKETS + 1];
+    // The index of the next event to play.
+    uint32_t next;
+} Layer;
+
+typedef struct Output {
+    jack_nframes_t time;
+    uint8_t size;
+    uint8_t data[3];
+} Output;
+
+typedef struct State {
+    jack_client_t *client;
+    jack_port_t *in;
+    jack_port_t *out;
+    bool thru;
+    // Control changes on this channel starting at `control_cc` are
+    // commands, if `control_channel` is non-negative.
+    int control_channel;
+    int control_cc;
+
+    // Commands from the main thread, one byte each.
+    SpscRing commands;
+
+    // From the latency callback, in frames: how long input takes to reach
+    // the looper, and how long its output takes to be heard.
+    atomic_uint capture_latency;
+    atomic_uint playback_latency;
+
+    // Everything below is process thread only. Layers and the pool are
+    // preallocated; recording just appends to the pool.
+    LoopEvent *pool;
+    uint32_t pool_size;
+    uint32_t pool_used;
+    Layer layers[MAX_LAYERS];
+    size_t nlayers;
+    Mode mode;
+    // Transport frame where the loop starts, and its length.
+    jack_nframes_t origin;
+    jack_nframes_t length;
+    unsigned bucket_shift;
+    // The pass through the loop in which the layer being recorded started,
+    // and the position of its last event.
+    jack_nframes_t layer_pass;
+    jack_nframes_t last_pos;
+    // The playback frame (see process()) expected at the start of the next
+    // period.
+    jack_nframes_t next_frame;
+    bool located;
+    // Notes currently sounding from playback, one bit per note.
+    uint64_t sounding[16][2];
+    Output outputs[MAX_PERIOD_EVENTS];
+    size_t noutputs;
+} State;
+
+static int close_and_fail(jack_client_t * const client) {
+    jack_client_close(client);
+    return EXIT_FAILURE;
+}
+
+static void send_command(State * const state, const Command command) {
+    const uint8_t byte = (uint8_t)command;
+    if (spsc_push(&state->commands, &byte, 1) == 0) {
+        fputs("command queue full\n", stderr);
+    }
+}
+
+static void emit(
+    State * const state,
+    const jack_nframes_t time,
+    const uint8_t * const data,
+    const uint8_t size
+) {
+    if (state->noutputs >= MAX_PERIOD_EVENTS) {
+        return;
+    }
+    Output * const output = &state->outputs[state->noutputs++];
+    output->time = time;
+    output->size = size;
+    memcpy(output->data, data, size);
+}
+
+// Emits a loop event, keeping track of which notes are sounding.
+static void play_event(
+    State * const state,
+    const jack_nframes_t time,
+    const LoopEvent * const event
+) {
+    const uint8_t status = event->data[0] & 0xf0;
+    const unsigned channel = event->data[0] & 0xf;
+    if ((status == 0x90 || status == 0x80) && event->size == 3) {
+        const unsigned note = event->data[1] & 0x7f;
+        const uint64_t bit = (uint64_t)1 << (note % 64);
+        if (status == 0x90 && event->data[2] > 0) {
+            state->sounding[channel][note / 64] |= bit;
+        } else {
+            state->sounding[channel][note / 64] &= ~bit;
+        }
+    }
+    emit(state, time, event->data, event->size);
+}
+
+// Sends note-offs for every note sounding from playback.
+static void silence(State * const state, const jack_nframes_t time) {
+    for (unsigned channel = 0; channel < 16; ++channel) {
+        for (unsigned note = 0; note < 128; ++note) {
+            const uint64_t bit = (uint64_t)1 << (note % 64);
+            if (!(state->sounding[channel][note / 64] & bit)) {
+                continue;
+            }
+            const uint8_t off[] = {0x80 | channel, note, 0};
+            emit(state, time, off, sizeof(off));
+        }
+    }
+    memset(state->sounding, 0, sizeof(state->sounding));
+}
+
+// Starts a new layer in the pool. Returns false if there is no room.
+static bool open_layer(State * const state, const jack_nframes_t pos) {
+    if (state->nlayers >= MAX_LAYERS) {
+        return false;
+    }
+    Layer * const layer = &state->layers[state->nlayers];
+    layer->start = state->pool_used;
+    layer->count = 0;
+    state->last_pos = pos;
+    return true;
+}
+
+// Indexes the layer being recorded and makes it playable. Empty layers are
+// dropped, so that undo always removes something audible.
+static void close_layer(State * const state, const jack_nframes_t pos) {
+    Layer * const layer = &state->layers[state->nlayers];
+    if (layer->count == 0) {
+        return;
+    }
+    const LoopEvent * const events = &state->pool[layer->start];
+    uint32_t next = 0;
+    for (uint32_t b = 0; b <= LOOP_BUCKETS; ++b) {
+        const uint64_t start = (uint64_t)b << state->bucket_shift;
+        while (next < layer->count && events[next].pos < start) {
+            ++next;
+        }
+        layer->buckets[b] = next;
+    }
+    // The layer's events from before `pos` have already been heard.
+    layer->next = layer->buckets[pos >> state->bucket_shift];
+    while (layer->next < layer->count && events[layer->next].pos < pos) {
+        ++layer->next;
+    }
+    ++state->nlayers;
+}
+
+static void record_event(
+    State * const state,
+    const jack_nframes_t pos,
+    const jack_midi_event_t * const event
+) {
+    if (event->size == 0 || event->size > 3) {
+        return;
+    }
+    Layer * const layer = &state->layers[state->nlayers];
+    // Layers must stay sorted; this only fails if the transport moved
+    // backwards while recording the first layer.
+    if (state->pool_used >= state->pool_size || pos < state->last_pos) {
+        return;
+    }
+    state->last_pos = pos;
+    LoopEvent * const stored = &state->pool[state->pool_used++];
+    stored->pos = pos;
+    stored->size = (uint8_t)event->size;
+    memcpy(stored->data, event->buffer, event->size);
+    ++layer->count;
+}
+
+static void drop_layers(State * const state, const size_t nlayers) {
+    state->nlayers = nlayers;
+    state->pool_used =
+        nlayers > 0 ?
+        state->layers[nlayers - 1].start + state->layers[nlayers - 1].count :
+        0;
+    if (nlayers == 0) {
+        state->mode = MODE_EMPTY;
+    }
+}
+
+// Fixes the loop length once the first layer is closed.
+static void set_length(State * const state, const jack_nframes_t length) {
+    state->length = length > 0 ? length : 1;
+    state->bucket_shift = 0;
+    while ((state->length - 1) >> state->bucket_shift >= LOOP_BUCKETS) {
+        ++state->bucket_shift;
+    }
+}
+
+// Returns the loop position of transport frame `frame`.
+static jack_nframes_t loop_pos(
+    const State * const state,
+    const jack_nframes_t frame
+) {
+    return (jack_nframes_t)(frame - state->origin) % state->length;
+}
+
+static jack_nframes_t loop_pass(
+    const State * const state,
+    const jack_nframes_t frame
+) {
+    return (jack_nframes_t)(frame - state->origin) / state->length;
+}
+
+// While overdubbing, each pass through the loop is recorded as its own
+// layer. Starts a new layer if `frame` is in a later pass than the current
+// one (or before its last event, after a relocation).
+static void rotate_overdub(State * const state, const jack_nframes_t frame) {
+    const jack_nframes_t pass = loop_pass(state, frame);
+    const jack_nframes_t pos = loop_pos(state, frame);
+    if (pass == state->layer_pass && pos >= state->last_pos) {
+        return;
+    }
+    // The closed layer is heard from the start of the next pass.
+    close_layer(state, state->length);
+    state->layer_pass = pass;
+    if (!open_layer(state, pos)) {
+        state->mode = MODE_PLAYING;
+    }
+}
+
+static void start_overdub(State * const state, const jack_nframes_t frame) {
+    if (open_layer(state, loop_pos(state, frame))) {
+        state->layer_pass = loop_pass(state, frame);
+        state->mode = MODE_OVERDUBBING;
+    }
+}
+
+static void run_command(
+    State * const state,
+    const Command command,
+    const jack_nframes_t frame
+) {
+    const Mode mode = state->mode;
+    const jack_nframes_t pos =
+        mode == MODE_EMPTY || mode == MODE_RECORDING ?
+        0 : loop_pos(state, frame);
+    if (mode == MODE_EMPTY) {
+        if (command == CMD_RECORD && open_layer(state, 0)) {
+            state->origin = frame;
+            state->mode = MODE_RECORDING;
+        }
+        return;
+    }
+    if (mode == MODE_RECORDING) {
+        if (command == CMD_UNDO || command == CMD_CLEAR) {
+            drop_layers(state, 0);
+            return;
+        }
+        set_length(state, frame - state->origin);
+        close_layer(state, 0);
+        state->located = false;
+        state->mode = state->nlayers > 0 ? MODE_PLAYING : MODE_EMPTY;
+        if (command == CMD_OVERDUB && state->mode == MODE_PLAYING) {
+            start_overdub(state, frame);
+        }
+        return;
+    }
+    switch (command) {
+        case CMD_RECORD:
+        case CMD_OVERDUB:
+            if (mode == MODE_OVERDUBBING) {
+                close_layer(state, pos);
+                state->mode = MODE_PLAYING;
+            } else {
+                start_overdub(state, frame);
+            }
+            break;
+        case CMD_PLAY:
+            if (mode == MODE_OVERDUBBING) {
+                close_layer(state, pos);
+                state->mode = MODE_PLAYING;
+            }
+            break;
+        case CMD_UNDO:
+            silence(state, 0);
+            // While overdubbing, discard the pass being recorded, or the
+            // previous layer if nothing has been recorded yet.
+            if (mode == MODE_OVERDUBBING) {
+                state->mode = MODE_PLAYING;
+                if (state->layers[state->nlayers].count > 0) {
+                    drop_layers(state, state->nlayers);
+                    break;
+                }
+            }
+            drop_layers(state, state->nlayers - 1);
+            break;
+        case CMD_CLEAR:
+            silence(state, 0);
+            drop_layers(state, 0);
+            break;
+        default:
+            break;
+    }
+}
+
+static void run_commands(State * const state, const jack_nframes_t frame) {
+    uint8_t commands[COMMAND_QUEUE];
+    const size_t n = spsc_pop(&state->commands, commands, COMMAND_QUEUE);
+    for (size_t i = 0; i < n; ++i) {
+        run_command(state, (Command)commands[i], frame);
+    }
+}
+
+// Moves every layer's cursor to loop position `pos`, using the bucket index,
+// so relocating costs the same however long the loop is.
+static void locate(State * const state, const jack_nframes_t pos) {
+    for (size_t l = 0; l < state->nlayers; ++l) {
+        Layer * const layer = &state->layers[l];
+        const LoopEvent * const events = &state->pool[layer->start];
+        uint32_t next = layer->buckets[pos >> state->bucket_shift];
+        while (next < layer->count && events[next].pos < pos) {
+            ++next;
+        }
+        layer->next = next;
+    }
+}
+
+// Plays the events between loop positions `from` and `to` (exclusive), at
+// period offset `offset` onwards.
+static void play_range(
+    State * const state,
+    const jack_nframes_t from,
+    const jack_nframes_t to,
+    const jack_nframes_t offset
+) {
+    for (size_t l = 0; l < state->nlayers; ++l) {
+        Layer * const layer = &state->layers[l];
+        const LoopEvent * const events = &state->pool[layer->start];
+        while (layer->next < layer->count && events[layer->next].pos < to) {
+            const LoopEvent * const event = &events[layer->next++];
+            if (event->pos >= from) {
+                play_event(state, offset + (event->pos - from), event);
+            }
+        }
+    }
+}
+
+// Plays `nframes` frames of the loop starting at transport frame `frame`.
+static void play(
+    State * const state,
+    const jack_nframes_t frame,
+    const jack_nframes_t nframes
+) {
+    jack_nframes_t pos = loop_pos(state, frame);
+    if (!state->located || frame != state->next_frame) {
+        silence(state, 0);
+        locate(state, pos);
+        state->located = true;
+    }
+    jack_nframes_t offset = 0;
+    while (offset < nframes) {
+        const jack_nframes_t left = nframes - offset;
+        const jack_nframes_t run =
+            state->length - pos < left ? state->length - pos : left;
+        play_range(state, pos, pos + run, offset);
+        offset += run;
+        pos += run;
+        if (pos < state->length) {
+            continue;
+        }
+        pos = 0;
+        for (size_t l = 0; l < state->nlayers; ++l) {
+            state->layers[l].next = 0;
+        }
+    }
+}
+
+static bool is_control(const State * const state, const uint8_t * const data) {
+    return state->control_channel >= 0 &&
+        data[0] == (0xb0 | state->control_channel) &&
+        data[1] >= state->control_cc &&
+        data[1] < state->control_cc + NUM_COMMANDS;
+}
+
+// Handles input events: control changes become commands, and everything
+// else is passed through and recorded.
+static void handle_input(
+    State * const state,
+    void * const buffer,
+    const jack_nframes_t frame,
+    const bool rolling
+) {
+    const jack_nframes_t count = jack_midi_get_event_count(buffer);
+    for (jack_nframes_t i = 0; i < count; ++i) {
+        jack_midi_event_t event;
+        if (jack_midi_event_get(&event, buffer, i) != 0) {
+            break;
+        }
+        if (event.size == 3 && is_control(state, event.buffer)) {
+            if (event.buffer[2] >= 64) {
+                const Command command =
+                    (Command)(event.buffer[1] - state->control_cc);
+                run_command(state, command, frame + event.time);
+            }
+            continue;
+        }
+        if (state->thru && event.size <= 3) {
+            emit(state, event.time, event.buffer, (uint8_t)event.size);
+        }
+        if (!rolling) {
+            continue;
+        }
+        if (state->mode == MODE_RECORDING) {
+            record_event(state, frame + event.time - state->origin, &event);
+        } else if (state->mode == MODE_OVERDUBBING) {
+            rotate_overdub(state, frame + event.time);
+            if (state->mode == MODE_OVERDUBBING) {
+                const jack_nframes_t pos = loop_pos(state, frame + event.time);
+                record_event(state, pos, &event);
+            }
+        }
+    }
+}
+
+static int process(const jack_nframes_t nframes, void * const arg) {
+    PROBE1(process_entry, nframes);
+    State * const state = arg;
+    if (state->in == NULL || state->out == NULL) {
+        PROBE2(process_return, nframes, 0);
+        return 0;
+    }
+    void * const in = jack_port_get_buffer(state->in, nframes);
+    void * const out = jack_port_get_buffer(state->out, nframes);
+    if (in == NULL || out == NULL) {
+        PROBE2(process_return, nframes, -1);
+        return -1;
+    }
+    jack_midi_clear_buffer(out);
+    state->noutputs = 0;
+
+    jack_position_t position;
+    const bool rolling =
+        jack_transport_query(state->client, &position) ==
+        JackTransportRolling;
+    // Input is recorded at the frame it was played, which is the capture
+    // latency before it got here, and the loop is played ahead by the
+    // playback latency so it is heard on time.
+    const jack_nframes_t frame = position.frame - atomic_load_explicit(
+        &state->capture_latency,
+        memory_order_relaxed
+    );
+    const jack_nframes_t play_frame = position.frame + atomic_load_explicit(
+        &state->playback_latency,
+        memory_order_relaxed
+    );
+    run_commands(state, frame);
+    handle_input(state, in, frame, rolling);
+    if (rolling && state->mode == MODE_OVERDUBBING) {
+        // Start a new layer at the end of the pass even without input.
+        rotate_overdub(state, frame + nframes - 1);
+    }
+    if (state->mode == MODE_PLAYING || state->mode == MODE_OVERDUBBING) {
+        if (rolling) {
+            play(state, play_frame, nframes);
+        } else if (state->located) {
+            silence(state, 0);
+            state->located = false;
+        }
+    }
+    state->next_frame = play_frame + nframes;
+
+    // Loop events and input were collected separately; JACK needs them in
+    // time order. Periods hold few events, so insertion sort is fine.
+    Output * const outputs = state->outputs;
+    for (size_t i = 1; i < state->noutputs; ++i) {
+        const Output output = outputs[i];
+        size_t j = i;
+        for (; j > 0 && outputs[j - 1].time > output.time; --j) {
+            outputs[j] = outputs[j - 1];
+        }
+        outputs[j] = output;
+    }
+    for (size_t i = 0; i < state->noutputs; ++i) {
+        jack_midi_event_write(
+            out,
+            outputs[i].time,
+            outputs[i].data,
+            outputs[i].size
+        );
+    }
+    PROBE2(process_return, nframes, 0);
+    return 0;
+}
+
+// Passes latencies through unchanged (the looper adds none) and keeps
+// them for process().
+static void handle_latency(
+    const jack_latency_callback_mode_t mode,
+    void * const arg
+) {
+    State * const state = arg;
+    if (state->in == NULL || state->out == NULL) {
+        return;
+    }
+    jack_latency_range_t range;
+    if (mode == JackCaptureLatency) {
+        jack_port_get_latency_range(state->in, mode, &range);
+        jack_port_set_latency_range(state->out, mode, &range);
+        atomic_store_explicit(
+            &state->capture_latency,
+            range.max,
+            memory_order_relaxed
+        );
+    } else {
+        jack_port_get_latency_range(state->out, mode, &range);
+        jack_port_set_latency_range(state->in, mode, &range);
+        atomic_store_explicit(
+            &state->playback_latency,
+            range.max,
+            memory_order_relaxed
+        );
+    }
+}
+
+static void handle_line(State * const state, const char * const line) {
+    if (line[0] == '\0') {
+        return;
+    }
+    for (size_t i = 0; i < NUM_COMMANDS; ++i) {
+        if (strcmp(line, COMMAND_NAMES[i]) == 0) {
+            send_command(state, (Command)i);
+            return;
+        }
+    }
+    PROBE3(parse_error, line, strlen(line), 0);
+    fprintf(stderr, "unknown command: %s\n", line);
+}
+
+// Parses "<channel>:<cc>".
+static bool parse_control(State * const state, const char * const value) {
+    char *endptr = NULL;
+    const long channel = strtol(value, &endptr, 10);
+    if (endptr == value || *endptr != ':' || channel < 1 || channel > 16) {
+        return false;
+    }
+    const char * const text = endptr + 1;
+    const long cc = strtol(text, &endptr, 10);
+    if (endptr == text || *endptr != '\0' || cc < 0) {
+        return false;
+    }
+    if (cc + NUM_COMMANDS > 128) {
+        return false;
+    }
+    state->control_channel = (int)channel - 1;
+    state->control_cc = (int)cc;
+    return true;
+}
+
+int main(const int argc, char ** const argv) {
+    static State state = {
+        .thru = true,
+        .control_channel = -1,
+        .pool_size = DEFAULT_POOL,
+    };
+
+    int argi = 1;
+    for (; argi < argc; ++argi) {
+        const char * const arg = argv[argi];
+        const char *value = NULL;
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            usage(stdout, argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(arg, "--version") == 0) {
+            puts("0.1");
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(arg, "--") == 0) {
+            ++argi;
+            break;
+        }
+        if (arg[0] != '-' || arg[1] == '\0') {
+            break;
+        }
+        if (strcmp(arg, "-n") == 0 || strcmp(arg, "--no-thru") == 0) {
+            state.thru = false;
+        } else if (
+            match_option(argc, argv, &argi, "-c", "--control", &value)
+        ) {
+            if (value == NULL || !parse_control(&state, value)) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (match_option(argc, argv, &argi, "-e", "--events", &value)) {
+            char *endptr = NULL;
+            unsigned long count = 0;
+            if (value != NULL) {
+                count = strtoul(value, &endptr, 10);
+            }
+            if (count == 0 || *endptr != '\0' || count > UINT32_MAX) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+            state.pool_size = (uint32_t)count;
+        } else {
+            fprintf(stderr, "unknown option: %s\n", arg);
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - argi > 1) {
+        usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    state.pool = calloc(state.pool_size, sizeof(*state.pool));
+    if (state.pool == NULL) {
+        fputs("could not allocate event pool\n", stderr);
+        return EXIT_FAILURE;
+    }
+    // Avoid page faults in the process thread if possible.
+    mlock(state.pool, state.pool_size * sizeof(*state.pool));
+    mlock(&state, sizeof(state));
+
+    int sigfds[2];
+    if (pipe(sigfds) != 0) {
+        perror("pipe() failed");
+        return EXIT_FAILURE;
+    }
+    sigfd_write = sigfds[1];
+
+    static const int signals[] = {SIGHUP, SIGINT, SIGQUIT, SIGTERM};
+    for (size_t i = 0; i < sizeof(signals) / sizeof(*signals); ++i) {
+        if (!install_exit_handler(signals[i])) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    const char * const name = argc > argi ? argv[argi] : "jacl-looper";
+    jack_status_t status = 0;
+    jack_client_t * const client =
+        jack_client_open(name, JackNoStartServer, &status);
+    if (client == NULL) {
+        fprintf(stderr, "jack_client_open() failed: 0x%x\n", (int)status);
+        return EXIT_FAILURE;
+    }
+
+    state.client = client;
+    spsc_init(&state.commands, 1, COMMAND_QUEUE);
+    const int spc_status = jack_set_process_callback(client, process, &state);
+    if (spc_status != 0) {
+        fprintf(
+            stderr,
+            "jack_set_process_callback() failed: %d\n",
+            spc_status
+        );
+        return close_and_fail(client);
+    }
+
+    const int slc_status =
+        jack_set_latency_callback(client, handle_latency, &state);
+    if (slc_status != 0) {
+        fprintf(
+            stderr,
+            "jack_set_latency_callback() failed: %d\n",
+            slc_status
+        );
+        return close_and_fail(client);
+    }
+
+    jack_port_t * const in = jack_port_register(
+        client,
+        "in",
+        JACK_DEFAULT_MIDI_TYPE,
+        JackPortIsInput,
+        0
+    );
+    jack_port_t * const out = jack_port_register(
+        client,
+        "out",
+        JACK_DEFAULT_MIDI_TYPE,
+        JackPortIsOutput,
+        0
+    );
+    if (in == NULL || out == NULL) {
+        fputs("jack_port_register() failed\n", stderr);
+        return close_and_fail(client);
+    }
+    state.in = in;
+    state.out = out;
+
+    const int astatus = jack_activate(client);
+    if (astatus != 0) {
+        fprintf(stderr, "jack_activate() failed: %d\n", astatus);
+        return close_and_fail(client);
+    }
+
+    const int sigfd_read = sigfds[0];
+    if (!set_nonblock(sigfd_read) || !set_nonblock(STDIN_FILENO)) {
+        return close_and_fail(client);
+    }
+    struct pollfd pollfds[] = {
+        {
+            .fd = sigfd_read,
+            .events = 0,
+        },
+        {
+            .fd = STDIN_FILENO,
+            .events = POLLIN,
+        },
+    };
+
+    char line[64];
+    size_t linelen = 0;
+    while (true) {
+        const int status =
+            poll(pollfds, sizeof(pollfds) / sizeof(*pollfds), -1);
+        if (status > 0) {
+        } else if (status == 0 || errno == EINTR) {
+            continue;
+        } else {
+            perror("poll() failed");
+            return close_and_fail(client);
+        }
+        if (pollfds[0].revents) {
+            break;
+        }
+        if (pollfds[1].revents & POLLIN) {
+            char buf[64];
+            while (true) {
+                const ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+                if (n < 0) {
+                    break;
+                }
+                if (n == 0) {
+                    pollfds[1].fd = -1;
+                    break;
+                }
+                for (size_t i = 0; i < (size_t)n; ++i) {
+                    if (buf[i] == '\n') {
+                        line[linelen] = '\0';
+                        handle_line(&state, line);
+                        linelen = 0;
+                        continue;
+                    }
+                    if (linelen < sizeof(line) - 1) {
+                        line[linelen++] = buf[i];
+                    }
+                }
+            }
+        } else if (pollfds[1].revents) {
+            pollfds[1].fd = -1;
+        }
+    }
+
+    jack_client_close(client);
+    const int tty = open("/dev/tty", O_WRONLY);
+    if (tty != -1) {
+        while (write(tty, "\n", 1) == -1 && errno == EINTR) {}
+        close(tty);
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2025 taylor.fish <contact@taylor.fish>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// A small LZ77 block compressor in the style of LZ4, for batches of MIDI
+// (mostly sysex) of up to 64 KiB. It favors speed over ratio: one hash
+// probe per position and greedy matching.
+//
+// A block is a series of sequences, each of which is:
+//   token (1 byte): literal count (high 4 bits), match length - 4 (low 4)
+//   [literal count - 15, as bytes of 255 and a final byte < 255]
+//   literals
+//   offset (2 bytes, little-endian, 1 or more)
+//   [match length - 19, encoded like the literal count]
+// The last sequence has only literals, and ends the block.
+#ifndef JACL_LZ_H
+#define JACL_LZ_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_INPUT 65535
+
+static inline uint32_t lz_hash(const unsigned char * const p) {
+    uint32_t n;
+    memcpy(&n, p, sizeof(n));
+    return (n * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+// Writes an extended length. Returns NULL if it doesn't fit.
+static inline unsigned char *lz_put_length(
+    unsigned char *out,
+    const unsigned char * const end,
+    size_t len
+) {
+    for (; len >= 255; len -= 255) {
+        if (out == end) {
+            return NULL;
+        }
+        *out++ = 255;
+    }
+    if (out == end) {
+        return NULL;
+    }
+    *out++ = (unsigned char)len;
+    return out;
+}
+
+static inline unsigned char *lz_put_sequence(
+    unsigned char *out,
+    const unsigned char * const end,
+    const unsigned char * const literals,
+    const size_t nliterals,
+    const size_t offset,
+    const size_t match
+) {
+    if (out == end) {
+        return NULL;
+    }
+    unsigned char * const token = out++;
+    *token = (unsigned char)((nliterals < 15 ? nliterals : 15) << 4);
+    if (nliterals >= 15) {
+        out = lz_put_length(out, end, nliterals - 15);
+        if (out == NULL) {
+            return NULL;
+        }
+    }
+    if ((size_t)(end - out) < nliterals) {
+        return NULL;
+    }
+    memcpy(out, literals, nliterals);
+    out += nliterals;
+    if (match == 0) {
+        return out;
+    }
+    if (end - out < 2) {
+        return NULL;
+    }
+    *out++ = offset & 0xff;
+    *out++ = (unsigned char)(offset >> 8);
+    const size_t extra = match - LZ_MIN_MATCH;
+    *token |= extra < 15 ? extra : 15;
+    if (extra >= 15) {
+        out = lz_put_length(out, end, extra - 15);
+    }
+    return out;
+}
+
+// Compresses `len` bytes (at most LZ_MAX_INPUT) from `in` into `out`, which
+// has room for `cap` bytes. Returns the compressed size, or 0 if it would
+// not fit (so passing `cap` < `len` also detects blocks that don't
+// compress).
+static inline size_t lz_compress(
+    const unsigned char * const in,
+    const size_t len,
+    unsigned char * const out,
+    const size_t cap
+) {
+    if (len > LZ_MAX_INPUT) {
+        return 0;
+    }
+    uint16_t table[1 << LZ_HASH_BITS];
+    memset(table, 0xff, sizeof(table));
+    const unsigned char * const out_end = out + cap;
+    unsigned char *op = out;
+    size_t anchor = 0;
+    size_t pos = 0;
+    while (len >= LZ_MIN_MATCH && pos <= len - LZ_MIN_MATCH) {
+        const uint32_t hash = lz_hash(in + pos);
+        const size_t candidate = table[hash];
+        table[hash] = (uint16_t)pos;
+        if (
+            candidate == 0xffff ||
+            candidate >= pos ||
+            memcmp(in + candidate, in + pos, LZ_MIN_MATCH) != 0
+        ) {
+            ++pos;
+            continue;
+        }
+        size_t match = LZ_MIN_MATCH;
+        while (pos + match < len && in[candidate + match] == in[pos + match]) {
+            ++match;
+        }
+        op = lz_put_sequence(
+            op,
+            out_end,
+            in + anchor,
+            pos - anchor,
+            pos - candidate,
+            match
+        );
+        if (op == NULL) {
+            return 0;
+        }
+        pos += match;
+        anchor = pos;
+    }
+    op = lz_put_sequence(op, out_end, in + anchor, len - anchor, 0, 0);
+    return op == NULL ? 0 : (size_t)(op - out);
+}
+
+// Reads an extended length. Returns NULL on truncated input.
+static inline const unsigned char *lz_get_length(
+    const unsigned char *in,
+    const unsigned char * const end,
+    size_t * const len
+) {
+    while (true) {
+        if (in == end) {
+            return NULL;
+        }
+        const unsigned char byte = *in++;
+        *len += byte;
+        if (byte != 255) {
+            return in;
+        }
+    }
+}
+
+// Decompresses `len` bytes from `in` into `out`, which has room for `cap`
+// bytes. Returns the decompressed size, or -1 if the block is malformed or
+// doesn't fit.
+static inline long lz_decompress(
+    const unsigned char *in,
+    const size_t len,
+    unsigned char * const out,
+    const size_t cap
+) {
+    const unsigned char * const end = in + len;
+    size_t pos = 0;
+    while (in < end) {
+        const unsigned char token = *in++;
+        size_t nliterals = token >> 4;
+        if (nliterals == 15) {
+            in = lz_get_length(in, end, &nliterals);
+            if (in == NULL) {
+                return -1;
+            }
+        }
+        if ((size_t)(end - in) < nliterals || cap - pos < nliterals) {
+            return -1;
+        }
+        memcpy(out + pos, in, nliterals);
+        in += nliterals;
+        pos += nliterals;
+        if (in == end) {
+            break;
+        }
+        if (end - in < 2) {
+            return -1;
+        }
+        const size_t offset = in[0] | (size_t)in[1] << 8;
+        in += 2;
+        size_t match = (token & 0x0f) + LZ_MIN_MATCH;
+        if ((token & 0x0f) == 15) {
+            in = lz_get_length(in, end, &match);
+            if (in == NULL) {
+                return -1;
+            }
+        }
+        if (offset == 0 || offset > pos || cap - pos < match) {
+            return -1;
+        }
+        // Byte by byte: the match may overlap its own output.
+        for (size_t i = 0; i < match; ++i, ++pos) {
+            out[pos] = out[pos - offset];
+        }
+    }
+    return (long)pos;
+}
+
+#endif
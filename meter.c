@@ -0,0 +1,555 @@
+/*
+ * Copyright (C) 2025 taylor.fish <contact@taylor.fish>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+#define _GNU_SOURCE
+#include "probes.h"
+#include "queue.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <jack/jack.h>
+#include <math.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_PORTS 1024
+#define RING_SIZE (1 << 20)
+
+static int sigfd_write;
+
+static const char *USAGE = "\
+Usage: %s [options] [client-name]\n\
+\n\
+Measures the level of incoming JACK audio (or CV) signals and writes it to\n\
+standard output. At the configured rate, one line per port is written for\n\
+the preceding interval:\n\
+\n\
+  <frame> <port> <peak> <rms> <min> <max>\n\
+\n\
+where <frame> is the JACK frame time at the start of the interval (less the\n\
+largest capture latency of the ports), <peak> is the largest absolute sample\n\
+value, and <min> and <max> are the envelope of the signal.\n\
+\n\
+[client-name] is the name of the JACK client to create; if not provided, the\n\
+default is 'jacl-meter'.\n\
+\n\
+Options:\n\
+  -p, --port <name>   Create an input port called <name>. May be given\n\
+                      multiple times.\n\
+  -n, --ports <count> Create <count> input ports called in_1, in_2, etc.\n\
+                      If neither this nor --port is given, a single port\n\
+                      called 'in' is created.\n\
+  -r, --rate <hz>     Number of measurements per second (default: 10).\n\
+";
+
+static void usage(FILE * const stream, const char * const arg0) {
+    const char *bin = arg0 ? arg0 : "";
+    size_t start = 0;
+    for (size_t i = 0; bin[i] != '\0'; ++i) {
+        if (bin[i] == '/') {
+            start = i + 1;
+        }
+    }
+    bin += start;
+    if (*bin == '\0') {
+        bin = "jacl-meter";
+    }
+    fprintf(stream, USAGE, bin);
+}
+
+static void handle_exit_signal(const int signum) {
+    (void)signum;
+    close(sigfd_write);
+}
+
+static bool install_exit_handler(const int signum) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    const struct sigaction act = {
+        .sa_handler = handle_exit_signal,
+        .sa_mask = mask,
+        .sa_flags = 0,
+    };
+    if (sigaction(signum, &act, NULL) == 0) {
+        return true;
+    }
+    fprintf(stderr, "sigaction(%d) failed", signum);
+    perror("");
+    return false;
+}
+
+// Matches option `shortopt` or `longopt` at `argv[*argi]`, accepting both
+// "--long value" and "--long=value". On a match, `*value` is set to the
+// option's argument (NULL if missing) and `*argi` is advanced past it.
+static bool match_option(
+    const int argc,
+    char ** const argv,
+    int * const argi,
+    const char * const shortopt,
+    const char * const longopt,
+    const char ** const value
+) {
+    const char * const arg = argv[*argi];
+    const size_t longlen = strlen(longopt);
+    if (strncmp(arg, longopt, longlen) == 0 && arg[longlen] == '=') {
+        *value = arg + longlen + 1;
+        return true;
+    }
+    if (strcmp(arg, shortopt) != 0 && strcmp(arg, longopt) != 0) {
+        return false;
+    }
+    *value = *argi + 1 < argc ? argv[++*argi] : NULL;
+    return true;
+}
+
+// Running totals for one port over the current interval.
+typedef struct Accum {
+    float min;
+    float max;
+    double sumsq;
+} Accum;
+
+// One measurement as queued for the writer thread.
+typedef struct Level {
+    float peak;
+    float rms;
+    float min;
+    float max;
+} Level;
+
+// Precedes the `nports` Levels of each queued interval.
+typedef struct BlockHeader {
+    jack_nframes_t frame;
+    jack_nframes_t nframes;
+} BlockHeader;
+
+typedef struct State {
+    jack_client_t *client;
+    size_t nports;
+    const char **names;
+    jack_port_t **ports;
+    // Process thread only.
+    Accum *accums;
+    jack_nframes_t interval;
+    jack_nframes_t start;
+    jack_nframes_t nframes;
+    // Scratch space for one block, so it can be queued with a single write.
+    char *block;
+    size_t block_size;
+    // Main thread only: the block being printed.
+    char *read_block;
+
+    // Whole blocks, one per element.
+    SpscRing ring;
+    atomic_size_t dropped;
+    atomic_bool running;
+    double rate;
+    // The largest capture latency of the ports, from the latency callback.
+    atomic_uint capture_latency;
+} State;
+
+static int close_and_fail(jack_client_t * const client) {
+    jack_client_close(client);
+    return EXIT_FAILURE;
+}
+
+#ifdef __GNUC__
+typedef float vfloat __attribute__((vector_size(16)));
+typedef int32_t vmask __attribute__((vector_size(16)));
+#define LANES (sizeof(vfloat) / sizeof(float))
+#define VSELECT(m, a, b) \
+    ((vfloat)(((m) & (vmask)(a)) | (~(m) & (vmask)(b))))
+#endif
+
+static void accumulate(
+    Accum * const acc,
+    const float * const buffer,
+    const jack_nframes_t nframes
+) {
+    jack_nframes_t i = 0;
+    float sumsq = 0;
+    float min = acc->min;
+    float max = acc->max;
+#ifdef __GNUC__
+    vfloat vmin = {0};
+    vfloat vmax = {0};
+    vfloat vsumsq = {0};
+    vmin += min;
+    vmax += max;
+    for (; i + LANES <= nframes; i += LANES) {
+        vfloat x;
+        memcpy(&x, buffer + i, sizeof(x));
+        vsumsq += x * x;
+        vmin = VSELECT(x < vmin, x, vmin);
+        vmax = VSELECT(x > vmax, x, vmax);
+    }
+    for (size_t l = 0; l < LANES; ++l) {
+        sumsq += vsumsq[l];
+        min = vmin[l] < min ? vmin[l] : min;
+        max = vmax[l] > max ? vmax[l] : max;
+    }
+#endif
+    for (; i < nframes; ++i) {
+        const float x = buffer[i];
+        sumsq += x * x;
+        min = x < min ? x : min;
+        max = x > max ? x : max;
+    }
+    acc->min = min;
+    acc->max = max;
+    acc->sumsq += sumsq;
+}
+
+static void reset(State * const state) {
+    for (size_t p = 0; p < state->nports; ++p) {
+        state->accums[p] = (Accum){
+            .min = INFINITY,
+            .max = -INFINITY,
+            .sumsq = 0,
+        };
+    }
+    state->nframes = 0;
+}
+
+// Queues the measurements for the current interval.
+static void push_block(State * const state) {
+    const BlockHeader header = {
+        .frame = state->start,
+        .nframes = state->nframes,
+    };
+    memcpy(state->block, &header, sizeof(header));
+    Level * const levels = (Level *)(state->block + sizeof(header));
+    for (size_t p = 0; p < state->nports; ++p) {
+        const Accum * const acc = &state->accums[p];
+        levels[p] = (Level){
+            .peak = fmaxf(-acc->min, acc->max),
+            .rms = (float)sqrt(acc->sumsq / state->nframes),
+            .min = acc->min,
+            .max = acc->max,
+        };
+    }
+    if (spsc_push(&state->ring, state->block, 1) == 0) {
+        atomic_fetch_add_explicit(&state->dropped, 1, memory_order_relaxed);
+    }
+}
+
+static int process(const jack_nframes_t nframes, void * const arg) {
+    PROBE1(process_entry, nframes);
+    State * const state = arg;
+    if (state->nframes == 0) {
+        const jack_nframes_t latency = atomic_load_explicit(
+            &state->capture_latency,
+            memory_order_relaxed
+        );
+        state->start = jack_last_frame_time(state->client) - latency;
+    }
+    for (size_t p = 0; p < state->nports; ++p) {
+        jack_port_t * const port = state->ports[p];
+        if (port == NULL) {
+            continue;
+        }
+        const jack_default_audio_sample_t * const buffer =
+            jack_port_get_buffer(port, nframes);
+        if (buffer == NULL) {
+            PROBE2(process_return, nframes, -1);
+            return -1;
+        }
+        accumulate(&state->accums[p], buffer, nframes);
+    }
+    state->nframes += nframes;
+    if (state->nframes >= state->interval) {
+        push_block(state);
+        reset(state);
+    }
+    PROBE2(process_return, nframes, 0);
+    return 0;
+}
+
+static void print_blocks(State * const state) {
+    BlockHeader header;
+    while (spsc_pop(&state->ring, state->read_block, 1) == 1) {
+        memcpy(&header, state->read_block, sizeof(header));
+        for (size_t p = 0; p < state->nports; ++p) {
+            Level level;
+            memcpy(
+                &level,
+                state->read_block + sizeof(header) + p * sizeof(level),
+                sizeof(level)
+            );
+            printf(
+                "%lu %s %.6g %.6g %.6g %.6g\n",
+                (unsigned long)header.frame,
+                state->names[p],
+                level.peak,
+                level.rms,
+                level.min,
+                level.max
+            );
+        }
+    }
+    const size_t dropped =
+        atomic_exchange_explicit(&state->dropped, 0, memory_order_relaxed);
+    if (dropped > 0) {
+        fprintf(stderr, "dropped %zu measurements\n", dropped);
+    }
+    fflush(stdout);
+}
+
+static void *writer_main(void * const arg) {
+    State * const state = arg;
+    const long interval_ns = (long)(1e9 / state->rate);
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    while (atomic_load_explicit(&state->running, memory_order_relaxed)) {
+        next.tv_nsec += interval_ns;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            ++next.tv_sec;
+        }
+        while (
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL) ==
+            EINTR
+        ) {}
+        print_blocks(state);
+    }
+    return NULL;
+}
+
+// Keeps the capture latency for process(), and publishes our own playback
+// latency: a sample is written at most one interval after the end of its
+// own, which is at most an interval away.
+static void handle_latency(
+    const jack_latency_callback_mode_t mode,
+    void * const arg
+) {
+    State * const state = arg;
+    jack_nframes_t latency = 0;
+    for (size_t p = 0; p < state->nports; ++p) {
+        jack_port_t * const port = state->ports[p];
+        if (port == NULL) {
+            continue;
+        }
+        jack_latency_range_t range;
+        if (mode == JackCaptureLatency) {
+            jack_port_get_latency_range(port, mode, &range);
+            latency = range.max > latency ? range.max : latency;
+            continue;
+        }
+        range.min = 0;
+        range.max = state->interval * 2;
+        jack_port_set_latency_range(port, mode, &range);
+    }
+    if (mode == JackCaptureLatency) {
+        atomic_store_explicit(
+            &state->capture_latency,
+            latency,
+            memory_order_relaxed
+        );
+    }
+}
+
+static void *xcalloc(const size_t n, const size_t size) {
+    void * const ptr = calloc(n, size);
+    if (ptr == NULL) {
+        abort();
+    }
+    return ptr;
+}
+
+int main(const int argc, char ** const argv) {
+    static State state = {
+        .rate = 10,
+    };
+    static const char *names[MAX_PORTS];
+    size_t count = 0;
+
+    int argi = 1;
+    for (; argi < argc; ++argi) {
+        const char * const arg = argv[argi];
+        const char *value = NULL;
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            usage(stdout, argv[0]);
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(arg, "--version") == 0) {
+            puts("0.1");
+            return EXIT_SUCCESS;
+        }
+        if (strcmp(arg, "--") == 0) {
+            ++argi;
+            break;
+        }
+        if (arg[0] != '-' || arg[1] == '\0') {
+            break;
+        }
+        if (match_option(argc, argv, &argi, "-p", "--port", &value)) {
+            if (value == NULL || *value == '\0') {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+            if (state.nports >= MAX_PORTS) {
+                fprintf(stderr, "too many ports (max %d)\n", MAX_PORTS);
+                return EXIT_FAILURE;
+            }
+            names[state.nports++] = value;
+        } else if (match_option(argc, argv, &argi, "-n", "--ports", &value)) {
+            char *endptr = NULL;
+            const long n = value ? strtol(value, &endptr, 10) : -1;
+            if (!endptr || *endptr != '\0' || n < 1 || n > MAX_PORTS) {
+                fprintf(stderr, "bad port count (max %d)\n", MAX_PORTS);
+                return EXIT_FAILURE;
+            }
+            count = (size_t)n;
+        } else if (match_option(argc, argv, &argi, "-r", "--rate", &value)) {
+            char *endptr = NULL;
+            state.rate = value ? strtod(value, &endptr) : -1;
+            if (!endptr || *endptr != '\0' || !(state.rate > 0)) {
+                fputs("bad rate\n", stderr);
+                return EXIT_FAILURE;
+            }
+        } else {
+            fprintf(stderr, "unknown option: %s\n", arg);
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (argc - argi > 1) {
+        usage(stderr, argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (state.nports + count > MAX_PORTS) {
+        fprintf(stderr, "too many ports (max %d)\n", MAX_PORTS);
+        return EXIT_FAILURE;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        char * const name = xcalloc(32, 1);
+        snprintf(name, 32, "in_%zu", i + 1);
+        names[state.nports++] = name;
+    }
+    if (state.nports == 0) {
+        names[state.nports++] = "in";
+    }
+
+    state.names = names;
+    state.ports = xcalloc(state.nports, sizeof(*state.ports));
+    state.accums = xcalloc(state.nports, sizeof(*state.accums));
+    state.block_size = sizeof(BlockHeader) + state.nports * sizeof(Level);
+    state.block = xcalloc(1, state.block_size);
+    state.read_block = xcalloc(1, state.block_size);
+    reset(&state);
+    size_t ring_blocks = RING_SIZE / state.block_size;
+    if (ring_blocks < 16) {
+        ring_blocks = 16;
+    }
+    spsc_init(&state.ring, state.block_size, ring_blocks);
+
+    int sigfds[2];
+    if (pipe(sigfds) != 0) {
+        perror("pipe() failed");
+        return EXIT_FAILURE;
+    }
+    sigfd_write = sigfds[1];
+
+    static const int signals[] = {SIGHUP, SIGINT, SIGQUIT, SIGTERM};
+    for (size_t i = 0; i < sizeof(signals) / sizeof(*signals); ++i) {
+        if (!install_exit_handler(signals[i])) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    const char * const name = argc > argi ? argv[argi] : "jacl-meter";
+    jack_status_t status = 0;
+    jack_client_t * const client =
+        jack_client_open(name, JackNoStartServer, &status);
+    if (client == NULL) {
+        fprintf(stderr, "jack_client_open() failed: 0x%x\n", (int)status);
+        return EXIT_FAILURE;
+    }
+
+    state.client = client;
+    const double interval = jack_get_sample_rate(client) / state.rate;
+    state.interval = interval < 1 ? 1 : (jack_nframes_t)interval;
+    const int spc_status = jack_set_process_callback(client, process, &state);
+    if (spc_status != 0) {
+        fprintf(
+            stderr,
+            "jack_set_process_callback() failed: %d\n",
+            spc_status
+        );
+        return close_and_fail(client);
+    }
+
+    const int slc_status =
+        jack_set_latency_callback(client, handle_latency, &state);
+    if (slc_status != 0) {
+        fprintf(
+            stderr,
+            "jack_set_latency_callback() failed: %d\n",
+            slc_status
+        );
+        return close_and_fail(client);
+    }
+
+    for (size_t i = 0; i < state.nports; ++i) {
+        jack_port_t * const port = jack_port_register(
+            client,
+            state.names[i],
+            JACK_DEFAULT_AUDIO_TYPE,
+            JackPortIsInput,
+            0
+        );
+        if (port == NULL) {
+            fputs("jack_port_register() failed\n", stderr);
+            return close_and_fail(client);
+        }
+        state.ports[i] = port;
+    }
+
+    atomic_store(&state.running, true);
+    pthread_t writer;
+    const int pc_status = pthread_create(&writer, NULL, writer_main, &state);
+    if (pc_status != 0) {
+        fprintf(stderr, "pthread_create() failed: %d\n", pc_status);
+        return close_and_fail(client);
+    }
+
+    const int astatus = jack_activate(client);
+    if (astatus != 0) {
+        fprintf(stderr, "jack_activate() failed: %d\n", astatus);
+        return close_and_fail(client);
+    }
+
+    const int sigfd_read = sigfds[0];
+    for (char c; read(sigfd_read, &c, 1) == -1 && errno == EINTR;) {}
+    jack_client_close(client);
+    atomic_store(&state.running, false);
+    pthread_join(writer, NULL);
+
+    const int tty = open("/dev/tty", O_WRONLY);
+    if (tty != -1) {
+        while (write(tty, "\n", 1) == -1 && errno == EINTR) {}
+        close(tty);
+    }
+    return EXIT_SUCCESS;
+}
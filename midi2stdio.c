@@ -14,34 +14,157 @@
  * You should have received a copy of the GNU General Public License
  * along with this program. If not, see <https://www.gnu.org/licenses/>.
  */
-#define _POSIX_C_SOURCE 1
+#define _GNU_SOURCE
+#include "autoconnect.h"
+#include "frame.h"
+#include "probes.h"
+#include "reconnect.h"
+#include "transform.h"
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <jack/jack.h>
 #include <jack/metadata.h>
 #include <jack/midiport.h>
+#include <limits.h>
+#include <net/if.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+#define SLOT_DATA 6
+#define DEFAULT_SLOTS (1 << 16)
+#define DEFAULT_RETRO_SLOTS (1 << 20)
+#define MAX_SINKS 32
+#define MAX_WRITERS 16
+#define SINK_BUFFER 16384
+// Largest datagram sent by a UDP sink.
+#define DATAGRAM_MAX 1400
+// How often the writer threads check for new data, in nanoseconds.
+#define WRITER_INTERVAL 2000000
+// How many slots behind a sink must be before a writer other than its own
+// serves it.
+#define STEAL_BACKLOG 512
+#define DEFAULT_REDUNDANCY 2
+
+// Marks a controller whose value hasn't been seen.
+#define CONTROL_UNSET 0xff
+#define BEND_UNSET 0xffff
+// Longest possible snapshot: every controller, program, pressure and bend
+// on every channel.
+#define SNAPSHOT_MAX (16 * (120 + 3) * 3)
+// Frames a snapshot can take, counting one for the batch in progress. Each
+// message takes at most 4 bytes in a batch.
+#define SNAPSHOT_FRAMES (SNAPSHOT_MAX / 3 * 4 / FRAME_MESSAGE_MAX + 2)
+
 static int sigfd_write;
+static int dumpfd_write = -1;
+// False in standby, until activated.
+static atomic_bool active = true;
 
 static const char *USAGE = "\
-Usage: %s [client-name]\n\
+Usage: %s [options] [client-name]\n\
 \n\
-Writes incoming JACK MIDI data to standard output. Each line contains one\n\
-MIDI message in hexadecimal format.\n\
+Writes incoming JACK MIDI data to standard output, or to the sinks given\n\
+with --sink. Each line contains one MIDI message in hexadecimal format.\n\
 \n\
 [client-name] is the name of the JACK client to create; if not provided, the\n\
 default is 'midi2stdio'.\n\
+\n\
+Options:\n\
+  -O, --sink <target>[,<option>=<value>...]\n\
+                      Write MIDI to <target> instead of standard output.\n\
+                      May be given multiple times. <target> is one of:\n\
+                        -               standard output\n\
+                        file:<path>     a file\n\
+                        tcp:<host>:<port>\n\
+                        udp:<host>:<port>\n\
+                        listen:[<host>:]<port>\n\
+                                        accept TCP connections; each\n\
+                                        client gets MIDI from the time it\n\
+                                        connects\n\
+                        multicast:<group>:<port>\n\
+                                        send sequenced binary frames to a\n\
+                                        UDP multicast group, for\n\
+                                        jacl-stdio2midi --multicast\n\
+                      Each sink is written independently. When one falls\n\
+                      a whole buffer behind, ',drop=<policy>' decides what\n\
+                      happens: 'oldest' (default) skips to the oldest data\n\
+                      still buffered, 'latest' skips to the newest, and\n\
+                      'close' closes the sink. Messages too long for one\n\
+                      datagram (over 699 bytes as hex on udp: sinks) are\n\
+                      skipped with a warning.\n\
+                      ',framed' sends binary frames, as multicast sinks\n\
+                      do, instead of lines of hex; read them with\n\
+                      jacl-stdio2midi --framed. ',compress' also compresses\n\
+                      batches of frames where that saves space, which helps\n\
+                      with large amounts of sysex. ',crc' adds a CRC-32C\n\
+                      to every frame, so the receiver drops corrupted\n\
+                      frames instead of playing garbage. Datagram sinks\n\
+                      also accept ',redundancy=<n>' (0-7, default 2): the\n\
+                      number of previous batches repeated in each\n\
+                      datagram.\n\
+                      Multicast sinks also accept ',ttl=<hops>' (default 1)\n\
+                      and ',if=<interface>', and ',backup-if=<interface>'\n\
+                      to send a copy of every datagram over a second\n\
+                      interface; receivers joined on both paths take each\n\
+                      message from whichever copy arrives first.\n\
 ";
 
+// Split from USAGE to stay within the string length limit of ISO C.
+static const char *USAGE_OPTIONS = "\
+  -S, --snapshot <seconds>\n\
+                      Also write the current controller, program, pressure\n\
+                      and pitch-bend state of every channel to all sinks\n\
+                      this often, so that receivers that missed earlier\n\
+                      messages catch up. Clients of 'listen:' sinks always\n\
+                      get this state when they connect.\n\
+  -s, --buffer-size <slots>\n\
+                      Size of the buffer (default: 65536, or 1048576 with\n\
+                      --retro). Each slot holds one message of up to 6\n\
+                      bytes; longer messages take several. In retro mode,\n\
+                      when the buffer is full, the oldest messages are lost\n\
+                      even if they are within the time limit.\n\
+  -r, --retro <minutes>\n\
+                      Keep the last <minutes> of MIDI in memory, and write\n\
+                      it to a file on SIGUSR2 or when 'dump' is read from\n\
+                      standard input. MIDI is then written as it arrives\n\
+                      only to sinks given with --sink.\n\
+  -F, --format <smf|hex>\n\
+                      Format of dumps (default: smf). 'smf' writes a type-0\n\
+                      Standard MIDI File at 120 BPM and 960 ticks per\n\
+                      quarter note; 'hex' writes one message per line,\n\
+                      preceded by its time in seconds since the first one.\n\
+  -o, --output <pattern>\n\
+                      strftime(3) pattern for dump file names (default:\n\
+                      'midi-%Y%m%d-%H%M%S.mid', or '.txt' for hex).\n\
+                      '-' writes to standard output.\n\
+  -w, --standby       Start in standby: set up everything and follow the\n\
+                      input as usual, but write nothing to the sinks until\n\
+                      SIGUSR1 is received or 'activate' is read from\n\
+                      standard input. Sinks then start with the newest\n\
+                      MIDI and a snapshot of the controller state, for\n\
+                      fast failover.\n\
+  -j, --writers <n>   Encode and write to the sinks with <n> threads\n\
+                      (default: 1, max: 16). Each sink is served by one\n\
+                      of them, so its output stays in order, but a thread\n\
+                      with spare time takes over sinks that have fallen\n\
+                      behind.\n\
+" TRANSFORM_USAGE AUTOCONNECT_USAGE;
+
 static void usage(FILE * const stream, const char * const arg0) {
     const char *bin = arg0 ? arg0 : "";
     size_t start = 0;
@@ -55,18 +178,38 @@ static void usage(FILE * const stream, const char * const arg0) {
         bin = "jacl-midi2stdio";
     }
     fprintf(stream, USAGE, bin);
+    fputs(USAGE_OPTIONS, stream);
 }
 
-static void on_exit(const int signum) {
+static void handle_exit_signal(const int signum) {
     (void)signum;
     close(sigfd_write);
 }
 
-static bool install_exit_handler(const int signum) {
+// Wakes up the dump thread. Async-signal-safe.
+static void request_dump(void) {
+    const int saved_errno = errno;
+    if (write(dumpfd_write, "", 1) < 0) {
+        // A dump is already pending.
+    }
+    errno = saved_errno;
+}
+
+static void handle_dump_signal(const int signum) {
+    (void)signum;
+    request_dump();
+}
+
+static void handle_activate_signal(const int signum) {
+    (void)signum;
+    atomic_store_explicit(&active, true, memory_order_relaxed);
+}
+
+static bool install_handler(const int signum, void (* const handler)(int)) {
     sigset_t mask;
     sigemptyset(&mask);
     const struct sigaction act = {
-        .sa_handler = on_exit,
+        .sa_handler = handler,
         .sa_mask = mask,
         .sa_flags = 0,
     };
@@ -96,14 +239,174 @@ static bool set_nonblock(const int fd) {
     return true;
 }
 
+// Matches option `shortopt` or `longopt` at `argv[*argi]`, accepting both
+// "--long value" and "--long=value". On a match, `*value` is set to the
+// option's argument (NULL if missing) and `*argi` is advanced past it.
+static bool match_option(
+    const int argc,
+    char ** const argv,
+    int * const argi,
+    const char * const shortopt,
+    const char * const longopt,
+    const char ** const value
+) {
+    const char * const arg = argv[*argi];
+    const size_t longlen = strlen(longopt);
+    if (strncmp(arg, longopt, longlen) == 0 && arg[longlen] == '=') {
+        *value = arg + longlen + 1;
+        return true;
+    }
+    if (strcmp(arg, shortopt) != 0 && strcmp(arg, longopt) != 0) {
+        return false;
+    }
+    *value = *argi + 1 < argc ? argv[++*argi] : NULL;
+    return true;
+}
+
+// One entry in the ring. Messages longer than SLOT_DATA bytes continue in
+// the following slots.
+typedef struct Slot {
+    // Frames since activation, less the capture latency of the input port.
+    uint64_t time;
+    uint8_t size;
+    // Set if this slot continues the message in the previous slot.
+    uint8_t cont;
+    uint8_t data[SLOT_DATA];
+} Slot;
+
+typedef enum DumpFormat {
+    DUMP_SMF,
+    DUMP_HEX,
+} DumpFormat;
+
+// process() writes every message into a ring, which the output and dump
+// threads read independently. It never waits for them: a reader that falls
+// more than a ring's length behind loses data.
+typedef struct Ring {
+    // Slots are numbered from 0 and never renumbered: slot n lives at
+    // `slots[n & mask]`. `committed` counts finished slots, and `reserved`
+    // is raised before a slot is overwritten, so a reader can tell which
+    // slots changed under it.
+    Slot *slots;
+    size_t mask;
+    atomic_uint_fast64_t committed;
+    atomic_uint_fast64_t reserved;
+    // Frames since activation, as of the last period.
+    atomic_uint_fast64_t clock;
+    // Process thread only.
+    uint64_t head;
+    uint64_t frames;
+    // The time of the last message.
+    uint64_t last_time;
+} Ring;
+
+typedef struct Retro {
+    bool enabled;
+    // Maximum age of dumped messages, in frames.
+    uint64_t window;
+    DumpFormat format;
+    const char *output;
+    // Dump thread only: the read end of the dump pipe, and a copy of the
+    // ring's slots.
+    int dumpfd;
+    Slot *copy;
+} Retro;
+
+typedef enum DropPolicy {
+    // Skip to the oldest data still in the ring.
+    DROP_OLDEST,
+    // Skip to the newest data, discarding the backlog.
+    DROP_LATEST,
+    // Close the sink.
+    DROP_CLOSE,
+} DropPolicy;
+
+typedef enum SinkKind {
+    SINK_STREAM,
+    SINK_DATAGRAM,
+    SINK_LISTEN,
+    SINK_MULTICAST,
+} SinkKind;
+
+// An output of the writer threads.
+typedef struct Sink {
+    const char *spec;
+    SinkKind kind;
+    int fd;
+    // For multicast sinks, a second socket that sends a copy of every
+    // datagram over another interface, or -1.
+    int backup_fd;
+    DropPolicy policy;
+    // The next slot to encode.
+    uint64_t cursor;
+    // Encoded data not yet written: `buf[start..len]`.
+    char buf[SINK_BUFFER];
+    size_t start;
+    size_t len;
+    // Set while `cursor` is partway through a message too long to encode
+    // at once, whose line has been started but not finished.
+    bool in_line;
+    unsigned long dropped;
+    // Set when the sink should get a snapshot of the controller state.
+    bool snapshot_due;
+    // The value of `State.snapshot_epoch` when the last periodic snapshot
+    // was due, and whether output was active when the sink was last served.
+    unsigned snapshot_epoch;
+    bool active;
+    // Whether to send frame.h frames rather than lines of hex, and how.
+    // Listening sinks pass these on to their clients.
+    bool framed;
+    bool compress;
+    bool checksum;
+    unsigned redundancy;
+    FrameSender *frames;
+} Sink;
+
+// The last value of every channel's controllers, kept up to date by
+// process() so that late-joining receivers can be brought up to date
+// without replaying history. Values are CONTROL_UNSET (or BEND_UNSET)
+// until first seen.
+typedef struct Controls {
+    atomic_uchar cc[16][120];
+    atomic_uchar program[16];
+    atomic_uchar pressure[16];
+    atomic_uint_least16_t bend[16];
+} Controls;
+
 typedef struct State {
     jack_client_t *client;
     jack_port_t *port;
-    bool line_completed;
+    jack_nframes_t sample_rate;
+    // The capture latency of the input port, from the latency callback.
+    atomic_uint capture_latency;
+    Ring ring;
+    Retro retro;
+    Transform transform;
+    bool transforming;
+    Controls controls;
+    // Seconds between snapshots; 0 to send them only on connect.
+    double snapshot_interval;
+    // Accepted connections are added as sinks; closed sinks have `fd` -1.
+    // After activation, a sink is only touched by the writer thread that
+    // holds its flag in `sink_busy`.
+    Sink *sinks;
+    atomic_flag sink_busy[MAX_SINKS];
+    atomic_size_t nsinks;
+    // Serializes accept_clients(), which may claim any free sink.
+    pthread_mutex_t accept_lock;
+    size_t nwriters;
+    // Incremented by writer 0 whenever a periodic snapshot is due.
+    atomic_uint snapshot_epoch;
+    atomic_bool running;
+    Reconnect reconnect;
+    AutoConnect autoconnect;
 } State;
 
 static int close_and_fail(jack_client_t * const client) {
-    jack_client_close(client);
+    // The client is NULL while we wait for the JACK server to come back.
+    if (client != NULL) {
+        jack_client_close(client);
+    }
     return EXIT_FAILURE;
 }
 
@@ -117,86 +420,1676 @@ static char int_to_hex(int n) {
     return '?';
 }
 
-static bool flush_buf(
-    const char * const buf,
-    const size_t len,
-    State * const state
+// Applies the transform, if any, to a copy of `event` in `copy`. Returns
+// false if the event should be dropped.
+static bool transform_event(
+    const State * const state,
+    jack_midi_event_t * const event,
+    uint8_t * const copy
 ) {
-    const ssize_t written = write(STDOUT_FILENO, buf, len);
-    if (written < 1) {
-        return false;
+    if (!state->transforming || event->size > 3) {
+        return true;
     }
-    if (written > (ssize_t)len) {
-        state->line_completed = false;
-        return false;
+    memcpy(copy, event->buffer, event->size);
+    event->buffer = copy;
+    return transform_apply(&state->transform, copy, event->size);
+}
+
+static void init_controls(Controls * const controls) {
+    for (int ch = 0; ch < 16; ++ch) {
+        for (int i = 0; i < 120; ++i) {
+            atomic_init(&controls->cc[ch][i], CONTROL_UNSET);
+        }
+        atomic_init(&controls->program[ch], CONTROL_UNSET);
+        atomic_init(&controls->pressure[ch], CONTROL_UNSET);
+        atomic_init(&controls->bend[ch], BEND_UNSET);
     }
-    switch (buf[written - 1]) {
-        case '\n':
-        case 'X':
-            state->line_completed = true;
-            break;
-        default:
-            state->line_completed = false;
+}
+
+static void store_control(atomic_uchar * const control, const uint8_t value) {
+    atomic_store_explicit(control, value, memory_order_relaxed);
+}
+
+// Updates the controller state from a channel message.
+static void track_controls(
+    Controls * const controls,
+    const uint8_t * const message,
+    const size_t size
+) {
+    if (size < 2 || message[0] < 0xb0 || message[0] >= 0xf0) {
+        return;
+    }
+    const unsigned ch = message[0] & 0x0f;
+    const uint8_t data1 = message[1] & 0x7f;
+    switch (message[0] & 0xf0) {
+        case 0xb0:
+            if (size < 3) {
+                return;
+            }
+            if (data1 < 120) {
+                store_control(&controls->cc[ch][data1], message[2] & 0x7f);
+                return;
+            }
+            if (data1 != 121) {
+                return;
+            }
+            // Reset All Controllers. Following RP-015, bank select,
+            // volume, pan and effect depths keep their values.
+            for (int i = 1; i < 120; ++i) {
+                if (i != 7 && i != 10 && i != 32 && (i < 91 || i > 95)) {
+                    store_control(&controls->cc[ch][i], CONTROL_UNSET);
+                }
+            }
+            store_control(&controls->pressure[ch], CONTROL_UNSET);
+            atomic_store_explicit(
+                &controls->bend[ch],
+                BEND_UNSET,
+                memory_order_relaxed
+            );
+            return;
+        case 0xc0:
+            store_control(&controls->program[ch], data1);
+            return;
+        case 0xd0:
+            store_control(&controls->pressure[ch], data1);
+            return;
+        case 0xe0:
+            if (size >= 3) {
+                atomic_store_explicit(
+                    &controls->bend[ch],
+                    data1 | (message[2] & 0x7f) << 7,
+                    memory_order_relaxed
+                );
+            }
+            return;
+    }
+}
+
+// Copies the period's events into the ring. Only memory writes: no
+// syscalls.
+static void record(
+    State * const state,
+    void * const buffer,
+    const jack_nframes_t nframes
+) {
+    Ring * const ring = &state->ring;
+    const size_t capacity = ring->mask + 1;
+    const uint64_t start = ring->head;
+    uint64_t head = start;
+    const uint64_t latency = atomic_load_explicit(
+        &state->capture_latency,
+        memory_order_relaxed
+    );
+    const jack_nframes_t count = jack_midi_get_event_count(buffer);
+    for (jack_nframes_t i = 0; i < count; ++i) {
+        jack_midi_event_t event;
+        if (jack_midi_event_get(&event, buffer, i) != 0) {
             break;
+        }
+        uint8_t copy[3];
+        if (!transform_event(state, &event, copy)) {
+            continue;
+        }
+        track_controls(&state->controls, event.buffer, event.size);
+        const size_t nslots = (event.size + SLOT_DATA - 1) / SLOT_DATA;
+        if (nslots == 0 || nslots > capacity / 2) {
+            continue;
+        }
+        // Timestamp the message when it was played rather than when it got
+        // here. Times never go backwards, even if the latency grows.
+        uint64_t time = ring->frames + event.time;
+        time = time > latency ? time - latency : 0;
+        if (time < ring->last_time) {
+            time = ring->last_time;
+        }
+        ring->last_time = time;
+        PROBE3(event_record, event.buffer, event.size, time);
+
+        atomic_store_explicit(
+            &ring->reserved,
+            head + nslots,
+            memory_order_relaxed
+        );
+        atomic_thread_fence(memory_order_release);
+        size_t offset = 0;
+        for (size_t k = 0; k < nslots; ++k) {
+            Slot * const slot = &ring->slots[(head + k) & ring->mask];
+            const size_t left = event.size - offset;
+            const size_t size = left < SLOT_DATA ? left : SLOT_DATA;
+            slot->time = time;
+            slot->size = (uint8_t)size;
+            slot->cont = k > 0;
+            memcpy(slot->data, event.buffer + offset, size);
+            offset += size;
+        }
+        head += nslots;
     }
-    return written == (ssize_t)len;
+    ring->head = head;
+    ring->frames += nframes;
+    atomic_store_explicit(&ring->committed, head, memory_order_release);
+    atomic_store_explicit(&ring->clock, ring->frames, memory_order_relaxed);
+    PROBE2(ring_commit, ring, head - start);
 }
 
 static int process(const jack_nframes_t nframes, void * const arg) {
+    PROBE1(process_entry, nframes);
     State * const state = arg;
     jack_port_t * const port = state->port;
     if (port == NULL) {
+        PROBE2(process_return, nframes, 0);
         return 0;
     }
 
     void * const buffer = jack_port_get_buffer(port, nframes);
     if (buffer == NULL) {
+        PROBE2(process_return, nframes, -1);
         return -1;
     }
+    record(state, buffer, nframes);
+    PROBE2(process_return, nframes, 0);
+    return 0;
+}
 
-    char buf[128];
-    size_t buflen = 0;
-    if (!state->line_completed) {
-        buf[buflen++] = 'X';
+// Keeps the capture latency for record(), and publishes our own playback
+// latency: messages wait up to a writer interval before they are written.
+static void handle_latency(
+    const jack_latency_callback_mode_t mode,
+    void * const arg
+) {
+    State * const state = arg;
+    if (state->port == NULL) {
+        return;
+    }
+    jack_latency_range_t range;
+    if (mode == JackCaptureLatency) {
+        jack_port_get_latency_range(state->port, mode, &range);
+        atomic_store_explicit(
+            &state->capture_latency,
+            range.max,
+            memory_order_relaxed
+        );
+        return;
     }
+    range.min = 0;
+    range.max = (jack_nframes_t)(
+        (uint64_t)state->sample_rate * WRITER_INTERVAL / 1000000000
+    );
+    jack_port_set_latency_range(state->port, mode, &range);
+}
 
-    const jack_nframes_t count = jack_midi_get_event_count(buffer);
-    for (jack_nframes_t i = 0; i < count; ++i) {
-        jack_midi_event_t event;
-        if (jack_midi_event_get(&event, buffer, i) != 0) {
+typedef struct Bytes {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+} Bytes;
+
+static void bytes_push(
+    Bytes * const bytes,
+    const void * const data,
+    const size_t len
+) {
+    if (bytes->len + len > bytes->cap) {
+        size_t cap = bytes->cap ? bytes->cap : 4096;
+        while (cap < bytes->len + len) {
+            cap *= 2;
+        }
+        bytes->data = realloc(bytes->data, cap);
+        if (bytes->data == NULL) {
+            abort();
+        }
+        bytes->cap = cap;
+    }
+    memcpy(bytes->data + bytes->len, data, len);
+    bytes->len += len;
+}
+
+static void bytes_push_varlen(Bytes * const bytes, uint32_t value) {
+    unsigned char buf[5];
+    size_t i = sizeof(buf);
+    buf[--i] = value & 0x7f;
+    while (value >>= 7) {
+        buf[--i] = 0x80 | (value & 0x7f);
+    }
+    bytes_push(bytes, buf + i, sizeof(buf) - i);
+}
+
+static void bytes_push_u32(Bytes * const bytes, const uint32_t value) {
+    const unsigned char buf[] = {
+        value >> 24,
+        (value >> 16) & 0xff,
+        (value >> 8) & 0xff,
+        value & 0xff,
+    };
+    bytes_push(bytes, buf, sizeof(buf));
+}
+
+// Reassembles the message starting at slot `*pos` of `copy` into
+// `message`, and advances `*pos` past it. The copy ends at `end`, which is
+// always at a message boundary.
+static void next_message(
+    const Slot * const copy,
+    const size_t mask,
+    uint64_t * const pos,
+    const uint64_t end,
+    Bytes * const message,
+    uint64_t * const time
+) {
+    const Slot * const first = &copy[*pos & mask];
+    *time = first->time;
+    message->len = 0;
+    bytes_push(message, first->data, first->size);
+    for (++*pos; *pos < end; ++*pos) {
+        const Slot * const slot = &copy[*pos & mask];
+        if (!slot->cont) {
+            return;
+        }
+        bytes_push(message, slot->data, slot->size);
+    }
+}
+
+// Appends `message` to an SMF track. Returns false if it can't be stored.
+static bool push_smf_event(
+    Bytes * const track,
+    const uint32_t delta,
+    const Bytes * const message
+) {
+    const unsigned char status = message->data[0];
+    if (status < 0x80 || (status >= 0xf1 && status != 0xf7)) {
+        // Running status and system common/real-time messages can't be
+        // stored in a file.
+        return false;
+    }
+    bytes_push_varlen(track, delta);
+    if (status == 0xf0 || status == 0xf7) {
+        bytes_push(track, &status, 1);
+        bytes_push_varlen(track, (uint32_t)(message->len - 1));
+        bytes_push(track, message->data + 1, message->len - 1);
+    } else {
+        bytes_push(track, message->data, message->len);
+    }
+    return true;
+}
+
+static FILE *open_dump(const Retro * const retro, char * const path) {
+    const char *pattern = retro->output;
+    if (pattern == NULL) {
+        pattern = retro->format == DUMP_SMF ?
+            "midi-%Y%m%d-%H%M%S.mid" :
+            "midi-%Y%m%d-%H%M%S.txt";
+    }
+    if (strcmp(pattern, "-") == 0) {
+        strcpy(path, "standard output");
+        return stdout;
+    }
+    const time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    if (strftime(path, PATH_MAX, pattern, &tm) == 0) {
+        fprintf(stderr, "bad output pattern: %s\n", pattern);
+        return NULL;
+    }
+    FILE * const file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "could not open %s", path);
+        perror("");
+    }
+    return file;
+}
+
+// Writes the messages in the retroactive buffer that are within the time
+// limit.
+static void dump(State * const state) {
+    Ring * const ring = &state->ring;
+    Retro * const retro = &state->retro;
+    const size_t mask = ring->mask;
+    const size_t capacity = mask + 1;
+    const uint64_t end =
+        atomic_load_explicit(&ring->committed, memory_order_acquire);
+    const uint64_t now =
+        atomic_load_explicit(&ring->clock, memory_order_relaxed);
+    memcpy(retro->copy, ring->slots, capacity * sizeof(*retro->copy));
+    atomic_thread_fence(memory_order_acquire);
+    const uint64_t reserved =
+        atomic_load_explicit(&ring->reserved, memory_order_relaxed);
+
+    // Skip slots that may have been overwritten while copying.
+    uint64_t pos = end > capacity ? end - capacity : 0;
+    if (reserved > capacity && reserved - capacity > pos) {
+        pos = reserved - capacity;
+    }
+    const uint64_t oldest = now > retro->window ? now - retro->window : 0;
+    while (pos < end && (
+        retro->copy[pos & mask].cont ||
+        retro->copy[pos & mask].time < oldest
+    )) {
+        ++pos;
+    }
+
+    char path[PATH_MAX];
+    FILE * const file = open_dump(retro, path);
+    if (file == NULL) {
+        return;
+    }
+    Bytes message = {0};
+    Bytes track = {0};
+    // 120 BPM at 960 ticks per quarter note.
+    const double ticks_per_frame = 1920.0 / state->sample_rate;
+    static const unsigned char tempo[] = {
+        0x00, 0xff, 0x51, 0x03, 0x07, 0xa1, 0x20,
+    };
+    bytes_push(&track, tempo, sizeof(tempo));
+    uint64_t start = 0;
+    uint64_t last_tick = 0;
+    size_t count = 0;
+    while (pos < end) {
+        uint64_t time;
+        next_message(retro->copy, mask, &pos, end, &message, &time);
+        if (count == 0) {
+            start = time;
+        }
+        if (retro->format == DUMP_HEX) {
+            const double seconds = (double)(time - start) / state->sample_rate;
+            fprintf(file, "%.6f ", seconds);
+            for (size_t i = 0; i < message.len; ++i) {
+                fprintf(file, "%02x", message.data[i]);
+            }
+            fputc('\n', file);
+            ++count;
+            continue;
+        }
+        const uint64_t tick = (uint64_t)((time - start) * ticks_per_frame);
+        if (push_smf_event(&track, (uint32_t)(tick - last_tick), &message)) {
+            last_tick = tick;
+            ++count;
+        }
+    }
+    if (retro->format == DUMP_SMF) {
+        static const unsigned char end_of_track[] = {0x00, 0xff, 0x2f, 0x00};
+        bytes_push(&track, end_of_track, sizeof(end_of_track));
+        static const unsigned char header[] = {
+            'M', 'T', 'h', 'd', 0, 0, 0, 6,
+            // Format 0, one track, 960 ticks per quarter note.
+            0, 0, 0, 1, 0x03, 0xc0,
+            'M', 'T', 'r', 'k',
+        };
+        Bytes head = {0};
+        bytes_push(&head, header, sizeof(header));
+        bytes_push_u32(&head, (uint32_t)track.len);
+        fwrite(head.data, 1, head.len, file);
+        fwrite(track.data, 1, track.len, file);
+        free(head.data);
+    }
+    free(message.data);
+    free(track.data);
+    const bool ok = fflush(file) == 0 && !ferror(file);
+    if (file != stdout) {
+        fclose(file);
+    }
+    if (!ok) {
+        fprintf(stderr, "error writing to %s\n", path);
+        return;
+    }
+    fprintf(stderr, "wrote %zu messages to %s\n", count, path);
+}
+
+// Dumps the retroactive buffer whenever a byte is written to `dumpfd_write`.
+// Exits when it is closed.
+static void *dump_thread(void * const arg) {
+    State * const state = arg;
+    while (true) {
+        char c;
+        const ssize_t n = read(state->retro.dumpfd, &c, 1);
+        if (n == 0) {
             break;
         }
-        for (size_t i = 0; i < event.size; ++i) {
-            const unsigned char value = event.buffer[i];
-            buf[buflen++] = int_to_hex(value >> 4);
-            buf[buflen++] = int_to_hex(value & 0xf);
-            if (buflen < sizeof(buf)) {
+        if (n < 0) {
+            if (errno == EINTR) {
                 continue;
             }
-            if (!flush_buf(buf, buflen, state)) {
-                return 0;
+            perror("read() failed");
+            break;
+        }
+        dump(state);
+    }
+    return NULL;
+}
+
+// Allocates the ring and locks it into memory, so process() doesn't
+// page-fault on it.
+static bool init_ring(Ring * const ring, const size_t nslots) {
+    size_t capacity = 64;
+    while (capacity < nslots) {
+        capacity *= 2;
+    }
+    ring->slots = calloc(capacity, sizeof(*ring->slots));
+    if (ring->slots == NULL) {
+        fputs("could not allocate buffer\n", stderr);
+        return false;
+    }
+    ring->mask = capacity - 1;
+    if (mlock(ring->slots, capacity * sizeof(*ring->slots)) != 0) {
+        perror("warning: mlock() failed");
+    }
+    return true;
+}
+
+typedef struct Multicast {
+    int ttl;
+    // 0 to let the kernel choose the interface.
+    unsigned ifindex;
+} Multicast;
+
+// Sets up `fd` to send to a multicast group. This has to happen before
+// connect(), which picks the route.
+static bool set_multicast(
+    const int fd,
+    const int family,
+    const Multicast * const multicast
+) {
+    const int ttl = multicast->ttl;
+    const unsigned ifindex = multicast->ifindex;
+    const int loop = 1;
+    int status;
+    if (family == AF_INET6) {
+        status = setsockopt(
+            fd,
+            IPPROTO_IPV6,
+            IPV6_MULTICAST_HOPS,
+            &ttl,
+            sizeof(ttl)
+        ) | setsockopt(
+            fd,
+            IPPROTO_IPV6,
+            IPV6_MULTICAST_LOOP,
+            &loop,
+            sizeof(loop)
+        );
+        if (ifindex != 0) {
+            const int index = (int)ifindex;
+            status |= setsockopt(
+                fd,
+                IPPROTO_IPV6,
+                IPV6_MULTICAST_IF,
+                &index,
+                sizeof(index)
+            );
+        }
+    } else {
+        const unsigned char ttl_byte = (unsigned char)ttl;
+        const unsigned char loop_byte = 1;
+        status = setsockopt(
+            fd,
+            IPPROTO_IP,
+            IP_MULTICAST_TTL,
+            &ttl_byte,
+            sizeof(ttl_byte)
+        ) | setsockopt(
+            fd,
+            IPPROTO_IP,
+            IP_MULTICAST_LOOP,
+            &loop_byte,
+            sizeof(loop_byte)
+        );
+        if (ifindex != 0) {
+            const struct ip_mreqn mreq = {
+                .imr_ifindex = (int)ifindex,
+            };
+            status |= setsockopt(
+                fd,
+                IPPROTO_IP,
+                IP_MULTICAST_IF,
+                &mreq,
+                sizeof(mreq)
+            );
+        }
+    }
+    if (status != 0) {
+        perror("could not set multicast options");
+        return false;
+    }
+    return true;
+}
+
+// Opens a socket for "<host>:<port>" (or just "<port>" when `server` is
+// true), and connects it or binds and listens on it. `multicast` is
+// non-NULL for multicast groups. Returns -1 on error.
+static int open_socket(
+    const char * const address,
+    const int socktype,
+    const bool server,
+    const Multicast * const multicast
+) {
+    char host[256] = "";
+    const char *port = address;
+    const char * const colon = strrchr(address, ':');
+    if (colon != NULL) {
+        const size_t len = colon - address;
+        if (len >= sizeof(host)) {
+            fprintf(stderr, "bad address: %s\n", address);
+            return -1;
+        }
+        memcpy(host, address, len);
+        host[len] = '\0';
+        port = colon + 1;
+    } else if (!server) {
+        fprintf(stderr, "bad address (expected <host>:<port>): %s\n", address);
+        return -1;
+    }
+    const struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = socktype,
+        .ai_flags = server ? AI_PASSIVE : 0,
+    };
+    struct addrinfo *info = NULL;
+    const int gai_status =
+        getaddrinfo(host[0] ? host : NULL, port, &hints, &info);
+    if (gai_status != 0) {
+        fprintf(
+            stderr,
+            "could not resolve %s: %s\n",
+            address,
+            gai_strerror(gai_status)
+        );
+        return -1;
+    }
+    int fd = -1;
+    for (const struct addrinfo *ai = info; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, 0);
+        if (fd == -1) {
+            continue;
+        }
+        if (server) {
+            const int one = 1;
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (
+                bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 &&
+                listen(fd, 8) == 0
+            ) {
+                break;
+            }
+        } else if (
+            (multicast == NULL ||
+                set_multicast(fd, ai->ai_family, multicast)) &&
+            connect(fd, ai->ai_addr, ai->ai_addrlen) == 0
+        ) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(info);
+    if (fd == -1) {
+        fprintf(stderr, "could not open %s", address);
+        perror("");
+    }
+    return fd;
+}
+
+static uint32_t random_session(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint32_t)now.tv_nsec ^ (uint32_t)now.tv_sec << 12 ^
+        (uint32_t)getpid() << 20;
+}
+
+static void close_sink(Sink * const sink, const char * const reason) {
+    fprintf(stderr, "closing sink %s: %s\n", sink->spec, reason);
+    close(sink->fd);
+    sink->fd = -1;
+    if (sink->backup_fd != -1) {
+        close(sink->backup_fd);
+        sink->backup_fd = -1;
+    }
+    free(sink->frames);
+    sink->frames = NULL;
+}
+
+static void start_frames(Sink * const sink) {
+    sink->frames = malloc(sizeof(*sink->frames));
+    if (sink->frames == NULL) {
+        abort();
+    }
+    frame_sender_init(sink->frames, random_session(), sink->redundancy);
+    sink->frames->compress = sink->compress;
+    sink->frames->checksum = sink->checksum;
+}
+
+// Opens a sink from a specification of the form
+// "<target>[,<option>=<value>...]".
+static bool open_sink(Sink * const sink, char * const spec) {
+    *sink = (Sink){
+        .spec = spec,
+        .fd = -1,
+        .backup_fd = -1,
+        .policy = DROP_OLDEST,
+    };
+    Multicast multicast = {
+        .ttl = 1,
+    };
+    unsigned backup_ifindex = 0;
+    // Only worth it for datagrams, so the default depends on the kind.
+    long redundancy = -1;
+    // Options live in argv, so they can be modified in place.
+    char *option = strchr(spec, ',');
+    if (option != NULL) {
+        *option++ = '\0';
+    }
+    while (option != NULL) {
+        char * const next = strchr(option, ',');
+        if (next != NULL) {
+            *next = '\0';
+        }
+        char *endptr = NULL;
+        if (strcmp(option, "drop=oldest") == 0) {
+            sink->policy = DROP_OLDEST;
+        } else if (strcmp(option, "drop=latest") == 0) {
+            sink->policy = DROP_LATEST;
+        } else if (strcmp(option, "drop=close") == 0) {
+            sink->policy = DROP_CLOSE;
+        } else if (strcmp(option, "framed") == 0) {
+            sink->framed = true;
+        } else if (strcmp(option, "compress") == 0) {
+            sink->framed = true;
+            sink->compress = true;
+        } else if (strcmp(option, "crc") == 0) {
+            sink->framed = true;
+            sink->checksum = true;
+        } else if (strncmp(option, "ttl=", 4) == 0) {
+            const long ttl = strtol(option + 4, &endptr, 10);
+            if (*endptr != '\0' || ttl < 0 || ttl > 255) {
+                fprintf(stderr, "bad TTL: %s\n", option + 4);
+                return false;
+            }
+            multicast.ttl = (int)ttl;
+        } else if (strncmp(option, "if=", 3) == 0) {
+            multicast.ifindex = if_nametoindex(option + 3);
+            if (multicast.ifindex == 0) {
+                fprintf(stderr, "unknown interface: %s\n", option + 3);
+                return false;
+            }
+        } else if (strncmp(option, "backup-if=", 10) == 0) {
+            backup_ifindex = if_nametoindex(option + 10);
+            if (backup_ifindex == 0) {
+                fprintf(stderr, "unknown interface: %s\n", option + 10);
+                return false;
+            }
+        } else if (strncmp(option, "redundancy=", 11) == 0) {
+            redundancy = strtol(option + 11, &endptr, 10);
+            if (
+                *endptr != '\0' ||
+                redundancy < 0 ||
+                redundancy > FRAME_MAX_REDUNDANCY
+            ) {
+                fprintf(stderr, "bad redundancy: %s\n", option + 11);
+                return false;
+            }
+        } else {
+            fprintf(stderr, "bad sink option: %s\n", option);
+            return false;
+        }
+        option = next == NULL ? NULL : next + 1;
+    }
+    if (strcmp(spec, "-") == 0) {
+        sink->fd = dup(STDOUT_FILENO);
+    } else if (strncmp(spec, "file:", 5) == 0) {
+        sink->fd = open(
+            spec + 5,
+            O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+            0666
+        );
+        if (sink->fd == -1) {
+            fprintf(stderr, "could not open %s", spec + 5);
+            perror("");
+        }
+    } else if (strncmp(spec, "tcp:", 4) == 0) {
+        sink->fd = open_socket(spec + 4, SOCK_STREAM, false, NULL);
+    } else if (strncmp(spec, "udp:", 4) == 0) {
+        sink->kind = SINK_DATAGRAM;
+        sink->fd = open_socket(spec + 4, SOCK_DGRAM, false, NULL);
+    } else if (strncmp(spec, "listen:", 7) == 0) {
+        sink->kind = SINK_LISTEN;
+        sink->fd = open_socket(spec + 7, SOCK_STREAM, true, NULL);
+    } else if (strncmp(spec, "multicast:", 10) == 0) {
+        sink->kind = SINK_MULTICAST;
+        sink->fd = open_socket(spec + 10, SOCK_DGRAM, false, &multicast);
+        sink->framed = true;
+        if (backup_ifindex != 0) {
+            multicast.ifindex = backup_ifindex;
+            sink->backup_fd =
+                open_socket(spec + 10, SOCK_DGRAM, false, &multicast);
+            if (sink->backup_fd == -1 || !set_nonblock(sink->backup_fd)) {
+                return false;
+            }
+        }
+    } else {
+        fprintf(stderr, "bad sink: %s\n", spec);
+        return false;
+    }
+    if (backup_ifindex != 0 && sink->kind != SINK_MULTICAST) {
+        fputs("backup-if= is only for multicast sinks\n", stderr);
+        return false;
+    }
+    if (redundancy < 0) {
+        const bool datagram =
+            sink->kind == SINK_DATAGRAM || sink->kind == SINK_MULTICAST;
+        redundancy = datagram ? DEFAULT_REDUNDANCY : 0;
+    }
+    sink->redundancy = (unsigned)redundancy;
+    if (sink->framed && sink->kind != SINK_LISTEN) {
+        start_frames(sink);
+    }
+    return sink->fd != -1 && set_nonblock(sink->fd);
+}
+
+// Claims sink `i` for the calling writer thread, unless another one has it.
+static bool lock_sink(State * const state, const size_t i) {
+    return !atomic_flag_test_and_set_explicit(
+        &state->sink_busy[i],
+        memory_order_acquire
+    );
+}
+
+static void unlock_sink(State * const state, const size_t i) {
+    atomic_flag_clear_explicit(&state->sink_busy[i], memory_order_release);
+}
+
+// Accepts pending connections on a listening sink. Each one becomes a new
+// sink, starting at the newest data.
+static void accept_clients(State * const state, const Sink * const listener) {
+    while (true) {
+        const int fd = accept4(
+            listener->fd,
+            NULL,
+            NULL,
+            SOCK_NONBLOCK | SOCK_CLOEXEC
+        );
+        if (fd == -1) {
+            return;
+        }
+        pthread_mutex_lock(&state->accept_lock);
+        const size_t nsinks =
+            atomic_load_explicit(&state->nsinks, memory_order_relaxed);
+        size_t index = MAX_SINKS;
+        for (size_t i = 0; i < nsinks && index == MAX_SINKS; ++i) {
+            if (!lock_sink(state, i)) {
+                continue;
+            }
+            if (state->sinks[i].fd == -1) {
+                index = i;
+            } else {
+                unlock_sink(state, i);
+            }
+        }
+        const bool added = index == MAX_SINKS && nsinks < MAX_SINKS;
+        if (added) {
+            // Not yet visible to the other writers.
+            index = nsinks;
+            lock_sink(state, index);
+        }
+        if (index == MAX_SINKS) {
+            pthread_mutex_unlock(&state->accept_lock);
+            fputs("too many sinks; rejecting connection\n", stderr);
+            close(fd);
+            continue;
+        }
+        Sink * const sink = &state->sinks[index];
+        *sink = (Sink){
+            .spec = listener->spec,
+            .kind = SINK_STREAM,
+            .fd = fd,
+            .backup_fd = -1,
+            .policy = listener->policy,
+            .cursor = atomic_load_explicit(
+                &state->ring.committed,
+                memory_order_acquire
+            ),
+            .snapshot_due = true,
+            .framed = listener->framed,
+            .compress = listener->compress,
+            .checksum = listener->checksum,
+            .redundancy = listener->redundancy,
+            .snapshot_epoch = atomic_load_explicit(
+                &state->snapshot_epoch,
+                memory_order_relaxed
+            ),
+        };
+        if (sink->framed) {
+            start_frames(sink);
+        }
+        if (added) {
+            atomic_store_explicit(
+                &state->nsinks,
+                nsinks + 1,
+                memory_order_release
+            );
+        }
+        unlock_sink(state, index);
+        pthread_mutex_unlock(&state->accept_lock);
+    }
+}
+
+static size_t push_hex_line(
+    char * const buf,
+    const uint8_t * const message,
+    const size_t size
+) {
+    size_t len = 0;
+    for (size_t i = 0; i < size; ++i) {
+        buf[len++] = int_to_hex(message[i] >> 4);
+        buf[len++] = int_to_hex(message[i] & 0xf);
+    }
+    buf[len++] = '\n';
+    return len;
+}
+
+static size_t push_control(
+    uint8_t * const buf,
+    const uint8_t status,
+    const uint8_t data1,
+    const unsigned data2
+) {
+    buf[0] = status;
+    buf[1] = data1;
+    if (data2 == CONTROL_UNSET) {
+        return 2;
+    }
+    buf[2] = (uint8_t)data2;
+    return 3;
+}
+
+// Length of a message in a snapshot.
+static size_t control_length(const uint8_t status) {
+    return (status & 0xe0) == 0xc0 ? 2 : 3;
+}
+
+// Encodes the controller state as messages that recreate it, back to back.
+// Bank selects come before program changes, which come before the other
+// controllers.
+static size_t encode_snapshot(
+    const Controls * const controls,
+    uint8_t * const buf
+) {
+    static const uint8_t first[] = {0, 32};
+    size_t len = 0;
+    for (uint8_t ch = 0; ch < 16; ++ch) {
+        for (size_t i = 0; i < sizeof(first); ++i) {
+            const uint8_t value = atomic_load_explicit(
+                &controls->cc[ch][first[i]],
+                memory_order_relaxed
+            );
+            if (value != CONTROL_UNSET) {
+                len += push_control(buf + len, 0xb0 | ch, first[i], value);
+            }
+        }
+        const uint8_t program = atomic_load_explicit(
+            &controls->program[ch],
+            memory_order_relaxed
+        );
+        if (program != CONTROL_UNSET) {
+            len += push_control(buf + len, 0xc0 | ch, program, CONTROL_UNSET);
+        }
+        for (uint8_t i = 1; i < 120; ++i) {
+            const uint8_t value = atomic_load_explicit(
+                &controls->cc[ch][i],
+                memory_order_relaxed
+            );
+            if (i != 32 && value != CONTROL_UNSET) {
+                len += push_control(buf + len, 0xb0 | ch, i, value);
+            }
+        }
+        const uint8_t pressure = atomic_load_explicit(
+            &controls->pressure[ch],
+            memory_order_relaxed
+        );
+        if (pressure != CONTROL_UNSET) {
+            len +=
+                push_control(buf + len, 0xd0 | ch, pressure, CONTROL_UNSET);
+        }
+        const unsigned bend = atomic_load_explicit(
+            &controls->bend[ch],
+            memory_order_relaxed
+        );
+        if (bend != BEND_UNSET) {
+            len += push_control(buf + len, 0xe0 | ch, bend & 0x7f, bend >> 7);
+        }
+    }
+    return len;
+}
+
+// Adds a snapshot of the controller state to the sink's buffer as lines of
+// hex, if it fits. Otherwise, it stays due until enough of the buffer has
+// been written.
+static void fill_snapshot(
+    const Controls * const controls,
+    Sink * const sink
+) {
+    // One per writer thread.
+    static _Thread_local uint8_t snapshot[SNAPSHOT_MAX];
+    if (sink->len + SNAPSHOT_MAX / 3 * 7 > SINK_BUFFER) {
+        return;
+    }
+    const size_t len = encode_snapshot(controls, snapshot);
+    for (size_t i = 0; i < len;) {
+        const size_t size = control_length(snapshot[i]);
+        sink->len += push_hex_line(sink->buf + sink->len, snapshot + i, size);
+        i += size;
+    }
+    sink->snapshot_due = false;
+}
+
+// Ends the line of a message the sink is partway through, before skipping
+// the rest of it. There is always room for the newline the last piece left
+// out.
+static void end_line(Sink * const sink) {
+    if (sink->in_line) {
+        sink->buf[sink->len++] = '\n';
+        sink->in_line = false;
+    }
+}
+
+// Called when `sink` has fallen too far behind: applies its drop policy.
+static void sink_lagged(
+    Ring * const ring,
+    Sink * const sink,
+    const uint64_t committed
+) {
+    const size_t capacity = ring->mask + 1;
+    uint64_t cursor = committed;
+    if (sink->policy == DROP_CLOSE) {
+        close_sink(sink, "too slow");
+        return;
+    }
+    if (sink->policy == DROP_OLDEST) {
+        const uint64_t reserved =
+            atomic_load_explicit(&ring->reserved, memory_order_relaxed);
+        // Leave a margin for the slots process() is about to overwrite.
+        const uint64_t margin = capacity / 8;
+        cursor = reserved > capacity - margin ?
+            reserved - capacity + margin : 0;
+        if (cursor > committed) {
+            cursor = committed;
+        }
+    }
+    end_line(sink);
+    PROBE2(sink_drop, sink->spec, cursor - sink->cursor);
+    sink->dropped += cursor - sink->cursor;
+    fprintf(
+        stderr,
+        "sink %s: dropped %lu slots so far\n",
+        sink->spec,
+        sink->dropped
+    );
+    sink->cursor = cursor;
+}
+
+// Skips a `size`-byte message that `sink` can't send.
+static void drop_message(
+    Sink * const sink,
+    const size_t size,
+    const char * const reason
+) {
+    PROBE2(sink_drop, sink->spec, 1);
+    ++sink->dropped;
+    fprintf(
+        stderr,
+        "sink %s: dropped a %zu-byte message (%s)\n",
+        sink->spec,
+        size,
+        reason
+    );
+}
+
+// Encodes messages from the ring into the sink's buffer as lines of hex.
+// Messages too long for the buffer are encoded a slot at a time as room
+// allows, except on datagram sinks, which can't send them anyway.
+static void fill_sink(
+    State * const state,
+    Sink * const sink,
+    const uint64_t committed
+) {
+    Ring * const ring = &state->ring;
+    const size_t mask = ring->mask;
+    const size_t capacity = mask + 1;
+    if (committed - sink->cursor > capacity) {
+        sink_lagged(ring, sink, committed);
+        if (sink->fd == -1) {
+            return;
+        }
+    }
+    if (sink->start > 0) {
+        memmove(sink->buf, sink->buf + sink->start, sink->len - sink->start);
+        sink->len -= sink->start;
+        sink->start = 0;
+    }
+    if (sink->snapshot_due && !sink->in_line) {
+        fill_snapshot(&state->controls, sink);
+    }
+    uint64_t pos = sink->cursor;
+    size_t len = sink->len;
+    bool in_line = sink->in_line;
+    // After dropping data, skip to the start of a message.
+    while (!in_line && pos < committed && ring->slots[pos & mask].cont) {
+        ++pos;
+    }
+    while (pos < committed) {
+        if (in_line) {
+            const Slot * const slot = &ring->slots[pos & mask];
+            if (len + slot->size * 2 + 1 > SINK_BUFFER) {
+                break;
+            }
+            len += push_hex_line(sink->buf + len, slot->data, slot->size) - 1;
+            ++pos;
+            // `committed` only ever falls between messages.
+            if (pos == committed || !ring->slots[pos & mask].cont) {
+                sink->buf[len++] = '\n';
+                in_line = false;
+            }
+            continue;
+        }
+        uint64_t end = pos + 1;
+        size_t size = ring->slots[pos & mask].size;
+        while (end < committed && ring->slots[end & mask].cont) {
+            size += ring->slots[end & mask].size;
+            ++end;
+        }
+        if (sink->kind == SINK_DATAGRAM && size * 2 + 1 > DATAGRAM_MAX) {
+            drop_message(sink, size, "too long for a datagram");
+            pos = end;
+            continue;
+        }
+        if (size * 2 + 1 > SINK_BUFFER) {
+            // Could never fit, so waiting for room would stall the sink.
+            PROBE2(event_encode, sink->spec, size);
+            in_line = true;
+            continue;
+        }
+        if (len + size * 2 + 1 > SINK_BUFFER) {
+            break;
+        }
+        for (; pos < end; ++pos) {
+            const Slot * const slot = &ring->slots[pos & mask];
+            // Each piece is followed by a newline, which the next one
+            // overwrites.
+            len += push_hex_line(sink->buf + len, slot->data, slot->size) - 1;
+        }
+        sink->buf[len++] = '\n';
+        PROBE2(event_encode, sink->spec, size);
+    }
+    // Discard what was encoded if process() overwrote any of it meanwhile.
+    atomic_thread_fence(memory_order_acquire);
+    const uint64_t reserved =
+        atomic_load_explicit(&ring->reserved, memory_order_relaxed);
+    if (reserved > capacity && reserved - capacity > sink->cursor) {
+        sink_lagged(ring, sink, committed);
+        return;
+    }
+    PROBE3(ring_read, sink->spec, sink->cursor, pos);
+    sink->len = len;
+    sink->in_line = in_line;
+    sink->cursor = pos;
+}
+
+static bool is_datagram(const Sink * const sink) {
+    return sink->kind == SINK_DATAGRAM || sink->kind == SINK_MULTICAST;
+}
+
+// Whether a framed sink has room for `count` more frames. Datagrams are
+// sent right away, so they always do.
+static bool frame_room(const Sink * const sink, const size_t count) {
+    return is_datagram(sink) ||
+        sink->len + count * (FRAME_MAX + 2) <= SINK_BUFFER;
+}
+
+// Sends a datagram. Returns false on errors other than a full buffer or an
+// unreachable receiver, which only lose this datagram.
+static bool send_datagram(
+    const int fd,
+    const unsigned char * const datagram,
+    const size_t len
+) {
+    while (send(fd, datagram, len, 0) < 0) {
+        if (errno == EINTR) {
+            continue;
+        }
+        return errno == EAGAIN ||
+            errno == EWOULDBLOCK ||
+            errno == ECONNREFUSED ||
+            errno == ENOBUFS;
+    }
+    return true;
+}
+
+// Sends the current batch of a framed sink. On stream sinks, it goes into
+// the sink's buffer, which must have room (see frame_room()). Datagrams
+// that can't be sent right away are dropped; receivers recover them from
+// the redundant copies in later ones, or count them as lost.
+static void send_frame(Sink * const sink) {
+    unsigned char datagram[FRAME_MAX];
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    const uint32_t time =
+        (uint32_t)now.tv_sec * 1000000 + (uint32_t)(now.tv_nsec / 1000);
+    const size_t len = frame_finish(sink->frames, time, datagram);
+    if (!is_datagram(sink)) {
+        sink->buf[sink->len++] = (char)(len >> 8);
+        sink->buf[sink->len++] = (char)(len & 0xff);
+        memcpy(sink->buf + sink->len, datagram, len);
+        sink->len += len;
+        return;
+    }
+    if (!send_datagram(sink->fd, datagram, len)) {
+        close_sink(sink, strerror(errno));
+        return;
+    }
+    // The backup path failing leaves the primary one going.
+    if (
+        sink->backup_fd != -1 &&
+        !send_datagram(sink->backup_fd, datagram, len)
+    ) {
+        fprintf(
+            stderr,
+            "closing backup path of sink %s: %s\n",
+            sink->spec,
+            strerror(errno)
+        );
+        close(sink->backup_fd);
+        sink->backup_fd = -1;
+    }
+}
+
+static void push_frame(
+    Sink * const sink,
+    const uint8_t * const message,
+    const size_t len
+) {
+    if (len > FRAME_MESSAGE_MAX) {
+        drop_message(sink, len, "too long for a frame");
+        return;
+    }
+    if (!frame_add(sink->frames, message, len)) {
+        send_frame(sink);
+        if (sink->fd != -1) {
+            frame_add(sink->frames, message, len);
+        }
+    }
+}
+
+// Encodes messages from the ring into frames and sends them (or, for
+// stream sinks, adds them to the buffer). Frames are sent at least once per
+// writer interval, so batches cover about that much time.
+static void fill_frames(
+    State * const state,
+    Sink * const sink,
+    const uint64_t committed
+) {
+    Ring * const ring = &state->ring;
+    const size_t mask = ring->mask;
+    const size_t capacity = mask + 1;
+    if (committed - sink->cursor > capacity) {
+        sink_lagged(ring, sink, committed);
+        if (sink->fd == -1) {
+            return;
+        }
+    }
+    if (sink->start > 0) {
+        memmove(sink->buf, sink->buf + sink->start, sink->len - sink->start);
+        sink->len -= sink->start;
+        sink->start = 0;
+    }
+    if (sink->snapshot_due && frame_room(sink, SNAPSHOT_FRAMES)) {
+        // One per writer thread.
+        static _Thread_local uint8_t snapshot[SNAPSHOT_MAX];
+        const size_t len = encode_snapshot(&state->controls, snapshot);
+        for (size_t i = 0; i < len && sink->fd != -1;) {
+            const size_t size = control_length(snapshot[i]);
+            push_frame(sink, snapshot + i, size);
+            i += size;
+        }
+        sink->snapshot_due = false;
+    }
+    uint64_t pos = sink->cursor;
+    while (pos < committed && ring->slots[pos & mask].cont) {
+        ++pos;
+    }
+    uint8_t message[FRAME_MESSAGE_MAX];
+    // Each message sends at most one frame, and the final one another.
+    while (pos < committed && sink->fd != -1 && frame_room(sink, 2)) {
+        size_t size = 0;
+        uint64_t end = pos;
+        do {
+            const Slot * const slot = &ring->slots[end & mask];
+            if (size + slot->size <= sizeof(message)) {
+                memcpy(message + size, slot->data, slot->size);
+            }
+            size += slot->size;
+            ++end;
+        } while (end < committed && ring->slots[end & mask].cont);
+        atomic_thread_fence(memory_order_acquire);
+        const uint64_t reserved =
+            atomic_load_explicit(&ring->reserved, memory_order_relaxed);
+        if (reserved > capacity && reserved - capacity > pos) {
+            sink->cursor = pos;
+            sink_lagged(ring, sink, committed);
+            return;
+        }
+        PROBE2(event_encode, sink->spec, size);
+        push_frame(sink, message, size);
+        pos = end;
+    }
+    PROBE3(ring_read, sink->spec, sink->cursor, pos);
+    sink->cursor = pos;
+    if (sink->fd != -1 && !frame_empty(sink->frames)) {
+        send_frame(sink);
+    }
+}
+
+// Writes as much of the sink's buffer as it will take without blocking.
+static void flush_buf(Sink * const sink) {
+    while (sink->start < sink->len) {
+        size_t len = sink->len - sink->start;
+        if (sink->kind == SINK_DATAGRAM && len > DATAGRAM_MAX) {
+            // Send whole lines only.
+            len = DATAGRAM_MAX;
+            while (len > 0 && sink->buf[sink->start + len - 1] != '\n') {
+                --len;
+            }
+            if (len == 0) {
+                // The first line alone is too long for a datagram.
+                const char * const newline = memchr(
+                    sink->buf + sink->start,
+                    '\n',
+                    sink->len - sink->start
+                );
+                sink->start = newline == NULL ?
+                    sink->len : (size_t)(newline - sink->buf) + 1;
+                PROBE2(sink_drop, sink->spec, 1);
+                ++sink->dropped;
+                continue;
+            }
+        }
+        const ssize_t written = write(sink->fd, sink->buf + sink->start, len);
+        PROBE3(flush_write, sink->spec, len, written);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                PROBE2(flush_drop, sink->spec, sink->len - sink->start);
+                close_sink(sink, strerror(errno));
+            }
+            return;
+        }
+        sink->start += (size_t)written;
+    }
+    sink->start = 0;
+    sink->len = 0;
+}
+
+// Feeds every sink from the ring, so a slow sink only delays itself.
+// Encodes and writes whatever sink `sink` is due. The caller holds its flag.
+static void serve_sink(
+    State * const state,
+    Sink * const sink,
+    const uint64_t committed,
+    const bool is_active,
+    const short revents
+) {
+    if (sink->fd == -1) {
+        return;
+    }
+    if (sink->kind == SINK_LISTEN) {
+        if (revents & POLLIN) {
+            accept_clients(state, sink);
+        }
+        return;
+    }
+    const unsigned epoch =
+        atomic_load_explicit(&state->snapshot_epoch, memory_order_relaxed);
+    if (sink->snapshot_epoch != epoch || (is_active && !sink->active)) {
+        // Periodically, and to bring receivers up to date with what they
+        // missed in standby.
+        sink->snapshot_epoch = epoch;
+        sink->snapshot_due = true;
+    }
+    sink->active = is_active;
+    if (!is_active) {
+        // Keep up with the ring without writing anything.
+        end_line(sink);
+        sink->cursor = committed;
+        return;
+    }
+    if (sink->framed) {
+        fill_frames(state, sink, committed);
+    } else {
+        fill_sink(state, sink, committed);
+    }
+    if (sink->fd != -1) {
+        flush_buf(sink);
+    }
+}
+
+// A writer thread. Sink i belongs to writer i % nwriters, which keeps each
+// sink's output in order; a slow sink only holds up the sinks that share
+// its writer. A writer also serves other writers' sinks that have fallen
+// far behind, such as during a burst, when it can claim them.
+typedef struct Writer {
+    State *state;
+    size_t index;
+    pthread_t thread;
+} Writer;
+
+static void *writer_thread(void * const arg) {
+    const Writer * const writer = arg;
+    State * const state = writer->state;
+    Ring * const ring = &state->ring;
+    struct pollfd pollfds[MAX_SINKS];
+    size_t owned[MAX_SINKS];
+    struct timespec last_snapshot;
+    clock_gettime(CLOCK_MONOTONIC, &last_snapshot);
+    bool running = true;
+    while (running) {
+        running = atomic_load_explicit(&state->running, memory_order_acquire);
+        const bool is_active =
+            atomic_load_explicit(&active, memory_order_relaxed);
+        if (writer->index == 0 && state->snapshot_interval > 0) {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            const double elapsed = (now.tv_sec - last_snapshot.tv_sec) +
+                (now.tv_nsec - last_snapshot.tv_nsec) / 1e9;
+            if (elapsed >= state->snapshot_interval) {
+                last_snapshot = now;
+                atomic_fetch_add_explicit(
+                    &state->snapshot_epoch,
+                    1,
+                    memory_order_relaxed
+                );
+            }
+        }
+        const size_t nsinks =
+            atomic_load_explicit(&state->nsinks, memory_order_acquire);
+        size_t nfds = 0;
+        for (size_t i = writer->index; i < nsinks; i += state->nwriters) {
+            if (!lock_sink(state, i)) {
+                continue;
+            }
+            const Sink * const sink = &state->sinks[i];
+            short events = 0;
+            if (sink->kind == SINK_LISTEN) {
+                events = POLLIN;
+            } else if (sink->start < sink->len) {
+                events = POLLOUT;
+            }
+            owned[nfds] = i;
+            pollfds[nfds++] = (struct pollfd){
+                .fd = events ? sink->fd : -1,
+                .events = events,
+            };
+            unlock_sink(state, i);
+        }
+        if (running) {
+            poll(pollfds, nfds, WRITER_INTERVAL / 1000000);
+        }
+
+        const uint64_t committed =
+            atomic_load_explicit(&ring->committed, memory_order_acquire);
+        for (size_t k = 0; k < nfds; ++k) {
+            const size_t i = owned[k];
+            if (!lock_sink(state, i)) {
+                continue;
+            }
+            serve_sink(
+                state,
+                &state->sinks[i],
+                committed,
+                is_active,
+                pollfds[k].revents
+            );
+            unlock_sink(state, i);
+        }
+        for (size_t i = 0; state->nwriters > 1 && i < nsinks; ++i) {
+            if (i % state->nwriters == writer->index || !lock_sink(state, i)) {
+                continue;
+            }
+            Sink * const sink = &state->sinks[i];
+            if (
+                sink->kind != SINK_LISTEN &&
+                committed - sink->cursor >= STEAL_BACKLOG
+            ) {
+                serve_sink(state, sink, committed, is_active, 0);
+            }
+            unlock_sink(state, i);
+        }
+    }
+    return NULL;
+}
+
+// Sets up a newly opened client: callbacks, ports and activation. Used at
+// startup and again after the server restarts.
+static bool start_client(State * const state, jack_client_t * const client) {
+    state->client = client;
+    state->port = NULL;
+    const int spc_status = jack_set_process_callback(client, process, state);
+    if (spc_status != 0) {
+        fprintf(
+            stderr,
+            "jack_set_process_callback() failed: %d\n",
+            spc_status
+        );
+        return false;
+    }
+
+    const int slc_status =
+        jack_set_latency_callback(client, handle_latency, state);
+    if (slc_status != 0) {
+        fprintf(
+            stderr,
+            "jack_set_latency_callback() failed: %d\n",
+            slc_status
+        );
+        return false;
+    }
+    if (
+        !reconnect_watch(&state->reconnect, client) ||
+        !autoconnect_watch(&state->autoconnect, client)
+    ) {
+        return false;
+    }
+
+    jack_port_t * const port = jack_port_register(
+        client,
+        "in",
+        JACK_DEFAULT_MIDI_TYPE,
+        JackPortIsInput,
+        0
+    );
+    if (port == NULL) {
+        fputs("jack_port_register() failed\n", stderr);
+        return false;
+    }
+    state->port = port;
+
+    const int astatus = jack_activate(client);
+    if (astatus != 0) {
+        fprintf(stderr, "jack_activate() failed: %d\n", astatus);
+        return false;
+    }
+    return true;
+}
+
+#define COMMAND_MAX 64
+
+// Reads commands from standard input, which is non-blocking. Returns false
+// at end of file.
+static bool handle_commands(char * const line, size_t * const linelen) {
+    char buf[64];
+    while (true) {
+        const ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+        if (n < 0) {
+            return true;
+        }
+        if (n == 0) {
+            return false;
+        }
+        for (size_t i = 0; i < (size_t)n; ++i) {
+            if (buf[i] != '\n') {
+                if (*linelen < COMMAND_MAX - 1) {
+                    line[(*linelen)++] = buf[i];
+                }
+                continue;
+            }
+            line[*linelen] = '\0';
+            *linelen = 0;
+            if (strcmp(line, "dump") == 0) {
+                request_dump();
+            } else if (strcmp(line, "activate") == 0) {
+                atomic_store_explicit(&active, true, memory_order_relaxed);
+            } else if (line[0] != '\0') {
+                fprintf(stderr, "unknown command: %s\n", line);
             }
-            buflen = 0;
         }
-        buf[buflen++] = '\n';
     }
-    flush_buf(buf, buflen, state);
-    return 0;
 }
 
 int main(const int argc, char ** const argv) {
+    double retro_minutes = 0;
+    bool standby = false;
+    size_t slots = 0;
+    DumpFormat format = DUMP_SMF;
+    const char *output = NULL;
+    static Sink sinks[MAX_SINKS];
+    size_t nsinks = 0;
+    static State state = {
+        .port = NULL,
+        .sinks = sinks,
+        .accept_lock = PTHREAD_MUTEX_INITIALIZER,
+        .nwriters = 1,
+    };
+    transform_init(&state.transform);
+    init_controls(&state.controls);
+    crc32c_init();
+
     int argi = 1;
-    if (argc > argi) {
-        if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+    for (; argi < argc; ++argi) {
+        const char * const arg = argv[argi];
+        const char *value = NULL;
+        char *endptr = NULL;
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
             usage(stdout, argv[0]);
             return EXIT_SUCCESS;
         }
-        if (strcmp(argv[1], "--version") == 0) {
+        if (strcmp(arg, "--version") == 0) {
             puts("0.1");
             return EXIT_SUCCESS;
         }
-        if (strcmp(argv[1], "--") == 0) {
+        if (strcmp(arg, "--") == 0) {
             ++argi;
+            break;
+        }
+        if (arg[0] != '-' || arg[1] == '\0') {
+            break;
+        }
+        if (strcmp(arg, "-w") == 0 || strcmp(arg, "--standby") == 0) {
+            standby = true;
+        } else if (
+            match_option(argc, argv, &argi, "-r", "--retro", &value)
+        ) {
+            if (value != NULL) {
+                retro_minutes = strtod(value, &endptr);
+            }
+            if (value == NULL || *endptr != '\0' || !(retro_minutes > 0)) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (
+            match_option(argc, argv, &argi, "-S", "--snapshot", &value)
+        ) {
+            if (value != NULL) {
+                state.snapshot_interval = strtod(value, &endptr);
+            }
+            if (
+                value == NULL ||
+                *endptr != '\0' ||
+                !(state.snapshot_interval > 0)
+            ) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (
+            match_option(argc, argv, &argi, "-s", "--buffer-size", &value)
+        ) {
+            if (value != NULL) {
+                slots = strtoul(value, &endptr, 10);
+            }
+            if (value == NULL || *endptr != '\0' || slots == 0) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (
+            match_option(argc, argv, &argi, "-j", "--writers", &value)
+        ) {
+            if (value != NULL) {
+                state.nwriters = strtoul(value, &endptr, 10);
+            }
+            if (
+                value == NULL || *endptr != '\0' ||
+                state.nwriters == 0 || state.nwriters > MAX_WRITERS
+            ) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (match_option(argc, argv, &argi, "-O", "--sink", &value)) {
+            if (value == NULL || *value == '\0') {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+            if (nsinks >= MAX_SINKS) {
+                fprintf(stderr, "too many sinks (max %d)\n", MAX_SINKS);
+                return EXIT_FAILURE;
+            }
+            // `value` points into argv, which may be modified.
+            if (!open_sink(&sinks[nsinks++], (char *)value)) {
+                return EXIT_FAILURE;
+            }
+        } else if (match_option(argc, argv, &argi, "-F", "--format", &value)) {
+            if (value != NULL && strcmp(value, "smf") == 0) {
+                format = DUMP_SMF;
+            } else if (value != NULL && strcmp(value, "hex") == 0) {
+                format = DUMP_HEX;
+            } else {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+        } else if (match_option(argc, argv, &argi, "-o", "--output", &value)) {
+            if (value == NULL || *value == '\0') {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+            output = value;
+        } else if (
+            match_option(argc, argv, &argi, "-t", "--transform", &value)
+        ) {
+            if (value == NULL) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+            if (!transform_add_rule(&state.transform, value)) {
+                return EXIT_FAILURE;
+            }
+            state.transforming = true;
+        } else if (
+            match_option(argc, argv, &argi, "-C", "--connect", &value)
+        ) {
+            if (value == NULL) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+            if (!autoconnect_add_rule(&state.autoconnect, value)) {
+                return EXIT_FAILURE;
+            }
+        } else {
+            fprintf(stderr, "unknown option: %s\n", arg);
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
         }
     }
     if (argc - argi > 1) {
@@ -204,7 +2097,56 @@ int main(const int argc, char ** const argv) {
         return EXIT_FAILURE;
     }
 
-    set_nonblock(STDOUT_FILENO);
+    const bool retro = retro_minutes > 0;
+    if (!retro && nsinks == 0) {
+        static char stdout_spec[] = "-";
+        if (!open_sink(&sinks[nsinks++], stdout_spec)) {
+            return EXIT_FAILURE;
+        }
+    }
+    atomic_init(&state.nsinks, nsinks);
+    for (size_t i = 0; i < MAX_SINKS; ++i) {
+        atomic_flag_clear(&state.sink_busy[i]);
+    }
+    if (slots == 0) {
+        slots = retro ? DEFAULT_RETRO_SLOTS : DEFAULT_SLOTS;
+    }
+    if (!init_ring(&state.ring, slots)) {
+        return EXIT_FAILURE;
+    }
+    // A closed socket shows up as EPIPE from write().
+    signal(SIGPIPE, SIG_IGN);
+
+    int dumpfds[2] = {-1, -1};
+    if (retro) {
+        state.retro.copy =
+            calloc(state.ring.mask + 1, sizeof(*state.retro.copy));
+        if (state.retro.copy == NULL) {
+            fputs("could not allocate buffer\n", stderr);
+            return EXIT_FAILURE;
+        }
+        state.retro.enabled = true;
+        state.retro.format = format;
+        state.retro.output = output;
+        if (pipe2(dumpfds, O_CLOEXEC) != 0) {
+            perror("pipe2() failed");
+            return EXIT_FAILURE;
+        }
+        state.retro.dumpfd = dumpfds[0];
+        dumpfd_write = dumpfds[1];
+        if (
+            !set_nonblock(dumpfd_write) ||
+            !install_handler(SIGUSR2, handle_dump_signal)
+        ) {
+            return EXIT_FAILURE;
+        }
+    }
+    // Commands are read from standard input in retro and standby modes.
+    const bool commands = retro || standby;
+    if (commands && !set_nonblock(STDIN_FILENO)) {
+        return EXIT_FAILURE;
+    }
+    atomic_store_explicit(&active, !standby, memory_order_relaxed);
     int sigfds[2];
     if (pipe(sigfds) != 0) {
         perror("pipe() failed");
@@ -214,10 +2156,13 @@ int main(const int argc, char ** const argv) {
 
     static const int signals[] = {SIGHUP, SIGINT, SIGQUIT, SIGTERM};
     for (size_t i = 0; i < sizeof(signals) / sizeof(*signals); ++i) {
-        if (!install_exit_handler(signals[i])) {
+        if (!install_handler(signals[i], handle_exit_signal)) {
             return EXIT_FAILURE;
         }
     }
+    if (!install_handler(SIGUSR1, handle_activate_signal)) {
+        return EXIT_FAILURE;
+    }
 
     const char * const name = argc > argi ? argv[argi] : "midi2stdio";
     jack_status_t status = 0;
@@ -228,43 +2173,135 @@ int main(const int argc, char ** const argv) {
         return EXIT_FAILURE;
     }
 
-    State state = {
-        .client = client,
-        .port = NULL,
-        .line_completed = true,
-    };
-    const int spc_status = jack_set_process_callback(client, process, &state);
-    if (spc_status != 0) {
-        fprintf(
-            stderr,
-            "jack_set_process_callback() failed: %d\n",
-            spc_status
-        );
+    state.client = client;
+    state.sample_rate = jack_get_sample_rate(client);
+    state.retro.window =
+        (uint64_t)(retro_minutes * 60 * state.sample_rate + 0.5);
+    if (
+        !reconnect_init(&state.reconnect, name, 1) ||
+        !autoconnect_init(&state.autoconnect)
+    ) {
         return close_and_fail(client);
     }
 
-    jack_port_t * const port = jack_port_register(
-        client,
-        "in",
-        JACK_DEFAULT_MIDI_TYPE,
-        JackPortIsInput,
-        0
-    );
-    if (port == NULL) {
-        fputs("jack_port_register() failed\n", stderr);
-        return close_and_fail(client);
+    atomic_store_explicit(&state.running, true, memory_order_relaxed);
+    static Writer writers[MAX_WRITERS];
+    for (size_t i = 0; i < state.nwriters; ++i) {
+        writers[i] = (Writer){
+            .state = &state,
+            .index = i,
+        };
+        const int wc_status = pthread_create(
+            &writers[i].thread,
+            NULL,
+            writer_thread,
+            &writers[i]
+        );
+        if (wc_status != 0) {
+            fprintf(stderr, "pthread_create() failed: %d\n", wc_status);
+            return close_and_fail(client);
+        }
     }
-    state.port = port;
 
-    const int astatus = jack_activate(client);
-    if (astatus != 0) {
-        fprintf(stderr, "jack_activate() failed: %d\n", astatus);
+    pthread_t dumper;
+    if (retro) {
+        const int pc_status =
+            pthread_create(&dumper, NULL, dump_thread, &state);
+        if (pc_status != 0) {
+            fprintf(stderr, "pthread_create() failed: %d\n", pc_status);
+            return close_and_fail(client);
+        }
+    }
+
+    if (!start_client(&state, client)) {
         return close_and_fail(client);
     }
 
     const int sigfd_read = sigfds[0];
-    for (char c; read(sigfd_read, &c, 1) == -1 && errno == EINTR;) {}
-    jack_client_close(client);
+    struct pollfd pollfds[] = {
+        {
+            .fd = sigfd_read,
+            .events = 0,
+        },
+        {
+            .fd = commands ? STDIN_FILENO : -1,
+            .events = POLLIN,
+        },
+        {
+            .fd = state.reconnect.notify_read,
+            .events = POLLIN,
+        },
+        {
+            .fd = state.autoconnect.notify_read,
+            .events = POLLIN,
+        },
+    };
+    char line[COMMAND_MAX];
+    size_t linelen = 0;
+    while (true) {
+        // The writer keeps serving sinks while the server is down; the ring
+        // simply stays empty until the client is back.
+        if (state.client == NULL) {
+            jack_client_t * const next = reconnect_try(&state.reconnect);
+            if (next == NULL) {
+            } else if (start_client(&state, next)) {
+                reconnect_restore(&state.reconnect, next, &state.port);
+            } else {
+                jack_client_close(next);
+                state.client = NULL;
+                state.port = NULL;
+            }
+        }
+        autoconnect_apply(&state.autoconnect, state.client, &state.port, 1);
+        const int status = poll(
+            pollfds,
+            sizeof(pollfds) / sizeof(*pollfds),
+            reconnect_combine_timeouts(
+                reconnect_timeout(&state.reconnect),
+                autoconnect_timeout(&state.autoconnect)
+            )
+        );
+        if (status < 0 && errno != EINTR) {
+            perror("poll() failed");
+            break;
+        }
+        if (status <= 0) {
+            continue;
+        }
+        if (pollfds[0].revents) {
+            break;
+        }
+        if (pollfds[1].revents & POLLIN) {
+            if (!handle_commands(line, &linelen)) {
+                pollfds[1].fd = -1;
+            }
+        } else if (pollfds[1].revents) {
+            pollfds[1].fd = -1;
+        }
+        if (
+            pollfds[2].revents & POLLIN &&
+            reconnect_read(&state.reconnect, &state.port)
+        ) {
+            jack_client_close(state.client);
+            state.client = NULL;
+            state.port = NULL;
+        }
+        if (pollfds[3].revents & POLLIN) {
+            autoconnect_read(&state.autoconnect);
+        }
+    }
+    if (state.client != NULL) {
+        jack_client_close(state.client);
+    }
+    atomic_store_explicit(&state.running, false, memory_order_release);
+    for (size_t i = 0; i < state.nwriters; ++i) {
+        pthread_join(writers[i].thread, NULL);
+    }
+    if (retro) {
+        signal(SIGUSR2, SIG_IGN);
+        close(dumpfd_write);
+        pthread_join(dumper, NULL);
+    }
 
     const int tty = open("/dev/tty", O_WRONLY);
     if (tty != -1) {
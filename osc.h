@@ -0,0 +1,560 @@
+/*
+ * Copyright (C) 2025 taylor.fish <contact@taylor.fish>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Minimal OSC-over-UDP support shared by the jacl clients. Requires
+// _GNU_SOURCE (for recvmmsg()).
+//
+// Packets are parsed in place: no allocation happens after the receiver and
+// address table have been set up.
+#ifndef JACL_OSC_H
+#define JACL_OSC_H
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OSC_BATCH 16
+#define OSC_PACKET_MAX 4096
+#define OSC_MAX_DEPTH 4
+
+typedef struct OscMessage {
+    const char *address;
+    // Type tags, not including the leading ','.
+    const char *types;
+    const unsigned char *args;
+    const unsigned char *end;
+} OscMessage;
+
+typedef struct OscArg {
+    char type;
+    union {
+        int32_t i;
+        int64_t h;
+        float f;
+        double d;
+        unsigned char m[4];
+        struct {
+            const unsigned char *data;
+            size_t size;
+        } b;
+    };
+} OscArg;
+
+typedef void (*OscHandler)(void *ctx, const OscMessage *message);
+// Called after all messages in a packet have been handled.
+typedef void (*OscPacketHandler)(void *ctx);
+
+static inline uint32_t osc_read_u32(const unsigned char * const p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+        (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static inline uint64_t osc_read_u64(const unsigned char * const p) {
+    return (uint64_t)osc_read_u32(p) << 32 | osc_read_u32(p + 4);
+}
+
+// Returns the padded size of the string at `p`, or 0 if it isn't
+// terminated before `end`.
+static inline size_t osc_string_size(
+    const unsigned char * const p,
+    const unsigned char * const end
+) {
+    const unsigned char * const nul = memchr(p, '\0', end - p);
+    if (nul == NULL) {
+        return 0;
+    }
+    const size_t size = ((size_t)(nul - p) + 4) & ~(size_t)3;
+    return size <= (size_t)(end - p) ? size : 0;
+}
+
+// Reads the next argument of `message`, advancing it. Returns false at the
+// end of the argument list or on malformed/unsupported data.
+static inline bool osc_next_arg(
+    OscMessage * const message,
+    OscArg * const arg
+) {
+    const char type = *message->types;
+    const unsigned char * const p = message->args;
+    const size_t avail = message->end - p;
+    size_t size = 0;
+    switch (type) {
+        case 'i':
+        case 'f':
+        case 'm':
+        case 'r':
+        case 'c':
+            size = 4;
+            break;
+        case 'h':
+        case 'd':
+        case 't':
+            size = 8;
+            break;
+        case 'T':
+        case 'F':
+        case 'N':
+        case 'I':
+            break;
+        case 's':
+        case 'S':
+            size = osc_string_size(p, message->end);
+            if (size == 0) {
+                return false;
+            }
+            break;
+        case 'b': {
+            if (avail < 4) {
+                return false;
+            }
+            const size_t len = osc_read_u32(p);
+            size = 4 + ((len + 3) & ~(size_t)3);
+            if (len > avail - 4 || size > avail) {
+                return false;
+            }
+            arg->b.data = p + 4;
+            arg->b.size = len;
+            break;
+        }
+        default:
+            return false;
+    }
+    if (size > avail) {
+        return false;
+    }
+    arg->type = type;
+    switch (type) {
+        case 'i':
+        case 'r':
+        case 'c':
+            arg->i = (int32_t)osc_read_u32(p);
+            break;
+        case 'f': {
+            const uint32_t bits = osc_read_u32(p);
+            memcpy(&arg->f, &bits, sizeof(arg->f));
+            break;
+        }
+        case 'm':
+            memcpy(arg->m, p, 4);
+            break;
+        case 'h':
+        case 't':
+            arg->h = (int64_t)osc_read_u64(p);
+            break;
+        case 'd': {
+            const uint64_t bits = osc_read_u64(p);
+            memcpy(&arg->d, &bits, sizeof(arg->d));
+            break;
+        }
+        default:
+            break;
+    }
+    ++message->types;
+    message->args += size;
+    return true;
+}
+
+// Converts a numeric argument to a float. Returns false if `arg` isn't
+// numeric.
+static inline bool osc_arg_number(
+    const OscArg * const arg,
+    float * const out
+) {
+    switch (arg->type) {
+        case 'i':
+            *out = (float)arg->i;
+            return true;
+        case 'f':
+            *out = arg->f;
+            return true;
+        case 'h':
+            *out = (float)arg->h;
+            return true;
+        case 'd':
+            *out = (float)arg->d;
+            return true;
+        case 'T':
+            *out = 1;
+            return true;
+        case 'F':
+            *out = 0;
+            return true;
+        default:
+            return false;
+    }
+}
+
+static inline bool osc_parse_element(
+    const unsigned char *data,
+    size_t size,
+    OscHandler handler,
+    void *ctx,
+    unsigned depth
+);
+
+static inline bool osc_parse_bundle(
+    const unsigned char * const data,
+    const size_t size,
+    const OscHandler handler,
+    void * const ctx,
+    const unsigned depth
+) {
+    // "#bundle\0" followed by an 8-byte time tag. Time tags are ignored;
+    // elements are dispatched immediately, in order.
+    size_t pos = 16;
+    if (size < pos || depth >= OSC_MAX_DEPTH) {
+        return false;
+    }
+    while (pos < size) {
+        if (size - pos < 4) {
+            return false;
+        }
+        const size_t len = osc_read_u32(data + pos);
+        pos += 4;
+        if (len > size - pos || len % 4 != 0) {
+            return false;
+        }
+        if (!osc_parse_element(data + pos, len, handler, ctx, depth + 1)) {
+            return false;
+        }
+        pos += len;
+    }
+    return true;
+}
+
+static inline bool osc_parse_element(
+    const unsigned char * const data,
+    const size_t size,
+    const OscHandler handler,
+    void * const ctx,
+    const unsigned depth
+) {
+    const unsigned char * const end = data + size;
+    if (size >= 8 && memcmp(data, "#bundle", 8) == 0) {
+        return osc_parse_bundle(data, size, handler, ctx, depth);
+    }
+    if (size == 0 || data[0] != '/') {
+        return false;
+    }
+    const size_t addr_size = osc_string_size(data, end);
+    if (addr_size == 0) {
+        return false;
+    }
+    OscMessage message = {
+        .address = (const char *)data,
+        .types = "",
+        .args = data + addr_size,
+        .end = end,
+    };
+    if (message.args < end && *message.args == ',') {
+        const size_t types_size = osc_string_size(message.args, end);
+        if (types_size == 0) {
+            return false;
+        }
+        message.types = (const char *)message.args + 1;
+        message.args += types_size;
+    }
+    handler(ctx, &message);
+    return true;
+}
+
+// Parses an OSC packet (a message or a bundle), calling `handler` for each
+// message. Returns false if the packet is malformed; messages preceding the
+// malformed part will already have been handled.
+static inline bool osc_parse_packet(
+    const unsigned char * const data,
+    const size_t size,
+    const OscHandler handler,
+    void * const ctx
+) {
+    return osc_parse_element(data, size, handler, ctx, 0);
+}
+
+// Fixed-size open-addressing hash table mapping addresses to indices, built
+// once at startup.
+typedef struct OscEntry {
+    const char *address;
+    int index;
+} OscEntry;
+
+typedef struct OscTable {
+    OscEntry *entries;
+    size_t mask;
+} OscTable;
+
+static inline uint32_t osc_hash(const char *s) {
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for (; *s != '\0'; ++s) {
+        hash ^= (unsigned char)*s;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Initializes `table` to hold up to `count` entries.
+static inline void osc_table_init(OscTable * const table, const size_t count) {
+    size_t capacity = 4;
+    while (capacity < count * 2) {
+        capacity *= 2;
+    }
+    table->entries = calloc(capacity, sizeof(*table->entries));
+    if (table->entries == NULL) {
+        abort();
+    }
+    table->mask = capacity - 1;
+}
+
+// Returns false if `address` is already present. `address` is not copied.
+static inline bool osc_table_insert(
+    OscTable * const table,
+    const char * const address,
+    const int index
+) {
+    size_t i = osc_hash(address) & table->mask;
+    for (; table->entries[i].address; i = (i + 1) & table->mask) {
+        if (strcmp(table->entries[i].address, address) == 0) {
+            return false;
+        }
+    }
+    table->entries[i].address = address;
+    table->entries[i].index = index;
+    return true;
+}
+
+// Returns -1 if `address` is not present.
+static inline int osc_table_find(
+    const OscTable * const table,
+    const char * const address
+) {
+    size_t i = osc_hash(address) & table->mask;
+    for (; table->entries[i].address; i = (i + 1) & table->mask) {
+        if (strcmp(table->entries[i].address, address) == 0) {
+            return table->entries[i].index;
+        }
+    }
+    return -1;
+}
+
+// Ancillary data of a received packet: room for its SO_TIMESTAMPNS receive
+// time.
+typedef union OscControl {
+    unsigned char buf[CMSG_SPACE(sizeof(struct timespec))];
+    // struct cmsghdr is aligned like its first member, a size_t.
+    size_t align;
+} OscControl;
+
+typedef struct OscReceiver {
+    int fd;
+    struct mmsghdr msgs[OSC_BATCH];
+    struct iovec iovs[OSC_BATCH];
+    OscControl controls[OSC_BATCH];
+    unsigned char bufs[OSC_BATCH][OSC_PACKET_MAX];
+    // When the kernel received the packet being handled (CLOCK_REALTIME),
+    // or zero if unknown.
+    struct timespec stamp;
+} OscReceiver;
+
+// Asks the kernel to timestamp packets received on `fd` as they arrive,
+// rather than leaving receivers to guess from when they were read.
+static inline void osc_enable_timestamps(const int fd) {
+    const int one = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) != 0) {
+        perror("warning: could not enable receive timestamps");
+    }
+}
+
+// Finds the receive time in the ancillary data of `msg`. Sets `stamp` to
+// zero if there is none.
+static inline void osc_receive_time(
+    const struct msghdr * const msg,
+    struct timespec * const stamp
+) {
+    *stamp = (struct timespec){0};
+    for (
+        const struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+        cmsg != NULL;
+        cmsg = CMSG_NXTHDR((struct msghdr *)msg, (struct cmsghdr *)cmsg)
+    ) {
+        if (
+            cmsg->cmsg_level == SOL_SOCKET &&
+            cmsg->cmsg_type == SCM_TIMESTAMPNS
+        ) {
+            memcpy(stamp, CMSG_DATA(cmsg), sizeof(*stamp));
+            return;
+        }
+    }
+}
+
+// Splits "[host:]port" into its parts. `host` is set to NULL if omitted.
+static inline bool osc_split_spec(
+    char * const spec,
+    const char ** const host,
+    const char ** const port
+) {
+    char * const colon = strrchr(spec, ':');
+    *host = NULL;
+    *port = spec;
+    if (colon != NULL) {
+        *colon = '\0';
+        *port = colon + 1;
+        *host = spec;
+        if (spec[0] == '[' && colon > spec && colon[-1] == ']') {
+            colon[-1] = '\0';
+            *host = spec + 1;
+        }
+    }
+    return **port != '\0';
+}
+
+// Opens a non-blocking UDP socket bound to `spec` ("[host:]port"). Returns
+// false on failure.
+static inline bool osc_receiver_open(
+    OscReceiver * const receiver,
+    const char * const spec
+) {
+    char buf[256];
+    if (strlen(spec) >= sizeof(buf)) {
+        fputs("UDP address too long\n", stderr);
+        return false;
+    }
+    strcpy(buf, spec);
+    const char *host;
+    const char *port;
+    if (!osc_split_spec(buf, &host, &port)) {
+        fprintf(stderr, "bad UDP address: %s\n", spec);
+        return false;
+    }
+
+    const struct addrinfo hints = {
+        .ai_flags = AI_PASSIVE,
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_DGRAM,
+    };
+    struct addrinfo *info = NULL;
+    const int gai_status = getaddrinfo(host, port, &hints, &info);
+    if (gai_status != 0) {
+        fprintf(
+            stderr,
+            "getaddrinfo(%s) failed: %s\n",
+            spec,
+            gai_strerror(gai_status)
+        );
+        return false;
+    }
+    int fd = -1;
+    for (const struct addrinfo *ai = info; ai; ai = ai->ai_next) {
+        fd = socket(
+            ai->ai_family,
+            ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+            ai->ai_protocol
+        );
+        if (fd == -1) {
+            continue;
+        }
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(info);
+    if (fd == -1) {
+        fprintf(stderr, "could not bind UDP socket to %s", spec);
+        perror("");
+        return false;
+    }
+
+    receiver->fd = fd;
+    osc_enable_timestamps(fd);
+    for (size_t i = 0; i < OSC_BATCH; ++i) {
+        receiver->iovs[i] = (struct iovec){
+            .iov_base = receiver->bufs[i],
+            .iov_len = sizeof(receiver->bufs[i]),
+        };
+        receiver->msgs[i] = (struct mmsghdr){
+            .msg_hdr = {
+                .msg_iov = &receiver->iovs[i],
+                .msg_iovlen = 1,
+                .msg_control = receiver->controls[i].buf,
+                .msg_controllen = sizeof(receiver->controls[i].buf),
+            },
+        };
+    }
+    return true;
+}
+
+// Receives and dispatches all pending packets, up to OSC_BATCH per syscall.
+// `packet_handler` may be NULL. Returns false on an unexpected socket error.
+static inline bool osc_receive(
+    OscReceiver * const receiver,
+    const OscHandler handler,
+    const OscPacketHandler packet_handler,
+    void * const ctx
+) {
+    while (true) {
+        const int n = recvmmsg(
+            receiver->fd,
+            receiver->msgs,
+            OSC_BATCH,
+            MSG_DONTWAIT,
+            NULL
+        );
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("recvmmsg() failed");
+            return false;
+        }
+        for (int i = 0; i < n; ++i) {
+            struct mmsghdr * const msg = &receiver->msgs[i];
+            const size_t len = msg->msg_len;
+            osc_receive_time(&msg->msg_hdr, &receiver->stamp);
+            if (msg->msg_hdr.msg_flags & MSG_TRUNC) {
+                fputs("OSC packet too large; dropped\n", stderr);
+            } else if (!osc_parse_packet(
+                receiver->bufs[i],
+                len,
+                handler,
+                ctx
+            )) {
+                fputs("malformed OSC packet\n", stderr);
+            }
+            if (packet_handler != NULL) {
+                packet_handler(ctx);
+            }
+            msg->msg_hdr.msg_flags = 0;
+            msg->msg_hdr.msg_controllen = sizeof(receiver->controls[i].buf);
+        }
+        if (n < OSC_BATCH) {
+            return true;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2025 taylor.fish <contact@taylor.fish>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Static tracepoints (USDT) for bpftrace, perf and SystemTap, under the
+// provider "jacl". For example:
+//
+//   bpftrace -e 'usdt:./jacl-stdio2midi:jacl:queue_pop { @ = hist(arg2); }'
+//
+// An unattached probe costs a nop, plus whatever computing its arguments
+// does, so these should be values already at hand: integers or pointers.
+// The probes are compiled in when <sys/sdt.h> is available (e.g., from
+// `systemtap-sdt-dev`) and JACL_NO_PROBES isn't defined.
+#ifndef JACL_PROBES_H
+#define JACL_PROBES_H
+
+#if !defined(JACL_NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define JACL_PROBES 1
+#endif
+#endif
+
+#ifdef JACL_PROBES
+#define PROBE0(name) DTRACE_PROBE(jacl, name)
+#define PROBE1(name, a) DTRACE_PROBE1(jacl, name, a)
+#define PROBE2(name, a, b) DTRACE_PROBE2(jacl, name, a, b)
+#define PROBE3(name, a, b, c) DTRACE_PROBE3(jacl, name, a, b, c)
+#else
+// Still mention the arguments, so they don't become unused.
+#define PROBE0(name) ((void)0)
+#define PROBE1(name, a) ((void)sizeof(a))
+#define PROBE2(name, a, b) ((void)sizeof(a), (void)sizeof(b))
+#define PROBE3(name, a, b, c) \
+    ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c))
+#endif
+
+#endif
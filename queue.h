@@ -0,0 +1,358 @@
+/*
+ * Copyright (C) 2025 taylor.fish <contact@taylor.fish>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Lock-free queues between the process thread and the others.
+//
+// SpscRing is a bounded ring of fixed-size elements with one producer and
+// one consumer. SpscSlab holds variable-length data for such a ring's
+// elements, allocated and freed in the same order. MpscQueue is an
+// unbounded, intrusive linked list with any number of producers and one
+// consumer; it never frees nodes itself.
+//
+// In all of them, the fields written by the producers and those written by
+// the consumer are on separate cache lines, so neither side's stores evict
+// the line the other is polling. The rings' producer and consumer also each
+// keep a private copy of the other's index and only reload it when that
+// copy says the ring is full (or empty), so most operations touch no shared
+// line at all.
+//
+// jacl-stdio2midi queues messages with an SpscRing and an SpscSlab, and
+// jacl-looper, jacl-meter and jacl-cv2stdio hand data to or from their
+// process threads with SpscRings. No tool has more than one producer for a
+// queue at the moment; MpscQueue is for when one does, and tests/queue.c
+// keeps it working meanwhile. jacl-midi2stdio's ring is read by every sink
+// at its own pace, and jacl-cv swaps whole scenes, so neither is a queue.
+#ifndef JACL_QUEUE_H
+#define JACL_QUEUE_H
+
+#include "probes.h"
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define QUEUE_CACHE_LINE 64
+
+typedef struct SpscRing {
+    // Constant after spsc_init().
+    unsigned char *data;
+    size_t elem_size;
+    size_t mask;
+
+    // Producer only, apart from `tail`.
+    alignas(QUEUE_CACHE_LINE) atomic_size_t tail;
+    size_t cached_head;
+
+    // Consumer only, apart from `head`.
+    alignas(QUEUE_CACHE_LINE) atomic_size_t head;
+    size_t cached_tail;
+} SpscRing;
+
+// Holds at least `capacity` elements of `elem_size` bytes. The memory is
+// locked if possible, since the process thread can't take page faults.
+static inline void spsc_init(
+    SpscRing * const ring,
+    const size_t elem_size,
+    const size_t capacity
+) {
+    size_t size = 1;
+    while (size < capacity) {
+        size *= 2;
+    }
+    ring->data = calloc(size, elem_size);
+    if (ring->data == NULL) {
+        abort();
+    }
+    if (mlock(ring->data, size * elem_size) != 0) {
+        // Not fatal; the ring just may be paged out.
+    }
+    ring->elem_size = elem_size;
+    ring->mask = size - 1;
+    atomic_init(&ring->tail, 0);
+    ring->cached_head = 0;
+    atomic_init(&ring->head, 0);
+    ring->cached_tail = 0;
+}
+
+// Copies `count` elements between `elems` and the ring, starting at ring
+// index `index` and wrapping around the end.
+static inline void spsc_copy_in(
+    SpscRing * const ring,
+    const size_t index,
+    const unsigned char * const elems,
+    const size_t count
+) {
+    const size_t start = index & ring->mask;
+    const size_t first = ring->mask + 1 - start < count ?
+        ring->mask + 1 - start : count;
+    memcpy(
+        ring->data + start * ring->elem_size,
+        elems,
+        first * ring->elem_size
+    );
+    memcpy(
+        ring->data,
+        elems + first * ring->elem_size,
+        (count - first) * ring->elem_size
+    );
+}
+
+static inline void spsc_copy_out(
+    const SpscRing * const ring,
+    const size_t index,
+    unsigned char * const elems,
+    const size_t count
+) {
+    const size_t start = index & ring->mask;
+    const size_t first = ring->mask + 1 - start < count ?
+        ring->mask + 1 - start : count;
+    memcpy(
+        elems,
+        ring->data + start * ring->elem_size,
+        first * ring->elem_size
+    );
+    memcpy(
+        elems + first * ring->elem_size,
+        ring->data,
+        (count - first) * ring->elem_size
+    );
+}
+
+// Producer: pushes as many of the `count` elements as fit, and returns how
+// many that was.
+static inline size_t spsc_push(
+    SpscRing * const ring,
+    const void * const elems,
+    const size_t count
+) {
+    const size_t tail =
+        atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    const size_t capacity = ring->mask + 1;
+    size_t room = capacity - (tail - ring->cached_head);
+    if (room < count) {
+        ring->cached_head =
+            atomic_load_explicit(&ring->head, memory_order_acquire);
+        room = capacity - (tail - ring->cached_head);
+    }
+    const size_t n = room < count ? room : count;
+    PROBE3(queue_push, ring, count, n);
+    if (n == 0) {
+        return 0;
+    }
+    spsc_copy_in(ring, tail, elems, n);
+    atomic_store_explicit(&ring->tail, tail + n, memory_order_release);
+    return n;
+}
+
+// Consumer: pops up to `max` elements into `elems`, and returns how many
+// there were.
+static inline size_t spsc_pop(
+    SpscRing * const ring,
+    void * const elems,
+    const size_t max
+) {
+    const size_t head =
+        atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t avail = ring->cached_tail - head;
+    if (avail < max) {
+        ring->cached_tail =
+            atomic_load_explicit(&ring->tail, memory_order_acquire);
+        avail = ring->cached_tail - head;
+    }
+    const size_t n = avail < max ? avail : max;
+    PROBE3(queue_pop, ring, max, n);
+    if (n == 0) {
+        return 0;
+    }
+    spsc_copy_out(ring, head, elems, n);
+    atomic_store_explicit(&ring->head, head + n, memory_order_release);
+    return n;
+}
+
+// Allocations are contiguous and identified by their offset, which counts
+// bytes from 0 and wraps at 2^32. The producer fills an allocation before
+// pushing the element that refers to it, so the ring's ordering covers the
+// data too.
+typedef struct SpscSlab {
+    // Constant after spsc_slab_init().
+    unsigned char *data;
+    uint32_t mask;
+
+    // Producer only.
+    uint32_t tail;
+    uint32_t cached_head;
+
+    // The end of the last allocation the consumer is done with.
+    alignas(QUEUE_CACHE_LINE) _Atomic uint32_t head;
+} SpscSlab;
+
+// `size` must be a power of two.
+static inline void spsc_slab_init(SpscSlab * const slab, const uint32_t size) {
+    slab->data = calloc(size, 1);
+    if (slab->data == NULL) {
+        abort();
+    }
+    if (mlock(slab->data, size) != 0) {
+        // Not fatal; the slab just may be paged out.
+    }
+    slab->mask = size - 1;
+    slab->tail = 0;
+    slab->cached_head = 0;
+    atomic_init(&slab->head, 0);
+}
+
+// Producer: finds room for `length` contiguous bytes, or returns NULL if
+// there is none. The space is only taken by spsc_slab_commit().
+static inline unsigned char *spsc_slab_reserve(
+    SpscSlab * const slab,
+    const size_t length,
+    uint32_t * const offset
+) {
+    const uint32_t size = slab->mask + 1;
+    if (length > size) {
+        return NULL;
+    }
+    uint32_t start = slab->tail;
+    if ((start & slab->mask) + length > size) {
+        // Skip the rest of the slab rather than split the allocation.
+        start += size - (start & slab->mask);
+    }
+    const uint32_t end = start + (uint32_t)length;
+    if (end - slab->cached_head > size) {
+        slab->cached_head =
+            atomic_load_explicit(&slab->head, memory_order_acquire);
+        if (end - slab->cached_head > size) {
+            return NULL;
+        }
+    }
+    *offset = start;
+    return slab->data + (start & slab->mask);
+}
+
+static inline void spsc_slab_commit(
+    SpscSlab * const slab,
+    const uint32_t offset,
+    const size_t length
+) {
+    slab->tail = offset + (uint32_t)length;
+}
+
+static inline const unsigned char *spsc_slab_at(
+    const SpscSlab * const slab,
+    const uint32_t offset
+) {
+    return slab->data + (offset & slab->mask);
+}
+
+// Consumer: frees every allocation up to and including the one at
+// `offset`.
+static inline void spsc_slab_release(
+    SpscSlab * const slab,
+    const uint32_t offset,
+    const size_t length
+) {
+    atomic_store_explicit(
+        &slab->head,
+        offset + (uint32_t)length,
+        memory_order_release
+    );
+}
+
+typedef struct MpscNode {
+    struct MpscNode * _Atomic next;
+} MpscNode;
+
+typedef struct MpscQueue {
+    // Producers: the last node pushed.
+    alignas(QUEUE_CACHE_LINE) MpscNode * _Atomic tail;
+
+    // Consumer only: the last node popped, initially the stub.
+    alignas(QUEUE_CACHE_LINE) MpscNode *cursor;
+    // The last node the consumer is done with, as published by
+    // mpsc_release(). It and later nodes are still in use; earlier ones
+    // can be freed.
+    MpscNode * _Atomic released;
+} MpscQueue;
+
+// `stub` is a node that carries no data. Like every node, it ends up
+// before `released` and must be freed by the owner.
+static inline void mpsc_init(MpscQueue * const queue, MpscNode * const stub) {
+    atomic_init(&stub->next, NULL);
+    atomic_init(&queue->tail, stub);
+    queue->cursor = stub;
+    atomic_init(&queue->released, stub);
+}
+
+// Producers: pushes the nodes from `first` to `last`, already linked
+// through their `next` fields, with one atomic operation.
+static inline void mpsc_push_batch(
+    MpscQueue * const queue,
+    MpscNode * const first,
+    MpscNode * const last
+) {
+    atomic_store_explicit(&last->next, NULL, memory_order_relaxed);
+    MpscNode * const prev =
+        atomic_exchange_explicit(&queue->tail, last, memory_order_acq_rel);
+    // Until this store, the consumer sees the queue end at `prev`; it picks
+    // up the batch on a later pop.
+    atomic_store_explicit(&prev->next, first, memory_order_release);
+}
+
+static inline void mpsc_push(MpscQueue * const queue, MpscNode * const node) {
+    mpsc_push_batch(queue, node, node);
+}
+
+// Consumer: pops up to `max` nodes into `nodes`, and returns how many there
+// were. They stay valid until mpsc_release() is called.
+static inline size_t mpsc_pop(
+    MpscQueue * const queue,
+    MpscNode ** const nodes,
+    const size_t max
+) {
+    size_t n = 0;
+    MpscNode *node = queue->cursor;
+    while (n < max) {
+        MpscNode * const next =
+            atomic_load_explicit(&node->next, memory_order_acquire);
+        if (next == NULL) {
+            break;
+        }
+        nodes[n++] = node = next;
+    }
+    queue->cursor = node;
+    return n;
+}
+
+// Consumer: lets the nodes popped so far, except the last, be freed.
+static inline void mpsc_release(MpscQueue * const queue) {
+    atomic_store_explicit(
+        &queue->released,
+        queue->cursor,
+        memory_order_release
+    );
+}
+
+// Whoever frees nodes: the first node still in use. Every node pushed
+// before it can be freed.
+static inline MpscNode *mpsc_released(MpscQueue * const queue) {
+    return atomic_load_explicit(&queue->released, memory_order_acquire);
+}
+
+#endif
@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2025 taylor.fish <contact@taylor.fish>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Surviving JACK server restarts. Requires _GNU_SOURCE (for pipe2()).
+//
+// JACK's shutdown and port-connect callbacks only write a byte to a pipe,
+// which the main thread polls. On a connection change, the main thread
+// records the names of every port connected to ours, since they can't be
+// asked for once the server is gone. On shutdown, it closes the client and
+// keeps trying to open a new one (between handling its other input, which
+// stays alive), then re-registers its ports and restores the connections
+// by name.
+#ifndef JACL_RECONNECT_H
+#define JACL_RECONNECT_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <jack/jack.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// How often (in milliseconds) to try to reopen the client while the server
+// is down.
+#define RECONNECT_INTERVAL 250
+
+typedef struct Reconnect {
+    const char *name;
+    // Written by JACK's callbacks: 's' on shutdown, 'c' when a connection
+    // changes.
+    int notify_read;
+    int notify_write;
+    // Main thread only. For each port, the names of the ports connected to
+    // it, as returned by jack_port_get_connections().
+    size_t nports;
+    const char ***peers;
+    bool down;
+    struct timespec down_since;
+    struct timespec last_attempt;
+    unsigned long restarts;
+} Reconnect;
+
+static inline bool reconnect_init(
+    Reconnect * const rc,
+    const char * const name,
+    const size_t nports
+) {
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) != 0) {
+        perror("pipe2() failed");
+        return false;
+    }
+    *rc = (Reconnect){
+        .name = name,
+        .notify_read = fds[0],
+        .notify_write = fds[1],
+        .nports = nports,
+        .peers = calloc(nports > 0 ? nports : 1, sizeof(*rc->peers)),
+    };
+    if (rc->peers == NULL) {
+        abort();
+    }
+    return true;
+}
+
+static inline void reconnect_notify(const Reconnect * const rc, char c) {
+    const int saved_errno = errno;
+    if (write(rc->notify_write, &c, 1) < 0) {
+        // A notification is already pending.
+    }
+    errno = saved_errno;
+}
+
+static inline void reconnect_handle_shutdown(
+    const jack_status_t code,
+    const char * const reason,
+    void * const arg
+) {
+    (void)code;
+    (void)reason;
+    reconnect_notify(arg, 's');
+}
+
+static inline void reconnect_handle_connect(
+    const jack_port_id_t a,
+    const jack_port_id_t b,
+    const int connect,
+    void * const arg
+) {
+    (void)a;
+    (void)b;
+    (void)connect;
+    reconnect_notify(arg, 'c');
+}
+
+// Registers the callbacks; call before jack_activate().
+static inline bool reconnect_watch(
+    Reconnect * const rc,
+    jack_client_t * const client
+) {
+    jack_on_info_shutdown(client, reconnect_handle_shutdown, rc);
+    const int status = jack_set_port_connect_callback(
+        client,
+        reconnect_handle_connect,
+        rc
+    );
+    if (status != 0) {
+        fprintf(
+            stderr,
+            "jack_set_port_connect_callback() failed: %d\n",
+            status
+        );
+        return false;
+    }
+    return true;
+}
+
+// Records the current connections of `ports` (rc->nports of them; NULL
+// entries are skipped).
+static inline void reconnect_save(
+    Reconnect * const rc,
+    jack_port_t * const * const ports
+) {
+    for (size_t i = 0; i < rc->nports; ++i) {
+        if (rc->peers[i] != NULL) {
+            jack_free(rc->peers[i]);
+        }
+        rc->peers[i] =
+            ports[i] == NULL ? NULL : jack_port_get_connections(ports[i]);
+    }
+}
+
+// Reads pending notifications. Returns true if the server shut down, in
+// which case the caller should close its client. Otherwise, saves the
+// connections of `ports` if they changed.
+static inline bool reconnect_read(
+    Reconnect * const rc,
+    jack_port_t * const * const ports
+) {
+    bool shutdown = false;
+    bool changed = false;
+    char buf[64];
+    ssize_t n;
+    while ((n = read(rc->notify_read, buf, sizeof(buf))) > 0) {
+        for (ssize_t i = 0; i < n; ++i) {
+            shutdown |= buf[i] == 's';
+            changed |= buf[i] == 'c';
+        }
+    }
+    if (shutdown && !rc->down) {
+        fputs("JACK server shut down; reconnecting\n", stderr);
+        rc->down = true;
+        clock_gettime(CLOCK_MONOTONIC, &rc->down_since);
+        rc->last_attempt = rc->down_since;
+        return true;
+    }
+    if (changed && !rc->down) {
+        reconnect_save(rc, ports);
+    }
+    return false;
+}
+
+static inline long reconnect_elapsed_ms(const struct timespec * const since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000 +
+        (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+// How long poll() may wait before the next attempt to reopen the client,
+// or -1 if the server is up.
+static inline int reconnect_timeout(const Reconnect * const rc) {
+    if (!rc->down) {
+        return -1;
+    }
+    const long left =
+        RECONNECT_INTERVAL - reconnect_elapsed_ms(&rc->last_attempt);
+    return left > 0 ? (int)left : 0;
+}
+
+// Tries to reopen the client if it's time to. Returns NULL if the server
+// isn't back yet.
+static inline jack_client_t *reconnect_try(Reconnect * const rc) {
+    if (reconnect_timeout(rc) != 0) {
+        return NULL;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &rc->last_attempt);
+    jack_status_t status = 0;
+    return jack_client_open(rc->name, JackNoStartServer, &status);
+}
+
+static inline int reconnect_combine_timeouts(const int a, const int b) {
+    if (a < 0) {
+        return b;
+    }
+    return b < 0 || a < b ? a : b;
+}
+
+// Restores the saved connections of `ports` on the new, activated client,
+// and reports how long recovery took.
+static inline void reconnect_restore(
+    Reconnect * const rc,
+    jack_client_t * const client,
+    jack_port_t * const * const ports
+) {
+    size_t total = 0;
+    size_t restored = 0;
+    for (size_t i = 0; i < rc->nports; ++i) {
+        const char * const * const peers = rc->peers[i];
+        if (ports[i] == NULL || peers == NULL) {
+            continue;
+        }
+        const char * const name = jack_port_name(ports[i]);
+        const bool input = jack_port_flags(ports[i]) & JackPortIsInput;
+        for (size_t j = 0; peers[j] != NULL; ++j) {
+            ++total;
+            const int status = input ?
+                jack_connect(client, peers[j], name) :
+                jack_connect(client, name, peers[j]);
+            if (status == 0 || status == EEXIST) {
+                ++restored;
+            }
+        }
+    }
+    rc->down = false;
+    ++rc->restarts;
+    fprintf(
+        stderr,
+        "reconnected to JACK after %.3f s; restored %zu of %zu connections "
+        "(%lu restarts in total)\n",
+        reconnect_elapsed_ms(&rc->down_since) / 1000.0,
+        restored,
+        total,
+        rc->restarts
+    );
+    reconnect_save(rc, ports);
+}
+
+#endif
@@ -14,13 +14,22 @@
  * You should have received a copy of the GNU General Public License
  * along with this program. If not, see <https://www.gnu.org/licenses/>.
  */
-#define _POSIX_C_SOURCE 1
-#include <assert.h>
+#define _GNU_SOURCE
+#include "autoconnect.h"
+#include "frame.h"
+#include "osc.h"
+#include "probes.h"
+#include "queue.h"
+#include "reconnect.h"
+#include "transform.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <jack/jack.h>
 #include <jack/metadata.h>
 #include <jack/midiport.h>
+#include <net/if.h>
+#include <netdb.h>
+#include <netinet/in.h>
 #include <poll.h>
 #include <signal.h>
 #include <stdatomic.h>
@@ -28,13 +37,30 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
 
+// Buckets of the arrival histograms: under 1 us, then powers of two up to
+// about 2 seconds.
+#define JITTER_BUCKETS 22
+#define MAX_MULTICAST 4
+// How long (in milliseconds) to wait for a batch that is missing from every
+// multicast path before giving up on it.
+#define REORDER_TIMEOUT 20
+// Capacity of the message queue, in messages, and of the buffer for longer
+// messages (such as sysex), in bytes.
+#define QUEUE_SLOTS 65536
+#define SLAB_SIZE (1 << 20)
+
 static int sigfd_write;
+static int statsfd_write = -1;
+// False in standby, until SIGUSR1.
+static atomic_bool active = true;
 
 static const char *USAGE = "\
-Usage: %s [client-name]\n\
+Usage: %s [options] [client-name]\n\
 \n\
 Converts hexadecimal MIDI messages read from standard input into JACK MIDI\n\
 output. Each line should contain exactly one MIDI message in hexadecimal\n\
@@ -42,7 +68,40 @@ format without any spaces.\n\
 \n\
 [client-name] is the name of the JACK client to create; if not provided, the\n\
 default is 'stdio2midi'.\n\
-";
+\n\
+Options:\n\
+  -u, --udp <[host:]port>\n\
+                      Also accept OSC messages on this UDP address. Messages\n\
+                      sent to /midi are converted to MIDI: a blob argument\n\
+                      is sent as one raw MIDI message, each MIDI ('m')\n\
+                      argument is sent as its own message, and a list of int\n\
+                      arguments is sent as one message of those bytes.\n\
+  -a, --address <address>\n\
+                      Also accept MIDI on this OSC address. Addresses are\n\
+                      matched exactly; patterns are not supported.\n\
+  -f, --framed        Read binary frames from standard input, as written\n\
+                      by jacl-midi2stdio's ',framed' and ',compress'\n\
+                      sinks, instead of lines of hex.\n\
+  -m, --multicast <group>:<port>[,if=<interface>]\n\
+                      Also join this UDP multicast group and accept MIDI\n\
+                      sent to it by jacl-midi2stdio's multicast sinks.\n\
+                      Lost datagrams are recovered from the redundant\n\
+                      copies in later ones where possible; others are\n\
+                      reported on standard error. May be given up to four\n\
+                      times, e.g., for the same group on two interfaces\n\
+                      fed by a ',backup-if' sink: each message is then\n\
+                      sent once, in order, from whichever path delivers it\n\
+                      first.\n\
+  -w, --standby       Start in standby: set up everything and read input\n\
+                      as usual, but discard it instead of sending it until\n\
+                      SIGUSR1 is received. Output then starts within a\n\
+                      period, for fast failover.\n\
+" AUTOCONNECT_USAGE "\
+\n\
+On SIGUSR2, statistics about packets received over the network are written\n\
+to standard error: how long they waited between arriving (as timestamped by\n\
+the kernel) and being handled, and, for multicast, the network jitter.\n\
+" TRANSFORM_USAGE;
 
 static void usage(FILE * const stream, const char * const arg0) {
     const char *bin = arg0 ? arg0 : "";
@@ -59,16 +118,30 @@ static void usage(FILE * const stream, const char * const arg0) {
     fprintf(stream, USAGE, bin);
 }
 
-static void on_exit(const int signum) {
+static void handle_exit_signal(const int signum) {
     (void)signum;
     close(sigfd_write);
 }
 
-static bool install_exit_handler(const int signum) {
+static void handle_stats_signal(const int signum) {
+    (void)signum;
+    const int saved_errno = errno;
+    if (write(statsfd_write, "", 1) < 0) {
+        // Statistics are already pending.
+    }
+    errno = saved_errno;
+}
+
+static void handle_activate_signal(const int signum) {
+    (void)signum;
+    atomic_store_explicit(&active, true, memory_order_relaxed);
+}
+
+static bool install_handler(const int signum, void (* const handler)(int)) {
     sigset_t mask;
     sigemptyset(&mask);
     const struct sigaction act = {
-        .sa_handler = on_exit,
+        .sa_handler = handler,
         .sa_mask = mask,
         .sa_flags = 0,
     };
@@ -98,91 +171,192 @@ static bool set_nonblock(const int fd) {
     return true;
 }
 
-typedef struct Node {
-    struct Node * _Atomic next;
-    size_t length;
-    unsigned char message[];
-} Node;
+// Matches option `shortopt` or `longopt` at `argv[*argi]`, accepting both
+// "--long value" and "--long=value". On a match, `*value` is set to the
+// option's argument (NULL if missing) and `*argi` is advanced past it.
+static bool match_option(
+    const int argc,
+    char ** const argv,
+    int * const argi,
+    const char * const shortopt,
+    const char * const longopt,
+    const char ** const value
+) {
+    const char * const arg = argv[*argi];
+    const size_t longlen = strlen(longopt);
+    if (strncmp(arg, longopt, longlen) == 0 && arg[longlen] == '=') {
+        *value = arg + longlen + 1;
+        return true;
+    }
+    if (strcmp(arg, shortopt) != 0 && strcmp(arg, longopt) != 0) {
+        return false;
+    }
+    *value = *argi + 1 < argc ? argv[++*argi] : NULL;
+    return true;
+}
+
+// One queued message. Messages of up to four bytes, which is every channel
+// message, are stored inline, so process() reads them in one linear pass;
+// longer ones are in the slab.
+typedef struct Slot {
+    uint32_t length;
+    union {
+        unsigned char bytes[4];
+        uint32_t offset;
+    };
+} Slot;
+
+// Arrival statistics for network input, from kernel receive timestamps.
+typedef struct Jitter {
+    // Time between a packet's arrival and its handling, which is our own
+    // scheduling delay, in buckets of microseconds.
+    unsigned long delay[JITTER_BUCKETS];
+    // Differences in transit time between consecutive multicast datagrams
+    // (the network's contribution), in buckets of microseconds.
+    unsigned long transit[JITTER_BUCKETS];
+    unsigned long packets;
+    // Packets the kernel didn't timestamp.
+    unsigned long untimed;
+    bool have_transit;
+    uint32_t last_transit;
+    // Interarrival jitter as estimated in RFC 3550, in microseconds.
+    double estimate;
+} Jitter;
 
 typedef struct State {
     jack_client_t *client;
     jack_port_t *port;
-    Node *malloc_head;
-    Node * _Atomic head;
-    Node * _Atomic tail;
+    SpscRing slots;
+    SpscSlab slab;
+    OscTable osc_table;
+    Transform transform;
+    bool transforming;
+    // Multicast and standard input, respectively. All multicast groups
+    // share a receiver, so that paths carrying the same stream dedupe each
+    // other.
+    FrameReceiver frames;
+    FrameReceiver stream_frames;
+    // Whether `frames` is holding batches for a gap, and since when.
+    bool holding;
+    struct timespec hold_since;
+    const OscReceiver *osc_receiver;
+    Jitter jitter;
+    Reconnect reconnect;
+    AutoConnect *autoconnect;
 } State;
 
-static Node *node_new(const size_t length, unsigned char * const message) {
-    Node * const node = malloc(sizeof(Node) + length);
-    if (node == NULL) {
-        abort();
+// Main thread only.
+static void push_message(
+    State * const state,
+    const unsigned char * const message,
+    const size_t length
+) {
+    PROBE2(event_decode, message, length);
+    Slot slot = {
+        .length = (uint32_t)length,
+    };
+    unsigned char *bytes = slot.bytes;
+    if (length > sizeof(slot.bytes)) {
+        bytes = spsc_slab_reserve(&state->slab, length, &slot.offset);
+        if (bytes == NULL) {
+            PROBE2(message_drop, message, length);
+            fputs("message buffer full; dropping message\n", stderr);
+            return;
+        }
     }
-    atomic_init(&node->next, NULL);
-    node->length = length;
-    if (message != NULL) {
-        memcpy(node->message, message, length);
+    memcpy(bytes, message, length);
+    if (
+        state->transforming &&
+        !transform_apply(&state->transform, bytes, length)
+    ) {
+        return;
     }
-    return node;
-}
-
-static Node *node_blank(void) {
-    return node_new(0, NULL);
-}
-
-static void push_back(State * const state, Node * const node) {
-    assert(atomic_load_explicit(&node->next, memory_order_acquire) == NULL);
-    Node * const old =
-        atomic_exchange_explicit(&state->tail, node, memory_order_acq_rel);
-    assert(old);
-    atomic_store_explicit(&old->next, node, memory_order_release);
-}
-
-static void free_excess(State * const state) {
-    Node * const head =
-        atomic_load_explicit(&state->head, memory_order_acquire);
-    Node *node = state->malloc_head;
-    state->malloc_head = head;
-    while (node != head) {
-        assert(node);
-        Node * const next =
-            atomic_load_explicit(&node->next, memory_order_relaxed);
-        free(node);
-        node = next;
+    if (length > sizeof(slot.bytes)) {
+        spsc_slab_commit(&state->slab, slot.offset, length);
+    }
+    if (spsc_push(&state->slots, &slot, 1) == 0) {
+        PROBE2(message_drop, message, length);
+        fputs("message queue full; dropping message\n", stderr);
     }
 }
 
 static int close_and_fail(jack_client_t * const client) {
-    jack_client_close(client);
+    // The client is NULL while we wait for the JACK server to come back.
+    if (client != NULL) {
+        jack_client_close(client);
+    }
     return EXIT_FAILURE;
 }
 
 static int process(const jack_nframes_t nframes, void * const arg) {
-    const State * const state = arg;
+    PROBE1(process_entry, nframes);
+    State * const state = arg;
     jack_port_t * const port = state->port;
     if (port == NULL) {
+        PROBE2(process_return, nframes, 0);
         return 0;
     }
 
     void * const buffer = jack_port_get_buffer(port, nframes);
     if (buffer == NULL) {
+        PROBE2(process_return, nframes, -1);
         return -1;
     }
 
     jack_midi_clear_buffer(buffer);
-    Node *node = atomic_load_explicit(&state->head, memory_order_relaxed);
-    while (true) {
-        Node * const next =
-            atomic_load_explicit(&node->next, memory_order_relaxed);
-        if (next == NULL) {
-            break;
+    // In standby, messages are consumed but not sent.
+    const bool sending = atomic_load_explicit(&active, memory_order_relaxed);
+    Slot batch[64];
+    size_t n;
+    do {
+        n = spsc_pop(&state->slots, batch, sizeof(batch) / sizeof(*batch));
+        for (size_t i = 0; i < n; ++i) {
+            const Slot * const slot = &batch[i];
+            if (slot->length <= sizeof(slot->bytes)) {
+                if (sending) {
+                    jack_midi_event_write(
+                        buffer,
+                        0,
+                        slot->bytes,
+                        slot->length
+                    );
+                }
+                continue;
+            }
+            if (sending) {
+                jack_midi_event_write(
+                    buffer,
+                    0,
+                    spsc_slab_at(&state->slab, slot->offset),
+                    slot->length
+                );
+            }
+            spsc_slab_release(&state->slab, slot->offset, slot->length);
         }
-        node = next;
-        jack_midi_event_write(buffer, 0, node->message, node->length);
-    }
-    atomic_store_explicit(&state->head, node, memory_order_release);
+    } while (n == sizeof(batch) / sizeof(*batch));
+    PROBE2(process_return, nframes, 0);
     return 0;
 }
 
+// Publishes our own capture latency: messages are written at the start of
+// the first period after they arrive, so they wait up to a period. There is
+// nothing to schedule against the playback latency, since messages carry no
+// timestamps and are sent as soon as possible.
+static void handle_latency(
+    const jack_latency_callback_mode_t mode,
+    void * const arg
+) {
+    const State * const state = arg;
+    if (state->port == NULL || mode != JackCaptureLatency) {
+        return;
+    }
+    jack_latency_range_t range = {
+        .min = 0,
+        .max = jack_get_buffer_size(state->client),
+    };
+    jack_port_set_latency_range(state->port, mode, &range);
+}
+
 static int hex_to_int(const char c) {
     if (c >= '0' && c <= '9') {
         return c - '0';
@@ -201,41 +375,618 @@ static void handle_line(
     const char * const line,
     const size_t len
 ) {
-    free_excess(state);
     if (len & 1) {
+        PROBE3(parse_error, line, len, len);
         fputs("bad message length\n", stderr);
         return;
     }
-    Node * const node = node_new(len / 2, NULL);
+    unsigned char message[512];
+    if (len / 2 > sizeof(message)) {
+        PROBE3(parse_error, line, len, len);
+        fputs("message too long\n", stderr);
+        return;
+    }
     for (size_t i = 0; i < len; ++i) {
         const char c = line[i];
         int value = hex_to_int(c);
         if (value == -1) {
+            PROBE3(parse_error, line, len, i);
             fprintf(stderr, "invalid hex digit: %c (0x%x)\n", c, c);
             return;
         }
         if (i % 2 == 0) {
-            node->message[i / 2] = value << 4;
+            message[i / 2] = value << 4;
         } else {
-            node->message[i / 2] |= value;
+            message[i / 2] |= value;
+        }
+    }
+    push_message(state, message, len / 2);
+}
+
+// Returns the length of a channel or system message with the given status
+// byte, or 0 if the length is not fixed or `status` is a data byte.
+static size_t midi_message_length(const unsigned char status) {
+    if (status < 0x80) {
+        return 0;
+    }
+    switch (status >> 4) {
+        case 0x8:
+        case 0x9:
+        case 0xa:
+        case 0xb:
+        case 0xe:
+            return 3;
+        case 0xc:
+        case 0xd:
+            return 2;
+        default:
+            break;
+    }
+    switch (status) {
+        case 0xf1:
+        case 0xf3:
+            return 2;
+        case 0xf2:
+            return 3;
+        case 0xf0:
+        case 0xf7:
+            return 0;
+        default:
+            return 1;
+    }
+}
+
+static void handle_osc(void * const ctx, const OscMessage * const message) {
+    State * const state = ctx;
+    if (osc_table_find(&state->osc_table, message->address) < 0) {
+        fprintf(stderr, "unknown OSC address: %s\n", message->address);
+        return;
+    }
+    unsigned char bytes[OSC_PACKET_MAX];
+    size_t nbytes = 0;
+    OscMessage args = *message;
+    OscArg arg;
+    while (osc_next_arg(&args, &arg)) {
+        switch (arg.type) {
+            case 'b':
+                if (arg.b.size > 0) {
+                    push_message(state, arg.b.data, arg.b.size);
+                }
+                break;
+            case 'm': {
+                // Port ID, status byte, data1, data2
+                const size_t length = midi_message_length(arg.m[1]);
+                if (length == 0) {
+                    fputs("bad status byte in OSC MIDI argument\n", stderr);
+                    break;
+                }
+                push_message(state, arg.m + 1, length);
+                break;
+            }
+            case 'i':
+                if (arg.i < 0 || arg.i > 0xff) {
+                    fprintf(stderr, "bad MIDI byte: %ld\n", (long)arg.i);
+                    return;
+                }
+                if (nbytes < sizeof(bytes)) {
+                    bytes[nbytes++] = (unsigned char)arg.i;
+                }
+                break;
+            default:
+                fprintf(stderr, "unsupported OSC type tag: %c\n", arg.type);
+                return;
         }
     }
-    push_back(state, node);
+    if (nbytes > 0) {
+        push_message(state, bytes, nbytes);
+    }
+}
+
+static unsigned jitter_bucket(const int64_t us) {
+    unsigned bucket = 0;
+    for (int64_t n = us; n > 0 && bucket + 1 < JITTER_BUCKETS; n >>= 1) {
+        ++bucket;
+    }
+    return bucket;
+}
+
+static uint32_t timespec_us(const struct timespec * const ts) {
+    return (uint32_t)ts->tv_sec * 1000000 + (uint32_t)(ts->tv_nsec / 1000);
+}
+
+// Records the arrival of a packet received by the kernel at `stamp` (zero
+// if unknown). `sent` is its send time in microseconds, or NULL if it has
+// none.
+static void record_arrival(
+    Jitter * const jitter,
+    const struct timespec * const stamp,
+    const uint32_t * const sent
+) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    ++jitter->packets;
+    struct timespec arrival = *stamp;
+    if (stamp->tv_sec == 0 && stamp->tv_nsec == 0) {
+        ++jitter->untimed;
+        arrival = now;
+    } else {
+        const int64_t delay = (int64_t)(now.tv_sec - stamp->tv_sec) *
+            1000000 + (now.tv_nsec - stamp->tv_nsec) / 1000;
+        ++jitter->delay[jitter_bucket(delay)];
+    }
+    if (sent == NULL) {
+        return;
+    }
+    // The clocks' offset cancels out in the difference.
+    const uint32_t transit = timespec_us(&arrival) - *sent;
+    if (jitter->have_transit) {
+        const int32_t diff = (int32_t)(transit - jitter->last_transit);
+        const int64_t magnitude = diff < 0 ? -(int64_t)diff : diff;
+        ++jitter->transit[jitter_bucket(magnitude)];
+        jitter->estimate += (magnitude - jitter->estimate) / 16;
+    }
+    jitter->have_transit = true;
+    jitter->last_transit = transit;
+}
+
+static void print_histogram(
+    const char * const title,
+    const unsigned long * const buckets
+) {
+    unsigned long total = 0;
+    for (unsigned i = 0; i < JITTER_BUCKETS; ++i) {
+        total += buckets[i];
+    }
+    if (total == 0) {
+        return;
+    }
+    fprintf(stderr, "%s:\n", title);
+    for (unsigned i = 0; i < JITTER_BUCKETS; ++i) {
+        if (buckets[i] == 0) {
+            continue;
+        }
+        char range[32] = "< 1";
+        if (i > 0) {
+            snprintf(
+                range,
+                sizeof(range),
+                "%lu-%lu",
+                1ul << (i - 1),
+                (1ul << i) - 1
+            );
+        }
+        fprintf(
+            stderr,
+            "  %15s us: %lu (%.1f%%)\n",
+            range,
+            buckets[i],
+            100.0 * buckets[i] / total
+        );
+    }
+}
+
+static void print_jitter(const State * const state) {
+    const Jitter * const jitter = &state->jitter;
+    fprintf(
+        stderr,
+        "%lu packets received, %lu without kernel timestamps\n",
+        jitter->packets,
+        jitter->untimed
+    );
+    print_histogram("scheduling delay (arrival to handling)", jitter->delay);
+    print_histogram(
+        "network jitter (transit time variation)",
+        jitter->transit
+    );
+    if (jitter->have_transit) {
+        fprintf(
+            stderr,
+            "network jitter estimate (RFC 3550): %.0f us\n",
+            jitter->estimate
+        );
+    }
+    if (state->frames.synced) {
+        fprintf(
+            stderr,
+            "multicast batches lost: %lu, recovered: %lu; "
+            "corrupt datagrams: %lu\n",
+            state->frames.lost,
+            state->frames.recovered,
+            state->frames.corrupt
+        );
+    }
+}
+
+static void handle_osc_packet(void * const ctx) {
+    State * const state = ctx;
+    record_arrival(&state->jitter, &state->osc_receiver->stamp, NULL);
+}
+
+// Joins the multicast group in `spec` ("<group>:<port>[,if=<interface>]").
+// Returns the socket, or -1 on error.
+static int open_multicast(const char * const spec) {
+    char buf[256];
+    if (strlen(spec) >= sizeof(buf)) {
+        fputs("multicast address too long\n", stderr);
+        return -1;
+    }
+    strcpy(buf, spec);
+    unsigned ifindex = 0;
+    char * const comma = strchr(buf, ',');
+    if (comma != NULL) {
+        *comma = '\0';
+        if (strncmp(comma + 1, "if=", 3) != 0) {
+            fprintf(stderr, "bad multicast option: %s\n", comma + 1);
+            return -1;
+        }
+        ifindex = if_nametoindex(comma + 4);
+        if (ifindex == 0) {
+            fprintf(stderr, "unknown interface: %s\n", comma + 4);
+            return -1;
+        }
+    }
+    char * const colon = strrchr(buf, ':');
+    if (colon == NULL) {
+        fprintf(stderr, "bad multicast address: %s\n", spec);
+        return -1;
+    }
+    *colon = '\0';
+
+    const struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_DGRAM,
+    };
+    struct addrinfo *info = NULL;
+    const int gai_status = getaddrinfo(buf, colon + 1, &hints, &info);
+    if (gai_status != 0) {
+        fprintf(
+            stderr,
+            "getaddrinfo(%s) failed: %s\n",
+            spec,
+            gai_strerror(gai_status)
+        );
+        return -1;
+    }
+    const int fd = socket(
+        info->ai_family,
+        info->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC,
+        info->ai_protocol
+    );
+    if (fd == -1) {
+        perror("socket() failed");
+        freeaddrinfo(info);
+        return -1;
+    }
+    // Several receivers on one host may join the same group.
+    const int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    osc_enable_timestamps(fd);
+    // Binding to the group's address filters out other traffic to the port.
+    int status = bind(fd, info->ai_addr, info->ai_addrlen);
+    if (status == 0 && info->ai_family == AF_INET6) {
+        const struct sockaddr_in6 * const addr = (void *)info->ai_addr;
+        const struct ipv6_mreq mreq = {
+            .ipv6mr_multiaddr = addr->sin6_addr,
+            .ipv6mr_interface = ifindex,
+        };
+        status = setsockopt(
+            fd,
+            IPPROTO_IPV6,
+            IPV6_JOIN_GROUP,
+            &mreq,
+            sizeof(mreq)
+        );
+    } else if (status == 0) {
+        const struct sockaddr_in * const addr = (void *)info->ai_addr;
+        const struct ip_mreqn mreq = {
+            .imr_multiaddr = addr->sin_addr,
+            .imr_ifindex = (int)ifindex,
+        };
+        status = setsockopt(
+            fd,
+            IPPROTO_IP,
+            IP_ADD_MEMBERSHIP,
+            &mreq,
+            sizeof(mreq)
+        );
+    }
+    freeaddrinfo(info);
+    if (status != 0) {
+        fprintf(stderr, "could not join multicast group %s", spec);
+        perror("");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void handle_frame_message(
+    void * const ctx,
+    const unsigned char * const message,
+    const size_t len
+) {
+    push_message(ctx, message, len);
+}
+
+// Frames read from a byte stream, each preceded by its length.
+typedef struct FrameInput {
+    unsigned char buf[2 + FRAME_MAX];
+    size_t len;
+} FrameInput;
+
+// Handles `n` bytes of framed input. Returns false if the stream is
+// corrupt.
+static bool handle_framed_input(
+    State * const state,
+    FrameInput * const input,
+    const unsigned char *data,
+    size_t n
+) {
+    while (n > 0) {
+        size_t needed = 2;
+        if (input->len >= 2) {
+            needed += (size_t)input->buf[0] << 8 | input->buf[1];
+            if (needed > sizeof(input->buf) || needed < 2 + FRAME_HEADER) {
+                fputs("bad frame length in input\n", stderr);
+                return false;
+            }
+        }
+        const size_t take =
+            needed - input->len < n ? needed - input->len : n;
+        memcpy(input->buf + input->len, data, take);
+        input->len += take;
+        data += take;
+        n -= take;
+        if (input->len < needed || needed == 2) {
+            continue;
+        }
+        FrameReceiver * const frames = &state->stream_frames;
+        const unsigned long corrupt = frames->corrupt;
+        if (!frame_receive(
+            frames,
+            input->buf + 2,
+            input->len - 2,
+            handle_frame_message,
+            state
+        )) {
+            fprintf(
+                stderr,
+                "%s frame in input dropped\n",
+                frames->corrupt != corrupt ? "corrupt" : "malformed"
+            );
+        }
+        input->len = 0;
+    }
+    return true;
+}
+
+// Receives all pending multicast datagrams. Returns false on an unexpected
+// socket error.
+static bool receive_multicast(State * const state, const int fd) {
+    FrameReceiver * const frames = &state->frames;
+    unsigned char buf[FRAME_MAX];
+    OscControl control;
+    while (true) {
+        struct iovec iov = {
+            .iov_base = buf,
+            .iov_len = sizeof(buf),
+        };
+        struct msghdr msg = {
+            .msg_iov = &iov,
+            .msg_iovlen = 1,
+            .msg_control = control.buf,
+            .msg_controllen = sizeof(control.buf),
+        };
+        const ssize_t len = recvmsg(fd, &msg, 0);
+        if (len < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                return true;
+            }
+            perror("recvmsg() failed");
+            return false;
+        }
+        struct timespec stamp;
+        osc_receive_time(&msg, &stamp);
+        const unsigned long lost = frames->lost;
+        const unsigned long corrupt = frames->corrupt;
+        if (!frame_receive(frames, buf, len, handle_frame_message, state)) {
+            fprintf(
+                stderr,
+                "%s multicast datagram dropped (%lu corrupt in total)\n",
+                frames->corrupt != corrupt ? "corrupt" : "malformed",
+                frames->corrupt
+            );
+            continue;
+        }
+        record_arrival(&state->jitter, &stamp, &frames->sent);
+        if (frames->lost != lost) {
+            fprintf(
+                stderr,
+                "multicast: lost %lu batches (%lu in total, %lu recovered)\n",
+                frames->lost - lost,
+                frames->lost,
+                frames->recovered
+            );
+        }
+    }
+}
+
+// Gives up on gaps in the multicast stream that have been waited for long
+// enough. Returns how long poll() may wait before the next one is due, or
+// -1 for no limit.
+static int flush_frames(State * const state) {
+    FrameReceiver * const frames = &state->frames;
+    if (!frame_pending(frames)) {
+        state->holding = false;
+        return -1;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if (!state->holding) {
+        state->holding = true;
+        state->hold_since = now;
+    }
+    const long waited = (now.tv_sec - state->hold_since.tv_sec) * 1000 +
+        (now.tv_nsec - state->hold_since.tv_nsec) / 1000000;
+    if (waited < REORDER_TIMEOUT) {
+        return (int)(REORDER_TIMEOUT - waited);
+    }
+    const unsigned long lost = frames->lost;
+    frame_flush(frames, handle_frame_message, state);
+    fprintf(
+        stderr,
+        "multicast: lost %lu batches (%lu in total, %lu recovered)\n",
+        frames->lost - lost,
+        frames->lost,
+        frames->recovered
+    );
+    // The next gap, if any, gets a full wait of its own.
+    state->hold_since = now;
+    return frame_pending(frames) ? REORDER_TIMEOUT : -1;
+}
+
+// Sets up a newly opened client: callbacks, ports and activation. Used at
+// startup and again after the server restarts.
+static bool start_client(State * const state, jack_client_t * const client) {
+    state->client = client;
+    state->port = NULL;
+    const int spc_status = jack_set_process_callback(client, process, state);
+    if (spc_status != 0) {
+        fprintf(
+            stderr,
+            "jack_set_process_callback() failed: %d\n",
+            spc_status
+        );
+        return false;
+    }
+
+    const int slc_status =
+        jack_set_latency_callback(client, handle_latency, state);
+    if (slc_status != 0) {
+        fprintf(
+            stderr,
+            "jack_set_latency_callback() failed: %d\n",
+            slc_status
+        );
+        return false;
+    }
+    if (
+        !reconnect_watch(&state->reconnect, client) ||
+        !autoconnect_watch(state->autoconnect, client)
+    ) {
+        return false;
+    }
+
+    jack_port_t * const port = jack_port_register(
+        client,
+        "out",
+        JACK_DEFAULT_MIDI_TYPE,
+        JackPortIsOutput,
+        0
+    );
+    if (port == NULL) {
+        fputs("jack_port_register() failed\n", stderr);
+        return false;
+    }
+    state->port = port;
+
+    const int astatus = jack_activate(client);
+    if (astatus != 0) {
+        fprintf(stderr, "jack_activate() failed: %d\n", astatus);
+        return false;
+    }
+    return true;
 }
 
 int main(const int argc, char ** const argv) {
+    const char *udp = NULL;
+    const char *multicasts[MAX_MULTICAST];
+    size_t nmulticast = 0;
+    bool framed = false;
+    const char *addresses[16] = {"/midi"};
+    size_t naddresses = 1;
+    static Transform transform;
+    transform_init(&transform);
+    bool transforming = false;
+    static AutoConnect autoconnect;
+    crc32c_init();
+
     int argi = 1;
-    if (argc > argi) {
-        if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+    for (; argi < argc; ++argi) {
+        const char * const arg = argv[argi];
+        const char *value = NULL;
+        if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
             usage(stdout, argv[0]);
             return EXIT_SUCCESS;
         }
-        if (strcmp(argv[1], "--version") == 0) {
+        if (strcmp(arg, "--version") == 0) {
             puts("0.1");
             return EXIT_SUCCESS;
         }
-        if (strcmp(argv[1], "--") == 0) {
+        if (strcmp(arg, "--") == 0) {
             ++argi;
+            break;
+        }
+        if (arg[0] != '-' || arg[1] == '\0') {
+            break;
+        }
+        if (match_option(argc, argv, &argi, "-u", "--udp", &value)) {
+            if (value == NULL) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+            udp = value;
+        } else if (
+            match_option(argc, argv, &argi, "-a", "--address", &value)
+        ) {
+            const size_t max = sizeof(addresses) / sizeof(*addresses);
+            if (value == NULL || value[0] != '/' || naddresses >= max) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+            addresses[naddresses++] = value;
+        } else if (strcmp(arg, "-f") == 0 || strcmp(arg, "--framed") == 0) {
+            framed = true;
+        } else if (
+            strcmp(arg, "-w") == 0 || strcmp(arg, "--standby") == 0
+        ) {
+            atomic_store_explicit(&active, false, memory_order_relaxed);
+        } else if (
+            match_option(argc, argv, &argi, "-m", "--multicast", &value)
+        ) {
+            if (value == NULL || nmulticast >= MAX_MULTICAST) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+            multicasts[nmulticast++] = value;
+        } else if (
+            match_option(argc, argv, &argi, "-t", "--transform", &value)
+        ) {
+            if (value == NULL) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+            if (!transform_add_rule(&transform, value)) {
+                return EXIT_FAILURE;
+            }
+            transforming = true;
+        } else if (
+            match_option(argc, argv, &argi, "-C", "--connect", &value)
+        ) {
+            if (value == NULL) {
+                usage(stderr, argv[0]);
+                return EXIT_FAILURE;
+            }
+            if (!autoconnect_add_rule(&autoconnect, value)) {
+                return EXIT_FAILURE;
+            }
+        } else {
+            fprintf(stderr, "unknown option: %s\n", arg);
+            usage(stderr, argv[0]);
+            return EXIT_FAILURE;
         }
     }
     if (argc - argi > 1) {
@@ -252,10 +1003,24 @@ int main(const int argc, char ** const argv) {
 
     static const int signals[] = {SIGHUP, SIGINT, SIGQUIT, SIGTERM};
     for (size_t i = 0; i < sizeof(signals) / sizeof(*signals); ++i) {
-        if (!install_exit_handler(signals[i])) {
+        if (!install_handler(signals[i], handle_exit_signal)) {
             return EXIT_FAILURE;
         }
     }
+    int statsfds[2];
+    if (pipe2(statsfds, O_CLOEXEC) != 0) {
+        perror("pipe2() failed");
+        return EXIT_FAILURE;
+    }
+    statsfd_write = statsfds[1];
+    if (
+        !set_nonblock(statsfds[0]) ||
+        !set_nonblock(statsfd_write) ||
+        !install_handler(SIGUSR2, handle_stats_signal) ||
+        !install_handler(SIGUSR1, handle_activate_signal)
+    ) {
+        return EXIT_FAILURE;
+    }
 
     const char * const name = argc > argi ? argv[argi] : "stdio2midi";
     jack_status_t status = 0;
@@ -266,40 +1031,45 @@ int main(const int argc, char ** const argv) {
         return EXIT_FAILURE;
     }
 
-    Node * const blank = node_blank();
     State state = {
         .client = client,
         .port = NULL,
-        .malloc_head = blank,
-        .head = blank,
-        .tail = blank,
+        .transform = transform,
+        .transforming = transforming,
     };
-    const int spc_status = jack_set_process_callback(client, process, &state);
-    if (spc_status != 0) {
-        fprintf(
-            stderr,
-            "jack_set_process_callback() failed: %d\n",
-            spc_status
-        );
-        return close_and_fail(client);
+    spsc_init(&state.slots, sizeof(Slot), QUEUE_SLOTS);
+    spsc_slab_init(&state.slab, SLAB_SIZE);
+    static OscReceiver receiver = {
+        .fd = -1,
+    };
+    state.osc_receiver = &receiver;
+    state.autoconnect = &autoconnect;
+    if (udp != NULL) {
+        osc_table_init(&state.osc_table, naddresses);
+        for (size_t i = 0; i < naddresses; ++i) {
+            osc_table_insert(&state.osc_table, addresses[i], 0);
+        }
+        if (!osc_receiver_open(&receiver, udp)) {
+            return close_and_fail(client);
+        }
     }
+    int multicast_fds[MAX_MULTICAST];
+    for (size_t i = 0; i < nmulticast; ++i) {
+        multicast_fds[i] = open_multicast(multicasts[i]);
+        if (multicast_fds[i] == -1) {
+            return close_and_fail(client);
+        }
+    }
+    // With a single path, nothing arrives out of order, so a gap is a loss.
+    state.frames.reorder = nmulticast > 1;
 
-    jack_port_t * const port = jack_port_register(
-        client,
-        "out",
-        JACK_DEFAULT_MIDI_TYPE,
-        JackPortIsOutput,
-        0
-    );
-    if (port == NULL) {
-        fputs("jack_port_register() failed\n", stderr);
+    if (
+        !reconnect_init(&state.reconnect, name, 1) ||
+        !autoconnect_init(&autoconnect)
+    ) {
         return close_and_fail(client);
     }
-    state.port = port;
-
-    const int astatus = jack_activate(client);
-    if (astatus != 0) {
-        fprintf(stderr, "jack_activate() failed: %d\n", astatus);
+    if (!start_client(&state, client)) {
         return close_and_fail(client);
     }
 
@@ -307,7 +1077,8 @@ int main(const int argc, char ** const argv) {
     if (!set_nonblock(sigfd_read) || !set_nonblock(STDIN_FILENO)) {
         return close_and_fail(client);
     }
-    struct pollfd pollfds[] = {
+    // Multicast sockets follow the fixed entries.
+    struct pollfd pollfds[6 + MAX_MULTICAST] = {
         {
             .fd = sigfd_read,
             .events = 0,
@@ -316,30 +1087,93 @@ int main(const int argc, char ** const argv) {
             .fd = STDIN_FILENO,
             .events = POLLIN,
         },
+        {
+            .fd = receiver.fd,
+            .events = POLLIN,
+        },
+        {
+            .fd = statsfds[0],
+            .events = POLLIN,
+        },
+        {
+            .fd = state.reconnect.notify_read,
+            .events = POLLIN,
+        },
+        {
+            .fd = autoconnect.notify_read,
+            .events = POLLIN,
+        },
     };
+    const size_t npollfds = 6 + nmulticast;
+    for (size_t i = 0; i < nmulticast; ++i) {
+        pollfds[6 + i] = (struct pollfd){
+            .fd = multicast_fds[i],
+            .events = POLLIN,
+        };
+    }
 
     char line[1024];
+    static FrameInput frame_input;
     size_t linelen = 0;
     while (true) {
-        const int status =
-            poll(pollfds, sizeof(pollfds) / sizeof(*pollfds), -1);
+        // Input keeps being queued while the server is down; it's sent once
+        // the client is back.
+        if (state.client == NULL) {
+            jack_client_t * const next = reconnect_try(&state.reconnect);
+            if (next == NULL) {
+            } else if (start_client(&state, next)) {
+                reconnect_restore(&state.reconnect, next, &state.port);
+            } else {
+                jack_client_close(next);
+                state.client = NULL;
+                state.port = NULL;
+            }
+        }
+        autoconnect_apply(&autoconnect, state.client, &state.port, 1);
+        const int status = poll(
+            pollfds,
+            npollfds,
+            reconnect_combine_timeouts(
+                reconnect_combine_timeouts(
+                    flush_frames(&state),
+                    reconnect_timeout(&state.reconnect)
+                ),
+                autoconnect_timeout(&autoconnect)
+            )
+        );
         if (status > 0) {
         } else if (status == 0 || errno == EINTR) {
             continue;
         } else {
             perror("poll() failed");
-            return close_and_fail(client);
+            return close_and_fail(state.client);
         }
-        for (size_t i = 0; i < sizeof(pollfds) / sizeof(*pollfds); ++i) {
+        for (size_t i = 0; i < npollfds; ++i) {
             if (pollfds[i].revents & POLLNVAL) {
                 fprintf(stderr, "unexpected POLLNVAL on #%zu\n", i);
-                return close_and_fail(client);
+                return close_and_fail(state.client);
             }
         }
         if (pollfds[0].revents) {
             break;
         }
-        if (pollfds[1].revents & POLLIN) {
+        if (framed && pollfds[1].revents & POLLIN) {
+            unsigned char buf[4096];
+            while (true) {
+                const ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
+                if (n < 0) {
+                    break;
+                }
+                if (
+                    n == 0 ||
+                    !handle_framed_input(&state, &frame_input, buf, n)
+                ) {
+                    close(STDIN_FILENO);
+                    pollfds[1].fd = -1;
+                    break;
+                }
+            }
+        } else if (pollfds[1].revents & POLLIN) {
             char buf[64];
             while (true) {
                 const ssize_t n = read(STDIN_FILENO, buf, sizeof(buf));
@@ -371,9 +1205,42 @@ int main(const int argc, char ** const argv) {
         } else if (pollfds[1].revents) {
             pollfds[1].fd = -1;
         }
+        if (pollfds[2].revents & POLLIN) {
+            if (
+                !osc_receive(&receiver, handle_osc, handle_osc_packet, &state)
+            ) {
+                return close_and_fail(state.client);
+            }
+        }
+        for (size_t i = 0; i < nmulticast; ++i) {
+            if (
+                pollfds[6 + i].revents & POLLIN &&
+                !receive_multicast(&state, multicast_fds[i])
+            ) {
+                return close_and_fail(state.client);
+            }
+        }
+        if (pollfds[3].revents & POLLIN) {
+            char buf[16];
+            while (read(statsfds[0], buf, sizeof(buf)) > 0) {}
+            print_jitter(&state);
+        }
+        if (
+            pollfds[4].revents & POLLIN &&
+            reconnect_read(&state.reconnect, &state.port)
+        ) {
+            jack_client_close(state.client);
+            state.client = NULL;
+            state.port = NULL;
+        }
+        if (pollfds[5].revents & POLLIN) {
+            autoconnect_read(&autoconnect);
+        }
     }
 
-    jack_client_close(client);
+    if (state.client != NULL) {
+        jack_client_close(state.client);
+    }
     const int tty = open("/dev/tty", O_WRONLY);
     if (tty != -1) {
         while (write(tty, "\n", 1) == -1 && errno == EINTR) {}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2025 taylor.fish <contact@taylor.fish>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Tests for expr.h. Run with `make check`.
+#include "../expr.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Not assert(), which `make` disables with NDEBUG.
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+
+#define RATE 48000
+// About 35 minutes at RATE.
+#define LATE_FRAME 100000000
+
+static unsigned long failures;
+
+static void check(
+    const bool ok,
+    const char * const cond,
+    const char * const file,
+    const int line
+) {
+    if (!ok) {
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, cond);
+        ++failures;
+    }
+}
+
+// `t` is the only input.
+static int resolve_t(
+    void * const ctx,
+    const char * const name,
+    const size_t len
+) {
+    (void)ctx;
+    return len == 1 && name[0] == 't' ? 0 : -1;
+}
+
+static void eval_at(
+    const char * const text,
+    const uint64_t frame,
+    float * const out
+) {
+    static Expr expr;
+    static ExprStack stack;
+    static double t[EXPR_BLOCK];
+    CHECK(expr_compile(&expr, text, resolve_t, NULL));
+    expr_fill_ramp(t, EXPR_BLOCK, (double)frame / RATE, 1.0 / RATE);
+    const double * const blocks[] = {t};
+    expr_eval(&expr, blocks, NULL, &stack, out, EXPR_BLOCK);
+}
+
+// Long after activation, t still advances by one frame per sample.
+static void test_late_time_steps(void) {
+    double t[EXPR_BLOCK];
+    expr_fill_ramp(t, EXPR_BLOCK, (double)LATE_FRAME / RATE, 1.0 / RATE);
+    double worst = 0;
+    for (size_t i = 1; i < EXPR_BLOCK; ++i) {
+        const double error = fabs((t[i] - t[i - 1]) * RATE - 1);
+        worst = error > worst ? error : worst;
+    }
+    // Within 1e-6 of a frame.
+    CHECK(worst < 1e-6);
+
+    // Blocks join up without a gap.
+    double next[EXPR_BLOCK];
+    expr_fill_ramp(
+        next,
+        EXPR_BLOCK,
+        (double)(LATE_FRAME + EXPR_BLOCK) / RATE,
+        1.0 / RATE
+    );
+    CHECK(fabs((next[0] - t[EXPR_BLOCK - 1]) * RATE - 1) < 1e-6);
+}
+
+// An audio-rate oscillator is as clean late as it is early.
+static void test_late_sine(void) {
+    float out[EXPR_BLOCK];
+    eval_at("sin(2*pi*440*t)", LATE_FRAME, out);
+    double worst = 0;
+    for (size_t i = 0; i < EXPR_BLOCK; ++i) {
+        const double t = (double)(LATE_FRAME + i) / RATE;
+        const double expected = sin(2 * 3.14159265358979 * 440 * t);
+        const double error = fabs(out[i] - expected);
+        worst = error > worst ? error : worst;
+    }
+    CHECK(worst < 1e-5);
+}
+
+static void test_functions(void) {
+    float out[EXPR_BLOCK];
+    eval_at("saw(0.25) + sqr(0.75) + tri(0.5) + clamp(2, 0, 1)", 0, out);
+    CHECK(out[0] == -0.5f - 1 + 1 + 1);
+    eval_at("mix(1, 3, 0.5) * (2 ^ 3) % 5", 0, out);
+    CHECK(out[0] == 1);
+    eval_at("t >= 1", RATE - 1, out);
+    CHECK(out[0] == 0 && out[1] == 1);
+}
+
+int main(void) {
+    test_late_time_steps();
+    test_late_sine();
+    test_functions();
+    if (failures > 0) {
+        fprintf(stderr, "%lu checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    puts("expr: all tests passed");
+    return EXIT_SUCCESS;
+}
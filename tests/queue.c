@@ -0,0 +1,366 @@
+/*
+ * Copyright (C) 2025 taylor.fish <contact@taylor.fish>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Tests for queue.h. Run with `make check`.
+#include "../queue.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Not assert(), which `make` disables with NDEBUG.
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+
+#define THREADED_COUNT 1000000
+
+static unsigned long failures;
+
+static void check(
+    const bool ok,
+    const char * const cond,
+    const char * const file,
+    const int line
+) {
+    if (!ok) {
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, cond);
+        ++failures;
+    }
+}
+
+static void test_ring_capacity(void) {
+    SpscRing ring;
+    spsc_init(&ring, sizeof(uint32_t), 5);
+    CHECK(ring.mask + 1 == 8);
+    free(ring.data);
+}
+
+static void test_ring_full_batch(void) {
+    SpscRing ring;
+    spsc_init(&ring, sizeof(uint32_t), 8);
+    uint32_t in[10];
+    for (uint32_t i = 0; i < 10; ++i) {
+        in[i] = i;
+    }
+    // Exactly the capacity fits; nothing more.
+    CHECK(spsc_push(&ring, in, 8) == 8);
+    CHECK(spsc_push(&ring, in + 8, 1) == 0);
+    uint32_t out[10] = {0};
+    CHECK(spsc_pop(&ring, out, 8) == 8);
+    for (uint32_t i = 0; i < 8; ++i) {
+        CHECK(out[i] == i);
+    }
+    CHECK(spsc_pop(&ring, out, 8) == 0);
+
+    // More than the capacity pushes only what fits.
+    CHECK(spsc_push(&ring, in, 10) == 8);
+    CHECK(spsc_pop(&ring, out, 10) == 8);
+    for (uint32_t i = 0; i < 8; ++i) {
+        CHECK(out[i] == i);
+    }
+    free(ring.data);
+}
+
+static void test_ring_wraparound(void) {
+    SpscRing ring;
+    spsc_init(&ring, sizeof(uint32_t), 8);
+    // Start near the end of the index space, so the indices themselves wrap
+    // as well as their positions in the ring.
+    const size_t start = SIZE_MAX - 20;
+    atomic_store(&ring.tail, start);
+    atomic_store(&ring.head, start);
+    ring.cached_head = start;
+    ring.cached_tail = start;
+
+    uint32_t next_in = 0;
+    uint32_t next_out = 0;
+    for (size_t round = 0; round < 100; ++round) {
+        // Batches of every size up to the capacity, at every offset.
+        const size_t count = round % 8 + 1;
+        uint32_t in[8];
+        for (size_t i = 0; i < count; ++i) {
+            in[i] = next_in + (uint32_t)i;
+        }
+        const size_t pushed = spsc_push(&ring, in, count);
+        next_in += (uint32_t)pushed;
+        uint32_t out[8];
+        const size_t popped = spsc_pop(&ring, out, round % 5 + 1);
+        for (size_t i = 0; i < popped; ++i) {
+            CHECK(out[i] == next_out);
+            ++next_out;
+        }
+    }
+    uint32_t out[8];
+    size_t popped;
+    while ((popped = spsc_pop(&ring, out, 8)) > 0) {
+        for (size_t i = 0; i < popped; ++i) {
+            CHECK(out[i] == next_out);
+            ++next_out;
+        }
+    }
+    CHECK(next_out == next_in);
+    CHECK(atomic_load(&ring.tail) < start);
+    free(ring.data);
+}
+
+static void test_slab_skip(void) {
+    SpscSlab slab;
+    spsc_slab_init(&slab, 64);
+    uint32_t a;
+    uint32_t b;
+    CHECK(spsc_slab_reserve(&slab, 65, &a) == NULL);
+    CHECK(spsc_slab_reserve(&slab, 40, &a) == slab.data);
+    CHECK(a == 0);
+    spsc_slab_commit(&slab, a, 40);
+
+    // 30 bytes don't fit after the first allocation, and skipping to the
+    // start would overlap it.
+    CHECK(spsc_slab_reserve(&slab, 30, &b) == NULL);
+    spsc_slab_release(&slab, a, 40);
+    CHECK(spsc_slab_reserve(&slab, 30, &b) == slab.data);
+    CHECK(b == 64);
+    CHECK(spsc_slab_at(&slab, b) == slab.data);
+    spsc_slab_commit(&slab, b, 30);
+    spsc_slab_release(&slab, b, 30);
+
+    // A reservation isn't taken until it's committed.
+    CHECK(spsc_slab_reserve(&slab, 34, &a) == slab.data + 30);
+    CHECK(spsc_slab_reserve(&slab, 34, &a) == slab.data + 30);
+    free(slab.data);
+}
+
+static void test_slab_whole(void) {
+    SpscSlab slab;
+    spsc_slab_init(&slab, 64);
+    uint32_t offset;
+    CHECK(spsc_slab_reserve(&slab, 64, &offset) == slab.data);
+    spsc_slab_commit(&slab, offset, 64);
+    CHECK(spsc_slab_reserve(&slab, 1, &offset) == NULL);
+    spsc_slab_release(&slab, offset, 64);
+    CHECK(spsc_slab_reserve(&slab, 64, &offset) == slab.data);
+    CHECK(offset == 64);
+    free(slab.data);
+}
+
+static void test_slab_wraparound(void) {
+    SpscSlab slab;
+    spsc_slab_init(&slab, 64);
+    // Offsets wrap at 2^32.
+    const uint32_t start = UINT32_MAX - 15;
+    slab.tail = start;
+    slab.cached_head = start;
+    atomic_store(&slab.head, start);
+    uint32_t a;
+    uint32_t b;
+    CHECK(spsc_slab_reserve(&slab, 10, &a) == slab.data + 48);
+    CHECK(a == start);
+    spsc_slab_commit(&slab, a, 10);
+    CHECK(spsc_slab_reserve(&slab, 10, &b) == slab.data);
+    CHECK(b == 0);
+    spsc_slab_commit(&slab, b, 10);
+    spsc_slab_release(&slab, a, 10);
+    spsc_slab_release(&slab, b, 10);
+    CHECK(spsc_slab_reserve(&slab, 54, &a) == slab.data + 10);
+    free(slab.data);
+}
+
+typedef struct SlabEntry {
+    uint32_t offset;
+    uint32_t length;
+    uint32_t seq;
+} SlabEntry;
+
+typedef struct SlabPair {
+    SpscRing ring;
+    SpscSlab slab;
+} SlabPair;
+
+static void *slab_producer(void * const arg) {
+    SlabPair * const pair = arg;
+    for (uint32_t seq = 0; seq < THREADED_COUNT; ++seq) {
+        SlabEntry entry = {
+            .length = seq % 97 + 1,
+            .seq = seq,
+        };
+        unsigned char *data;
+        while (
+            (data = spsc_slab_reserve(
+                &pair->slab,
+                entry.length,
+                &entry.offset
+            )) == NULL
+        ) {
+            sched_yield();
+        }
+        memset(data, (unsigned char)seq, entry.length);
+        spsc_slab_commit(&pair->slab, entry.offset, entry.length);
+        while (spsc_push(&pair->ring, &entry, 1) == 0) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+// One thread fills the slab while this one checks and frees it.
+static void test_slab_threaded(void) {
+    SlabPair pair;
+    spsc_init(&pair.ring, sizeof(SlabEntry), 64);
+    spsc_slab_init(&pair.slab, 1024);
+    pthread_t thread;
+    pthread_create(&thread, NULL, slab_producer, &pair);
+    uint32_t next = 0;
+    while (next < THREADED_COUNT) {
+        SlabEntry entries[16];
+        const size_t n = spsc_pop(&pair.ring, entries, 16);
+        if (n == 0) {
+            sched_yield();
+        }
+        for (size_t i = 0; i < n; ++i) {
+            const SlabEntry * const entry = &entries[i];
+            CHECK(entry->seq == next);
+            CHECK(entry->length == next % 97 + 1);
+            const unsigned char * const data =
+                spsc_slab_at(&pair.slab, entry->offset);
+            bool intact = true;
+            for (uint32_t k = 0; k < entry->length; ++k) {
+                intact &= data[k] == (unsigned char)next;
+            }
+            CHECK(intact);
+            spsc_slab_release(&pair.slab, entry->offset, entry->length);
+            ++next;
+        }
+    }
+    pthread_join(thread, NULL);
+    free(pair.ring.data);
+    free(pair.slab.data);
+}
+
+typedef struct TestNode {
+    MpscNode node;
+    uint32_t producer;
+    uint32_t seq;
+} TestNode;
+
+static void test_mpsc_batch(void) {
+    MpscQueue queue;
+    TestNode stub = {0};
+    TestNode nodes[3];
+    mpsc_init(&queue, &stub.node);
+    MpscNode *popped[4];
+    CHECK(mpsc_pop(&queue, popped, 4) == 0);
+    for (uint32_t i = 0; i < 3; ++i) {
+        nodes[i].seq = i;
+        if (i > 0) {
+            atomic_store(&nodes[i - 1].node.next, &nodes[i].node);
+        }
+    }
+    mpsc_push_batch(&queue, &nodes[0].node, &nodes[2].node);
+    CHECK(mpsc_pop(&queue, popped, 2) == 2);
+    CHECK(popped[0] == &nodes[0].node);
+    CHECK(popped[1] == &nodes[1].node);
+    CHECK(mpsc_released(&queue) == &stub.node);
+    mpsc_release(&queue);
+    CHECK(mpsc_released(&queue) == &nodes[1].node);
+    CHECK(mpsc_pop(&queue, popped, 4) == 1);
+    CHECK(popped[0] == &nodes[2].node);
+    CHECK(mpsc_pop(&queue, popped, 4) == 0);
+}
+
+#define MPSC_PRODUCERS 4
+
+typedef struct MpscProducer {
+    MpscQueue *queue;
+    TestNode *nodes;
+    uint32_t index;
+} MpscProducer;
+
+static void *mpsc_producer(void * const arg) {
+    const MpscProducer * const producer = arg;
+    for (uint32_t seq = 0; seq < THREADED_COUNT / MPSC_PRODUCERS; ++seq) {
+        TestNode * const node = &producer->nodes[seq];
+        node->producer = producer->index;
+        node->seq = seq;
+        mpsc_push(producer->queue, &node->node);
+    }
+    return NULL;
+}
+
+// Every node arrives once, and each producer's in order.
+static void test_mpsc_threaded(void) {
+    const uint32_t per_producer = THREADED_COUNT / MPSC_PRODUCERS;
+    MpscQueue queue;
+    TestNode stub = {0};
+    mpsc_init(&queue, &stub.node);
+    TestNode * const nodes =
+        calloc(per_producer * MPSC_PRODUCERS, sizeof(*nodes));
+    if (nodes == NULL) {
+        abort();
+    }
+    MpscProducer producers[MPSC_PRODUCERS];
+    pthread_t threads[MPSC_PRODUCERS];
+    for (uint32_t i = 0; i < MPSC_PRODUCERS; ++i) {
+        producers[i] = (MpscProducer){
+            .queue = &queue,
+            .nodes = nodes + i * per_producer,
+            .index = i,
+        };
+        pthread_create(&threads[i], NULL, mpsc_producer, &producers[i]);
+    }
+    uint32_t next[MPSC_PRODUCERS] = {0};
+    for (uint32_t total = 0; total < per_producer * MPSC_PRODUCERS;) {
+        MpscNode *popped[64];
+        const size_t n = mpsc_pop(&queue, popped, 64);
+        if (n == 0) {
+            sched_yield();
+        }
+        for (size_t i = 0; i < n; ++i) {
+            const TestNode * const node = (const TestNode *)popped[i];
+            CHECK(node->producer < MPSC_PRODUCERS);
+            if (node->producer < MPSC_PRODUCERS) {
+                CHECK(node->seq == next[node->producer]);
+                ++next[node->producer];
+            }
+        }
+        total += (uint32_t)n;
+        mpsc_release(&queue);
+    }
+    for (uint32_t i = 0; i < MPSC_PRODUCERS; ++i) {
+        pthread_join(threads[i], NULL);
+        CHECK(next[i] == per_producer);
+    }
+    free(nodes);
+}
+
+int main(void) {
+    test_ring_capacity();
+    test_ring_full_batch();
+    test_ring_wraparound();
+    test_slab_skip();
+    test_slab_whole();
+    test_slab_wraparound();
+    test_slab_threaded();
+    test_mpsc_batch();
+    test_mpsc_threaded();
+    if (failures > 0) {
+        fprintf(stderr, "%lu checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    puts("queue: all tests passed");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,277 @@
+/*
+ * Copyright (C) 2025 taylor.fish <contact@taylor.fish>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Throughput and latency of queue.h between two threads. Run with
+// `make bench`. Waiting sides yield the CPU, so this also finishes on one
+// core, but the numbers only mean much with at least two free ones.
+#define _GNU_SOURCE
+#include "../queue.h"
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define THROUGHPUT_COUNT 20000000
+#define LATENCY_ROUNDS 200000
+#define MPSC_PRODUCERS 4
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+typedef struct RingBench {
+    SpscRing ring;
+    size_t batch;
+} RingBench;
+
+static void *ring_producer(void * const arg) {
+    RingBench * const bench = arg;
+    uint64_t elems[64];
+    for (uint64_t sent = 0; sent < THROUGHPUT_COUNT;) {
+        size_t count = bench->batch;
+        if (count > THROUGHPUT_COUNT - sent) {
+            count = THROUGHPUT_COUNT - sent;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            elems[i] = sent + i;
+        }
+        const size_t n = spsc_push(&bench->ring, elems, count);
+        if (n == 0) {
+            sched_yield();
+        }
+        sent += n;
+    }
+    return NULL;
+}
+
+static void bench_ring(const size_t batch) {
+    RingBench bench = {
+        .batch = batch,
+    };
+    spsc_init(&bench.ring, sizeof(uint64_t), 4096);
+    const double start = now_seconds();
+    pthread_t thread;
+    pthread_create(&thread, NULL, ring_producer, &bench);
+    uint64_t elems[64];
+    uint64_t received = 0;
+    while (received < THROUGHPUT_COUNT) {
+        const size_t n = spsc_pop(&bench.ring, elems, batch);
+        if (n == 0) {
+            sched_yield();
+        }
+        received += n;
+    }
+    pthread_join(thread, NULL);
+    const double elapsed = now_seconds() - start;
+    printf(
+        "spsc ring, batches of %2zu: %7.1f M elements/s\n",
+        batch,
+        THROUGHPUT_COUNT / elapsed / 1e6
+    );
+    free(bench.ring.data);
+}
+
+typedef struct PingPong {
+    SpscRing to;
+    SpscRing from;
+} PingPong;
+
+static void *pong(void * const arg) {
+    PingPong * const pp = arg;
+    for (uint32_t i = 0; i < LATENCY_ROUNDS; ++i) {
+        uint32_t value;
+        while (spsc_pop(&pp->to, &value, 1) == 0) {
+            sched_yield();
+        }
+        while (spsc_push(&pp->from, &value, 1) == 0) {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+static int compare_doubles(const void * const a, const void * const b) {
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Round trips of one element through a pair of rings.
+static void bench_latency(void) {
+    PingPong pp;
+    spsc_init(&pp.to, sizeof(uint32_t), 64);
+    spsc_init(&pp.from, sizeof(uint32_t), 64);
+    double * const times = malloc(LATENCY_ROUNDS * sizeof(*times));
+    if (times == NULL) {
+        abort();
+    }
+    pthread_t thread;
+    pthread_create(&thread, NULL, pong, &pp);
+    for (uint32_t i = 0; i < LATENCY_ROUNDS; ++i) {
+        const double start = now_seconds();
+        uint32_t value = i;
+        while (spsc_push(&pp.to, &value, 1) == 0) {
+            sched_yield();
+        }
+        while (spsc_pop(&pp.from, &value, 1) == 0) {
+            sched_yield();
+        }
+        times[i] = now_seconds() - start;
+    }
+    pthread_join(thread, NULL);
+    qsort(times, LATENCY_ROUNDS, sizeof(*times), compare_doubles);
+    printf(
+        "spsc ring, round trip: median %.0f ns, 99th percentile %.0f ns\n",
+        times[LATENCY_ROUNDS / 2] * 1e9,
+        times[LATENCY_ROUNDS / 100 * 99] * 1e9
+    );
+    free(times);
+    free(pp.to.data);
+    free(pp.from.data);
+}
+
+typedef struct SlabBench {
+    SpscRing ring;
+    SpscSlab slab;
+} SlabBench;
+
+typedef struct SlabEntry {
+    uint32_t offset;
+    uint32_t length;
+} SlabEntry;
+
+static void *slab_producer(void * const arg) {
+    SlabBench * const bench = arg;
+    for (uint32_t i = 0; i < THROUGHPUT_COUNT / 4;) {
+        SlabEntry entry = {
+            .length = i % 64 + 8,
+        };
+        unsigned char * const data =
+            spsc_slab_reserve(&bench->slab, entry.length, &entry.offset);
+        if (data == NULL) {
+            sched_yield();
+            continue;
+        }
+        memset(data, 0, entry.length);
+        spsc_slab_commit(&bench->slab, entry.offset, entry.length);
+        while (spsc_push(&bench->ring, &entry, 1) == 0) {
+            sched_yield();
+        }
+        ++i;
+    }
+    return NULL;
+}
+
+// Variable-length messages, as stdio2midi queues them.
+static void bench_slab(void) {
+    SlabBench bench;
+    spsc_init(&bench.ring, sizeof(SlabEntry), 4096);
+    spsc_slab_init(&bench.slab, 1 << 18);
+    const double start = now_seconds();
+    pthread_t thread;
+    pthread_create(&thread, NULL, slab_producer, &bench);
+    uint32_t received = 0;
+    while (received < THROUGHPUT_COUNT / 4) {
+        SlabEntry entries[64];
+        const size_t n = spsc_pop(&bench.ring, entries, 64);
+        if (n == 0) {
+            sched_yield();
+        } else {
+            const SlabEntry * const last = &entries[n - 1];
+            spsc_slab_release(&bench.slab, last->offset, last->length);
+        }
+        received += (uint32_t)n;
+    }
+    pthread_join(thread, NULL);
+    const double elapsed = now_seconds() - start;
+    printf(
+        "spsc ring and slab, 8-71 bytes: %7.1f M messages/s\n",
+        THROUGHPUT_COUNT / 4 / elapsed / 1e6
+    );
+    free(bench.ring.data);
+    free(bench.slab.data);
+}
+
+typedef struct MpscBench {
+    MpscQueue *queue;
+    MpscNode *nodes;
+    size_t count;
+} MpscBench;
+
+static void *mpsc_producer(void * const arg) {
+    const MpscBench * const bench = arg;
+    for (size_t i = 0; i < bench->count; ++i) {
+        mpsc_push(bench->queue, &bench->nodes[i]);
+    }
+    return NULL;
+}
+
+static void bench_mpsc(void) {
+    const size_t per_producer = THROUGHPUT_COUNT / 4 / MPSC_PRODUCERS;
+    MpscQueue queue;
+    MpscNode stub;
+    mpsc_init(&queue, &stub);
+    MpscNode * const nodes =
+        calloc(per_producer * MPSC_PRODUCERS, sizeof(*nodes));
+    if (nodes == NULL) {
+        abort();
+    }
+    MpscBench benches[MPSC_PRODUCERS];
+    pthread_t threads[MPSC_PRODUCERS];
+    const double start = now_seconds();
+    for (size_t i = 0; i < MPSC_PRODUCERS; ++i) {
+        benches[i] = (MpscBench){
+            .queue = &queue,
+            .nodes = nodes + i * per_producer,
+            .count = per_producer,
+        };
+        pthread_create(&threads[i], NULL, mpsc_producer, &benches[i]);
+    }
+    for (size_t received = 0; received < per_producer * MPSC_PRODUCERS;) {
+        MpscNode *popped[64];
+        const size_t n = mpsc_pop(&queue, popped, 64);
+        if (n == 0) {
+            sched_yield();
+        }
+        received += n;
+    }
+    for (size_t i = 0; i < MPSC_PRODUCERS; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    const double elapsed = now_seconds() - start;
+    printf(
+        "mpsc queue, %d producers: %7.1f M nodes/s\n",
+        MPSC_PRODUCERS,
+        per_producer * MPSC_PRODUCERS / elapsed / 1e6
+    );
+    free(nodes);
+}
+
+int main(void) {
+    bench_ring(1);
+    bench_ring(16);
+    bench_ring(64);
+    bench_latency();
+    bench_slab();
+    bench_mpsc();
+    return EXIT_SUCCESS;
+}
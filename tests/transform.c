@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2025 taylor.fish <contact@taylor.fish>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// Tests for transform.h. Run with `make check`.
+#include "../transform.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Not assert(), which `make` disables with NDEBUG.
+#define CHECK(cond) check((cond), #cond, __FILE__, __LINE__)
+
+static unsigned long failures;
+
+static void check(
+    const bool ok,
+    const char * const cond,
+    const char * const file,
+    const int line
+) {
+    if (!ok) {
+        fprintf(stderr, "%s:%d: check failed: %s\n", file, line, cond);
+        ++failures;
+    }
+}
+
+// Sets up a transform from the rules in `specs`, ending with NULL.
+static void make_transform(
+    Transform * const transform,
+    const char * const * const specs
+) {
+    transform_init(transform);
+    for (size_t i = 0; specs[i] != NULL; ++i) {
+        CHECK(transform_add_rule(transform, specs[i]));
+    }
+}
+
+// A note-on (0-based `ch`) after the transform, or 0 if it was dropped.
+static uint32_t note_on(
+    const Transform * const transform,
+    const unsigned ch,
+    const uint8_t note,
+    const uint8_t velocity
+) {
+    uint8_t message[] = {(uint8_t)(0x90 | ch), note, velocity};
+    if (!transform_apply(transform, message, sizeof(message))) {
+        return 0;
+    }
+    return (uint32_t)message[0] << 16 | (uint32_t)message[1] << 8 |
+        message[2];
+}
+
+static void test_channel_chain(void) {
+    static Transform transform;
+    make_transform(
+        &transform,
+        (const char *[]){"channel@1=2", "channel@2=3", NULL}
+    );
+    // Channel 1 goes to 2, then on to 3; channel 2 also goes to 3.
+    CHECK(note_on(&transform, 0, 60, 100) == 0x923c64);
+    CHECK(note_on(&transform, 1, 60, 100) == 0x923c64);
+    CHECK(note_on(&transform, 2, 60, 100) == 0x923c64);
+    CHECK(note_on(&transform, 3, 60, 100) == 0x933c64);
+}
+
+static void test_rule_after_channel(void) {
+    static Transform transform;
+    make_transform(
+        &transform,
+        (const char *[]){
+            "channel@1=2",
+            "transpose@2=5",
+            "velocity@2=fixed:10",
+            NULL,
+        }
+    );
+    // Moved to channel 2 first, so the channel 2 rules apply.
+    CHECK(note_on(&transform, 0, 60, 100) == 0x91410a);
+    CHECK(note_on(&transform, 1, 60, 100) == 0x91410a);
+    CHECK(note_on(&transform, 2, 60, 100) == 0x923c64);
+}
+
+static void test_rule_before_channel(void) {
+    static Transform transform;
+    make_transform(
+        &transform,
+        (const char *[]){"transpose@2=5", "channel@1=2", NULL}
+    );
+    // Channel 1 was not on channel 2 when the transposition was added.
+    CHECK(note_on(&transform, 0, 60, 100) == 0x913c64);
+    CHECK(note_on(&transform, 1, 60, 100) == 0x914164);
+}
+
+static void test_drop(void) {
+    static Transform transform;
+    make_transform(&transform, (const char *[]){"transpose=100", NULL});
+    CHECK(note_on(&transform, 0, 20, 100) == 0x907864);
+    CHECK(note_on(&transform, 0, 28, 100) == 0);
+}
+
+int main(void) {
+    test_channel_chain();
+    test_rule_after_channel();
+    test_rule_before_channel();
+    test_drop();
+    if (failures > 0) {
+        fprintf(stderr, "%lu checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    puts("transform: all tests passed");
+    return EXIT_SUCCESS;
+}
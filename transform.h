@@ -0,0 +1,256 @@
+/*
+ * Copyright (C) 2025 taylor.fish <contact@taylor.fish>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+// MIDI transforms (transposition, channel remapping and velocity curves)
+// shared by the jacl MIDI clients. Rules are composed into lookup tables
+// when they are added, so applying any number of them to a message costs a
+// few table lookups.
+#ifndef JACL_TRANSFORM_H
+#define JACL_TRANSFORM_H
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Marks a note that was transposed out of range.
+#define TRANSFORM_DROP 0x80
+
+#define TRANSFORM_USAGE "\
+  -t, --transform <rule>\n\
+                      Transform channel messages. May be given multiple\n\
+                      times; rules apply in order. <rule> is one of:\n\
+                        transpose[@<ch>]=<semitones>\n\
+                                        Transpose notes and polyphonic\n\
+                                        pressure. Notes moved out of\n\
+                                        range are dropped.\n\
+                        channel[@<ch>]=<ch>\n\
+                                        Move messages to another channel.\n\
+                        velocity[@<ch>]=fixed:<v>\n\
+                        velocity[@<ch>]=lin:<min>:<max>\n\
+                        velocity[@<ch>]=gamma:<g>\n\
+                                        Replace note-on velocities,\n\
+                                        map 1..127 linearly to\n\
+                                        <min>..<max>, or apply the curve\n\
+                                        127 * (v / 127)^<g>.\n\
+                      '@<ch>' (1-16) restricts a rule to messages on that\n\
+                      channel after the rules before it.\n\
+"
+
+typedef struct Transform {
+    // Indexed by the channel the message arrived on. A rule for '@<ch>'
+    // changes the entries of every arrival channel currently mapped to
+    // <ch>, so that rules compose in order.
+    uint8_t channel[16];
+    uint8_t note[16][128];
+    uint8_t velocity[16][128];
+} Transform;
+
+static inline void transform_init(Transform * const transform) {
+    for (int ch = 0; ch < 16; ++ch) {
+        transform->channel[ch] = (uint8_t)ch;
+        for (int i = 0; i < 128; ++i) {
+            transform->note[ch][i] = (uint8_t)i;
+            transform->velocity[ch][i] = (uint8_t)i;
+        }
+    }
+}
+
+static inline uint8_t transform_velocity(
+    const char * const kind,
+    const float * const args,
+    const uint8_t velocity
+) {
+    float value;
+    if (strcmp(kind, "fixed") == 0) {
+        value = args[0];
+    } else if (strcmp(kind, "lin") == 0) {
+        value = args[0] + (args[1] - args[0]) * (velocity - 1) / 126.0f;
+    } else {
+        value = 127 * powf(velocity / 127.0f, args[0]);
+    }
+    // Velocity 0 would turn a note-on into a note-off.
+    const long rounded = lroundf(value);
+    return (uint8_t)(rounded < 1 ? 1 : rounded > 127 ? 127 : rounded);
+}
+
+// Parses a velocity curve ("<kind>:<args>") into `kind` and `args`.
+static inline bool transform_parse_curve(
+    const char * const spec,
+    char * const kind,
+    float * const args
+) {
+    static const struct {
+        const char *name;
+        int nargs;
+    } kinds[] = {
+        {"fixed", 1},
+        {"lin", 2},
+        {"gamma", 1},
+    };
+    const char * const colon = strchr(spec, ':');
+    if (colon == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(kinds) / sizeof(*kinds); ++i) {
+        const size_t len = strlen(kinds[i].name);
+        if ((size_t)(colon - spec) != len ||
+            strncmp(spec, kinds[i].name, len) != 0) {
+            continue;
+        }
+        const char *p = colon + 1;
+        for (int arg = 0; arg < kinds[i].nargs; ++arg) {
+            char *endptr = NULL;
+            args[arg] = strtof(p, &endptr);
+            if (endptr == p) {
+                return false;
+            }
+            const char expected = arg + 1 < kinds[i].nargs ? ':' : '\0';
+            if (*endptr != expected) {
+                return false;
+            }
+            p = endptr + 1;
+        }
+        strcpy(kind, kinds[i].name);
+        return kinds[i].nargs < 2 || args[0] <= args[1];
+    }
+    return false;
+}
+
+// Whether messages that arrived on channel `ch` are on channel `match`
+// under the rules so far. A `match` of -1 matches every channel.
+static inline bool transform_matches(
+    const Transform * const transform,
+    const int match,
+    const int ch
+) {
+    return match < 0 || transform->channel[ch] == match;
+}
+
+// Composes the rule `spec` into `transform`. Prints an error and returns
+// false if it is invalid.
+static inline bool transform_add_rule(
+    Transform * const transform,
+    const char * const spec
+) {
+    const char * const eq = strchr(spec, '=');
+    if (eq == NULL) {
+        fprintf(stderr, "bad transform rule: %s\n", spec);
+        return false;
+    }
+    const char *name_end = eq;
+    // The channel messages must be on for the rule to apply, or -1 for all.
+    int match = -1;
+    const char * const at = memchr(spec, '@', eq - spec);
+    if (at != NULL) {
+        char *endptr = NULL;
+        const long ch = strtol(at + 1, &endptr, 10);
+        if (endptr != eq || ch < 1 || ch > 16) {
+            fprintf(stderr, "bad channel in transform rule: %s\n", spec);
+            return false;
+        }
+        match = (int)ch - 1;
+        name_end = at;
+    }
+    const size_t name_len = name_end - spec;
+    const char * const value = eq + 1;
+    char *endptr = NULL;
+
+    if (name_len == 9 && strncmp(spec, "transpose", 9) == 0) {
+        const long semitones = strtol(value, &endptr, 10);
+        if (endptr == value || *endptr != '\0') {
+            fprintf(stderr, "bad transposition: %s\n", spec);
+            return false;
+        }
+        for (int ch = 0; ch < 16; ++ch) {
+            if (!transform_matches(transform, match, ch)) {
+                continue;
+            }
+            for (int i = 0; i < 128; ++i) {
+                const int note = transform->note[ch][i];
+                const long moved = note + semitones;
+                transform->note[ch][i] =
+                    note & TRANSFORM_DROP || moved < 0 || moved > 127 ?
+                    TRANSFORM_DROP : (uint8_t)moved;
+            }
+        }
+        return true;
+    }
+    if (name_len == 7 && strncmp(spec, "channel", 7) == 0) {
+        const long to = strtol(value, &endptr, 10);
+        if (endptr == value || *endptr != '\0' || to < 1 || to > 16) {
+            fprintf(stderr, "bad channel: %s\n", spec);
+            return false;
+        }
+        for (int ch = 0; ch < 16; ++ch) {
+            if (!transform_matches(transform, match, ch)) {
+                continue;
+            }
+            transform->channel[ch] = (uint8_t)(to - 1);
+        }
+        return true;
+    }
+    if (name_len == 8 && strncmp(spec, "velocity", 8) == 0) {
+        char kind[8];
+        float args[2];
+        if (!transform_parse_curve(value, kind, args)) {
+            fprintf(stderr, "bad velocity curve: %s\n", spec);
+            return false;
+        }
+        for (int ch = 0; ch < 16; ++ch) {
+            if (!transform_matches(transform, match, ch)) {
+                continue;
+            }
+            for (int i = 1; i < 128; ++i) {
+                uint8_t * const velocity = &transform->velocity[ch][i];
+                *velocity = transform_velocity(kind, args, *velocity);
+            }
+        }
+        return true;
+    }
+    fprintf(stderr, "unknown transform: %.*s\n", (int)name_len, spec);
+    return false;
+}
+
+// Transforms `message` in place. Returns false if it should be dropped.
+static inline bool transform_apply(
+    const Transform * const transform,
+    uint8_t * const message,
+    const size_t length
+) {
+    if (length == 0 || message[0] < 0x80 || message[0] >= 0xf0) {
+        return true;
+    }
+    const unsigned type = message[0] & 0xf0;
+    const unsigned ch = message[0] & 0x0f;
+    message[0] = (uint8_t)(type | transform->channel[ch]);
+    if (type > 0xa0 || length < 3) {
+        return true;
+    }
+    // Note off, note on, and polyphonic pressure.
+    const uint8_t note = transform->note[ch][message[1] & 0x7f];
+    message[1] = note;
+    if (type == 0x90) {
+        message[2] = transform->velocity[ch][message[2] & 0x7f];
+    }
+    return !(note & TRANSFORM_DROP);
+}
+
+#endif